@@ -0,0 +1,22 @@
+#include "aligned_array.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+void* AlignedAlloc(size_t bytes, size_t alignment) {
+    void* raw = std::calloc(1, bytes + alignment + sizeof(void*));
+    if (!raw) return nullptr;
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw) + sizeof(void*);
+    uintptr_t aligned = (start + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void AlignedFree(void* ptr) {
+    if (ptr) std::free(reinterpret_cast<void**>(ptr)[-1]);
+}
+
+void AlignedAllocFailed(size_t bytes) {
+    std::fprintf(stderr, "out of memory allocating %zu bytes of particle storage\n", bytes);
+    std::abort();
+}
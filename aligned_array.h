@@ -0,0 +1,76 @@
+#ifndef ALIGNED_ARRAY_H
+#define ALIGNED_ARRAY_H
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+const size_t PARTICLE_ALIGNMENT = 64;
+const size_t PARTICLE_LANE_PADDING = 16;
+
+// count rounded up to a whole number of PARTICLE_LANE_PADDING lanes.
+inline size_t PaddedCapacity(size_t count) {
+    return (count + PARTICLE_LANE_PADDING - 1) / PARTICLE_LANE_PADDING * PARTICLE_LANE_PADDING;
+}
+
+// Capacity for scratch that has to hold count elements: the current one if it
+// does, otherwise at least twice it, so a count that creeps up reallocates
+// only a logarithmic number of times.
+inline size_t GrownCapacity(size_t capacity, size_t count) {
+    if (count <= capacity) return capacity;
+    return PaddedCapacity(count > 2 * capacity ? count : 2 * capacity);
+}
+
+void* AlignedAlloc(size_t bytes, size_t alignment);
+void AlignedFree(void* ptr);
+// Reports an allocation AlignedAlloc could not satisfy and aborts.
+[[noreturn]] void AlignedAllocFailed(size_t bytes);
+
+// Contiguous, cache-line aligned storage for one particle attribute. Capacity is
+// padded to a whole number of 16-float lanes so vector kernels never straddle
+// the end of an allocation. Fresh storage is zeroed by calloc, so reserving a
+// large capacity only costs address space until the pages are written.
+template <typename T>
+class AlignedArray {
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedArray only holds trivially copyable types");
+public:
+    AlignedArray() : data_(nullptr), capacity_(0) {}
+    AlignedArray(const AlignedArray& other) : data_(nullptr), capacity_(0) {
+        Reallocate(other.capacity_, 0);
+        if (other.capacity_ > 0) std::memcpy(data_, other.data_, other.capacity_ * sizeof(T));
+    }
+    AlignedArray(AlignedArray&& other) noexcept : data_(other.data_), capacity_(other.capacity_) {
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+    AlignedArray& operator=(AlignedArray other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+        return *this;
+    }
+    ~AlignedArray() { AlignedFree(data_); }
+
+    void Reallocate(size_t capacity, size_t keep) {
+        if (capacity == capacity_) return;
+        T* fresh = capacity > 0 ? static_cast<T*>(AlignedAlloc(capacity * sizeof(T), PARTICLE_ALIGNMENT)) : nullptr;
+        if (capacity > 0 && !fresh) AlignedAllocFailed(capacity * sizeof(T));
+        if (keep > capacity) keep = capacity;
+        if (keep > 0) std::memcpy(fresh, data_, keep * sizeof(T));
+        AlignedFree(data_);
+        data_ = fresh;
+        capacity_ = capacity;
+    }
+
+    T* Data() { return data_; }
+    const T* Data() const { return data_; }
+    size_t Capacity() const { return capacity_; }
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+
+private:
+    T* data_;
+    size_t capacity_;
+};
+
+#endif
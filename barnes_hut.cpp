@@ -0,0 +1,440 @@
+#include "barnes_hut.h"
+#include "frame_profiler.h"
+#include "morton_order.h"
+#include "particle_system.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+
+// Nodes per task when splitting a level or summing its masses.
+static const size_t QUADTREE_NODES_PER_TASK = 256;
+// Pending nodes during a walk: at most three siblings per level plus the
+// children of the node being opened.
+static const size_t QUADTREE_STACK_SIZE = 3 * QUADTREE_MAX_DEPTH + 4;
+
+// Splits the slots [begin, end), whose keys agree above shift + 2, into its
+// quadrants: quadrant q is [bounds[q], bounds[q + 1]). Returns how many are
+// non-empty.
+static uint32_t SplitQuadrants(const uint32_t* keys, uint32_t begin, uint32_t end, unsigned shift, uint32_t bounds[5]) {
+    uint32_t children = 0;
+    bounds[0] = begin;
+    for (uint32_t q = 0; q < 4; q++) {
+        const uint32_t* split = std::partition_point(keys + bounds[q], keys + end, [&](uint32_t key) { return ((key >> shift) & 3) <= q; });
+        bounds[q + 1] = static_cast<uint32_t>(split - keys);
+        if (bounds[q + 1] > bounds[q]) children++;
+    }
+    return children;
+}
+
+void BuildQuadTree(QuadTree& tree, const ParticleSystem& particles) {
+    const size_t count = particles.Size();
+    tree.members = count;
+    tree.levels = 0;
+    if (count == 0) return;
+    if (tree.keys.Capacity() < count) {
+        const size_t capacity = GrownCapacity(tree.keys.Capacity(), count);
+        tree.keys.Reallocate(capacity, 0);
+        tree.particle.Reallocate(capacity, 0);
+        tree.x.Reallocate(capacity, 0);
+        tree.y.Reallocate(capacity, 0);
+        tree.mass.Reallocate(capacity, 0);
+    }
+    const size_t chunks = (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (tree.chunkBounds.Capacity() < 4 * chunks) tree.chunkBounds.Reallocate(4 * chunks, 0);
+
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    float* bounds = tree.chunkBounds.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float minX = x[begin], maxX = x[begin], minY = y[begin], maxY = y[begin];
+        for (size_t i = begin; i < end; i++) {
+            minX = x[i] < minX ? x[i] : minX;
+            maxX = x[i] > maxX ? x[i] : maxX;
+            minY = y[i] < minY ? y[i] : minY;
+            maxY = y[i] > maxY ? y[i] : maxY;
+        }
+        float* chunk = bounds + 4 * (begin / PARALLEL_CHUNK_SIZE);
+        chunk[0] = minX;
+        chunk[1] = maxX;
+        chunk[2] = minY;
+        chunk[3] = maxY;
+    });
+    float minX = bounds[0], maxX = bounds[1], minY = bounds[2], maxY = bounds[3];
+    for (size_t chunk = 1; chunk < chunks; chunk++) {
+        minX = std::min(minX, bounds[4 * chunk]);
+        maxX = std::max(maxX, bounds[4 * chunk + 1]);
+        minY = std::min(minY, bounds[4 * chunk + 2]);
+        maxY = std::max(maxY, bounds[4 * chunk + 3]);
+    }
+    float size = std::max(maxX - minX, maxY - minY);
+    if (!(size > 0.0f) || !std::isfinite(size)) size = 1.0f;
+    tree.originX = std::isfinite(minX) ? minX : 0.0f;
+    tree.originY = std::isfinite(minY) ? minY : 0.0f;
+    tree.size = size;
+
+    // Positions map onto 65536 cells a side; the largest clamps into the
+    // last cell, and NaN into the first.
+    const float originX = tree.originX;
+    const float originY = tree.originY;
+    const float cellsPerPixel = 65536.0f / size;
+    uint32_t* keys = tree.keys.Data();
+    uint32_t* member = tree.particle.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float column = (x[i] - originX) * cellsPerPixel;
+            float row = (y[i] - originY) * cellsPerPixel;
+            column = column > 0.0f ? (column < 65535.0f ? column : 65535.0f) : 0.0f;
+            row = row > 0.0f ? (row < 65535.0f ? row : 65535.0f) : 0.0f;
+            keys[i] = MortonKey(static_cast<uint32_t>(column), static_cast<uint32_t>(row));
+            member[i] = static_cast<uint32_t>(i);
+        }
+    });
+    RadixSortPairs(keys, member, count, 32, tree.sort);
+
+    const float* radius = particles.radius.Data();
+    float* sortedX = tree.x.Data();
+    float* sortedY = tree.y.Data();
+    float* sortedMass = tree.mass.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; slot++) {
+            const uint32_t i = member[slot];
+            sortedX[slot] = x[i];
+            sortedY[slot] = y[i];
+            sortedMass[slot] = radius[i] * radius[i];
+        }
+    });
+
+    if (tree.nodes.Capacity() == 0) tree.nodes.Reallocate(count / QUADTREE_LEAF_SIZE * 2 + 1, 0);
+    tree.nodes[0] = {0.0f, 0.0f, 0.0f, size, 0, static_cast<uint32_t>(count), 0, 0};
+    tree.levelStart[0] = 0;
+    tree.levelStart[1] = 1;
+    size_t level = 0;
+    for (;; level++) {
+        const size_t first = tree.levelStart[level];
+        const size_t last = tree.levelStart[level + 1];
+        const unsigned shift = static_cast<unsigned>(30 - 2 * level);
+        QuadNode* nodes = tree.nodes.Data();
+        ParallelFor(last - first, QUADTREE_NODES_PER_TASK, [&](size_t begin, size_t end) {
+            for (size_t n = first + begin; n < first + end; n++) {
+                QuadNode& node = nodes[n];
+                uint32_t quadrants[5];
+                const bool leaf = node.end - node.begin <= QUADTREE_LEAF_SIZE || level == QUADTREE_MAX_DEPTH;
+                node.childCount = leaf ? 0 : SplitQuadrants(keys, node.begin, node.end, shift, quadrants);
+            }
+        });
+        // Children go after the level in their parents' order.
+        size_t next = last;
+        for (size_t n = first; n < last; n++) {
+            nodes[n].firstChild = static_cast<uint32_t>(next);
+            next += nodes[n].childCount;
+        }
+        if (next == last) break;
+        if (tree.nodes.Capacity() < next) {
+            tree.nodes.Reallocate(std::max(next, 2 * tree.nodes.Capacity()), last);
+            nodes = tree.nodes.Data();
+        }
+        const float childSize = std::ldexp(size, -static_cast<int>(level + 1));
+        ParallelFor(last - first, QUADTREE_NODES_PER_TASK, [&](size_t begin, size_t end) {
+            for (size_t n = first + begin; n < first + end; n++) {
+                const QuadNode& node = nodes[n];
+                if (node.childCount == 0) continue;
+                uint32_t quadrants[5];
+                SplitQuadrants(keys, node.begin, node.end, shift, quadrants);
+                uint32_t child = node.firstChild;
+                for (uint32_t q = 0; q < 4; q++) {
+                    if (quadrants[q + 1] == quadrants[q]) continue;
+                    nodes[child++] = {0.0f, 0.0f, 0.0f, childSize, quadrants[q], quadrants[q + 1], 0, 0};
+                }
+            }
+        });
+        tree.levelStart[level + 2] = next;
+    }
+    tree.levels = level + 1;
+
+    // Masses from the leaves up: a leaf sums its particles, a parent its
+    // children, so every node is summed in the same order on any machine.
+    for (size_t depth = tree.levels; depth-- > 0;) {
+        const size_t first = tree.levelStart[depth];
+        QuadNode* nodes = tree.nodes.Data();
+        ParallelFor(tree.levelStart[depth + 1] - first, QUADTREE_NODES_PER_TASK, [&](size_t begin, size_t end) {
+            for (size_t n = first + begin; n < first + end; n++) {
+                QuadNode& node = nodes[n];
+                float mass = 0.0f, momentX = 0.0f, momentY = 0.0f;
+                if (node.childCount == 0) {
+                    for (uint32_t slot = node.begin; slot < node.end; slot++) {
+                        mass += sortedMass[slot];
+                        momentX += sortedMass[slot] * sortedX[slot];
+                        momentY += sortedMass[slot] * sortedY[slot];
+                    }
+                } else {
+                    for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+                        mass += nodes[child].mass;
+                        momentX += nodes[child].mass * nodes[child].x;
+                        momentY += nodes[child].mass * nodes[child].y;
+                    }
+                }
+                node.mass = mass;
+                node.x = mass > 0.0f ? momentX / mass : sortedX[node.begin];
+                node.y = mass > 0.0f ? momentY / mass : sortedY[node.begin];
+            }
+        });
+    }
+}
+
+void QuadTreeField(const QuadTree& tree, float x, float y, float theta, float& fx, float& fy) {
+    fx = 0.0f;
+    fy = 0.0f;
+    if (tree.levels == 0) return;
+    const QuadNode* nodes = tree.nodes.Data();
+    const float* sortedX = tree.x.Data();
+    const float* sortedY = tree.y.Data();
+    const float* sortedMass = tree.mass.Data();
+    const float thetaSquared = theta * theta;
+    const float softening = PAIR_FORCE_SOFTENING * PAIR_FORCE_SOFTENING;
+    uint32_t stack[QUADTREE_STACK_SIZE];
+    size_t pending = 0;
+    stack[pending++] = 0;
+    while (pending > 0) {
+        const QuadNode& node = nodes[stack[--pending]];
+        const float dx = node.x - x;
+        const float dy = node.y - y;
+        const float distanceSquared = dx * dx + dy * dy;
+        if (node.size * node.size < thetaSquared * distanceSquared) {
+            const float r2 = distanceSquared + softening;
+            const float strength = node.mass / (r2 * std::sqrt(r2));
+            fx += strength * dx;
+            fy += strength * dy;
+        } else if (node.childCount == 0) {
+            for (uint32_t slot = node.begin; slot < node.end; slot++) {
+                const float sx = sortedX[slot] - x;
+                const float sy = sortedY[slot] - y;
+                const float r2 = sx * sx + sy * sy + softening;
+                const float strength = sortedMass[slot] / (r2 * std::sqrt(r2));
+                fx += strength * sx;
+                fy += strength * sy;
+            }
+        } else {
+            for (uint32_t child = node.firstChild + node.childCount; child-- > node.firstChild;) stack[pending++] = child;
+        }
+    }
+}
+
+// Masses one group's walk collects before the group sums them.
+static const size_t PAIR_LIST_SIZE = 512;
+// Particles that walk the tree together. Bigger groups open more nodes but
+// share each walk, and each mass on the list, between more lanes.
+static const size_t PAIR_GROUP_SIZE = 64;
+static const size_t PAIR_GROUP_LANES = 16;
+
+// A group's particles, padded to a whole number of vectors with copies of
+// the first.
+struct PairGroup {
+    float x[PAIR_GROUP_SIZE];
+    float y[PAIR_GROUP_SIZE];
+    float sumX[PAIR_GROUP_SIZE];
+    float sumY[PAIR_GROUP_SIZE];
+    size_t count;
+};
+
+struct PairList {
+    float x[PAIR_LIST_SIZE];
+    float y[PAIR_LIST_SIZE];
+    float mass[PAIR_LIST_SIZE];
+    size_t count;
+};
+
+static void SumPairListScalar(const PairList& list, PairGroup& group) {
+    const float softening = PAIR_FORCE_SOFTENING * PAIR_FORCE_SOFTENING;
+    for (size_t lane = 0; lane < group.count; lane++) {
+        float fx = group.sumX[lane], fy = group.sumY[lane];
+        for (size_t k = 0; k < list.count; k++) {
+            const float dx = list.x[k] - group.x[lane];
+            const float dy = list.y[k] - group.y[lane];
+            const float r2 = dx * dx + dy * dy + softening;
+            const float strength = list.mass[k] / (r2 * std::sqrt(r2));
+            fx += strength * dx;
+            fy += strength * dy;
+        }
+        group.sumX[lane] = fx;
+        group.sumY[lane] = fy;
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+// Eight particles a vector against one broadcast mass at a time.
+__attribute__((target("avx2"))) static void SumPairListAvx2(const PairList& list, PairGroup& group) {
+    const __m256 softening = _mm256_set1_ps(PAIR_FORCE_SOFTENING * PAIR_FORCE_SOFTENING);
+    for (size_t lane = 0; lane < group.count; lane += 8) {
+        const __m256 gx = _mm256_loadu_ps(group.x + lane);
+        const __m256 gy = _mm256_loadu_ps(group.y + lane);
+        __m256 fx = _mm256_loadu_ps(group.sumX + lane);
+        __m256 fy = _mm256_loadu_ps(group.sumY + lane);
+        for (size_t k = 0; k < list.count; k++) {
+            const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(list.x[k]), gx);
+            const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(list.y[k]), gy);
+            const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), softening);
+            const __m256 strength = _mm256_div_ps(_mm256_set1_ps(list.mass[k]), _mm256_mul_ps(r2, _mm256_sqrt_ps(r2)));
+            fx = _mm256_add_ps(fx, _mm256_mul_ps(strength, dx));
+            fy = _mm256_add_ps(fy, _mm256_mul_ps(strength, dy));
+        }
+        _mm256_storeu_ps(group.sumX + lane, fx);
+        _mm256_storeu_ps(group.sumY + lane, fy);
+    }
+}
+
+// Sixteen particles a vector.
+QPS_AVX512_TARGET static void SumPairListAvx512(const PairList& list, PairGroup& group) {
+    const __m512 softening = _mm512_set1_ps(PAIR_FORCE_SOFTENING * PAIR_FORCE_SOFTENING);
+    for (size_t lane = 0; lane < group.count; lane += 16) {
+        const __m512 gx = _mm512_loadu_ps(group.x + lane);
+        const __m512 gy = _mm512_loadu_ps(group.y + lane);
+        __m512 fx = _mm512_loadu_ps(group.sumX + lane);
+        __m512 fy = _mm512_loadu_ps(group.sumY + lane);
+        for (size_t k = 0; k < list.count; k++) {
+            const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(list.x[k]), gx);
+            const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(list.y[k]), gy);
+            const __m512 r2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), softening);
+            const __m512 strength = _mm512_div_ps(_mm512_set1_ps(list.mass[k]), _mm512_mul_ps(r2, _mm512_maskz_sqrt_ps(0xFFFF, r2)));
+            fx = _mm512_add_ps(fx, _mm512_mul_ps(strength, dx));
+            fy = _mm512_add_ps(fy, _mm512_mul_ps(strength, dy));
+        }
+        _mm512_storeu_ps(group.sumX + lane, fx);
+        _mm512_storeu_ps(group.sumY + lane, fy);
+    }
+}
+
+#endif
+
+static void SumPairList(PairList& list, PairGroup& group, SimdLevel level) {
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        SumPairListAvx512(list, group);
+    } else if (level == SIMD_AVX2) {
+        SumPairListAvx2(list, group);
+    } else {
+        SumPairListScalar(list, group);
+    }
+#else
+    (void)level;
+    SumPairListScalar(list, group);
+#endif
+    list.count = 0;
+}
+
+static void AppendPair(PairList& list, PairGroup& group, SimdLevel level, float x, float y, float mass) {
+    if (list.count == PAIR_LIST_SIZE) SumPairList(list, group, level);
+    list.x[list.count] = x;
+    list.y[list.count] = y;
+    list.mass[list.count] = mass;
+    list.count++;
+}
+
+// Walks the tree once for the particles in slots [begin, end), at most a
+// group's worth, and adds scale times their field to ax and ay.
+static void WalkGroup(const QuadTree& tree, uint32_t begin, uint32_t end, float thetaSquared, float scale, SimdLevel level, float* ax, float* ay) {
+    const QuadNode* nodes = tree.nodes.Data();
+    const float* sortedX = tree.x.Data();
+    const float* sortedY = tree.y.Data();
+    const float* sortedMass = tree.mass.Data();
+    PairGroup group;
+    PairList list;
+    group.count = end - begin;
+    list.count = 0;
+    float minX = sortedX[begin], maxX = sortedX[begin], minY = sortedY[begin], maxY = sortedY[begin];
+    const size_t lanes = (group.count + PAIR_GROUP_LANES - 1) / PAIR_GROUP_LANES * PAIR_GROUP_LANES;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        const uint32_t slot = lane < group.count ? begin + static_cast<uint32_t>(lane) : begin;
+        group.x[lane] = sortedX[slot];
+        group.y[lane] = sortedY[slot];
+        group.sumX[lane] = 0.0f;
+        group.sumY[lane] = 0.0f;
+        minX = std::min(minX, group.x[lane]);
+        maxX = std::max(maxX, group.x[lane]);
+        minY = std::min(minY, group.y[lane]);
+        maxY = std::max(maxY, group.y[lane]);
+    }
+
+    uint32_t stack[QUADTREE_STACK_SIZE];
+    size_t pending = 0;
+    stack[pending++] = 0;
+    while (pending > 0) {
+        const QuadNode& node = nodes[stack[--pending]];
+        // Distance from the centre of mass to the nearest point of the group's
+        // box, so the node passes for every particle in the group.
+        const float dx = std::max(std::max(minX - node.x, node.x - maxX), 0.0f);
+        const float dy = std::max(std::max(minY - node.y, node.y - maxY), 0.0f);
+        if (node.size * node.size < thetaSquared * (dx * dx + dy * dy)) {
+            AppendPair(list, group, level, node.x, node.y, node.mass);
+        } else if (node.childCount == 0) {
+            for (uint32_t slot = node.begin; slot < node.end; slot++) AppendPair(list, group, level, sortedX[slot], sortedY[slot], sortedMass[slot]);
+        } else {
+            for (uint32_t child = node.firstChild + node.childCount; child-- > node.firstChild;) stack[pending++] = child;
+        }
+    }
+    SumPairList(list, group, level);
+
+    const uint32_t* member = tree.particle.Data();
+    for (size_t lane = 0; lane < group.count; lane++) {
+        ax[member[begin + lane]] = group.sumX[lane] * scale;
+        ay[member[begin + lane]] = group.sumY[lane] * scale;
+    }
+}
+
+void ComputePairAcceleration(QuadTree& tree, float strength, float theta) {
+    const SimdLevel level = ActiveSimdLevel();
+    if (tree.levels == 0) return;
+    if (tree.ax.Capacity() < tree.keys.Capacity()) {
+        tree.ax.Reallocate(tree.keys.Capacity(), 0);
+        tree.ay.Reallocate(tree.keys.Capacity(), 0);
+    }
+    const QuadNode* nodes = tree.nodes.Data();
+    const float scale = nodes[0].mass > 0.0f ? strength / nodes[0].mass : 0.0f;
+    const float thetaSquared = theta * theta;
+    float* ax = tree.ax.Data();
+    float* ay = tree.ay.Data();
+    // Groups are the largest nodes with at most a group's worth of
+    // particles. Nodes within a level are in slot order, so a task's groups
+    // are mostly neighbours and walk the same parts of the tree. Leaves at the
+    // deepest level can hold more than a group, and walk in pieces.
+    ParallelFor(tree.levelStart[tree.levels], QUADTREE_NODES_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t n = begin; n < end; n++) {
+            const QuadNode& node = nodes[n];
+            if (node.end - node.begin <= PAIR_GROUP_SIZE) {
+                if (n == 0) WalkGroup(tree, node.begin, node.end, thetaSquared, scale, level, ax, ay);
+                continue;
+            }
+            if (node.childCount == 0) {
+                for (uint32_t first = node.begin; first < node.end; first += PAIR_GROUP_SIZE) {
+                    const uint32_t last = node.end - first < PAIR_GROUP_SIZE ? node.end : first + static_cast<uint32_t>(PAIR_GROUP_SIZE);
+                    WalkGroup(tree, first, last, thetaSquared, scale, level, ax, ay);
+                }
+                continue;
+            }
+            for (uint32_t child = node.firstChild; child < node.firstChild + node.childCount; child++) {
+                const QuadNode& group = nodes[child];
+                if (group.end - group.begin <= PAIR_GROUP_SIZE) WalkGroup(tree, group.begin, group.end, thetaSquared, scale, level, ax, ay);
+            }
+        }
+    });
+}
+
+void UpdatePairForces(ParticleSystem& particles) {
+    ScopedProfile profile(PROFILE_PAIR_FORCES);
+    QuadTree& tree = particles.tree;
+    BuildQuadTree(tree, particles);
+    if (tree.levels == 0) return;
+    ComputePairAcceleration(tree, particles.pairForce, particles.theta);
+    const float* ax = tree.ax.Data();
+    const float* ay = tree.ay.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    const float dt = particles.dt;
+    ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            vx[i] += ax[i] * dt;
+            vy[i] += ay[i] * dt;
+        }
+    });
+}
@@ -0,0 +1,97 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include "aligned_array.h"
+#include "morton_order.h"
+#include <cstddef>
+#include <cstdint>
+
+class ParticleSystem;
+
+// Levels below the root of a QuadTree; 16 levels use every bit of the 32-bit
+// Morton keys.
+const size_t QUADTREE_MAX_DEPTH = 16;
+
+// A square of a QuadTree: the total mass of the particles in it and their
+// centre of mass, the slots they occupy, and its non-empty children, which
+// are stored next to each other. Leaves have no children.
+struct QuadNode {
+    float x;
+    float y;
+    float mass;
+    float size;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t firstChild;
+    uint32_t childCount;
+};
+
+// Barnes-Hut quadtree over the particle positions, rebuilt every step. The
+// particles are sorted by Morton key, so every node's particles are one range
+// of slots, and the nodes live in one array, level after level, with each
+// level's children allocated by a prefix sum over its parents.
+struct QuadTree {
+    // Per slot, in key order: the key, the particle and a copy of its
+    // position and mass.
+    AlignedArray<uint32_t> keys;
+    AlignedArray<uint32_t> particle;
+    AlignedArray<float> x;
+    AlignedArray<float> y;
+    AlignedArray<float> mass;
+    RadixSortScratch sort;
+    AlignedArray<QuadNode> nodes;
+    // Node index where each level starts, and one past the last level.
+    size_t levelStart[QUADTREE_MAX_DEPTH + 2] = {};
+    size_t levels = 0;
+    // Per particle: the acceleration from ComputePairAcceleration.
+    AlignedArray<float> ax;
+    AlignedArray<float> ay;
+    // Per chunk: the smallest and largest x and y.
+    AlignedArray<float> chunkBounds;
+    size_t members = 0;
+    float originX = 0.0f;
+    float originY = 0.0f;
+    float size = 0.0f;
+};
+
+// Nodes with at most this many particles are not split further.
+const size_t QUADTREE_LEAF_SIZE = 16;
+
+// Plummer softening length in px: the pair force peaks at about this
+// distance instead of diverging when two particles meet.
+const float PAIR_FORCE_SOFTENING = 5.0f;
+
+// A pair strength at which the whole system, 500 px away, pulls as hard as
+// the centre attraction: 0.05 px/frame^2.
+const float PAIR_FORCE_GRAVITY = 0.05f * 500.0f * 500.0f;
+
+// Rebuilds tree over the particles in [0, particles.Size()): Morton keys on
+// a square around their bounding box, a radix sort by key, then the nodes a
+// level at a time, each level split in parallel, and finally the masses and
+// centres of mass from the deepest level up. Masses are radius squared. The
+// tree depends only on the particles, not on the thread count.
+void BuildQuadTree(QuadTree& tree, const ParticleSystem& particles);
+
+// Sum over every particle j of mass_j d / (|d|^2 + softening^2)^(3/2), d
+// pointing from (x, y) to particle j, with any node whose size is less than
+// theta times its distance taken as one mass at its centre of mass. A
+// particle contributes nothing at its own position. Pass a theta of 0 for
+// the exact sum.
+void QuadTreeField(const QuadTree& tree, float x, float y, float theta, float& fx, float& fy);
+
+// The acceleration of every particle from every other, strength / total mass
+// times QuadTreeField at its position, into tree.ax and tree.ay by particle:
+// px/frame^2 with the strength in px^3/frame^2, and negative strengths
+// repel. The particles of each leaf walk the tree together, opening nodes by
+// their distance from the leaf's bounding box, and sum the resulting list of
+// masses a lane per particle, so each sum runs in list order whichever kernel
+// computes it.
+void ComputePairAcceleration(QuadTree& tree, float strength, float theta);
+
+// Rebuilds particles.tree and kicks every particle's velocity by dt times its
+// pair acceleration at particles.pairForce and particles.theta, profiled as
+// the pair forces stage. The principle update calls it after its sweep, as
+// it does the short-range forces.
+void UpdatePairForces(ParticleSystem& particles);
+
+#endif
@@ -0,0 +1,649 @@
+#include "barnes_hut.h"
+#include "density_splat.h"
+#include "neighbor_list.h"
+#include "particle_order.h"
+#include "particle_system.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "spatial_grid.h"
+#include "superposition.h"
+#include "thread_pool.h"
+#include "uncertainty.h"
+#include "wave_field.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+const int BENCH_WIDTH = 1920;
+const int BENCH_HEIGHT = 1080;
+// Domain area per particle for the collision kernel. Packed into the bench
+// domain a million 5-9 px circles would overlap hundreds deep, so its domain
+// grows with the count instead, keeping the contacts per particle fixed.
+const double COLLISION_BENCH_AREA = 1000.0;
+
+struct BenchKernel {
+    const char* name;
+    // Particle state streamed to and from memory per particle per call.
+    double bytesPerParticle;
+    std::function<void(ParticleSystem&, ParticleFeatures&)> run;
+    // Extra bytes per superposition basis state, whose count depends on the
+    // particle count.
+    double bytesPerBasisState = 0;
+};
+
+struct BenchResult {
+    std::string kernel;
+    size_t particles;
+    int threads;
+    double nsPerParticle;
+    double bytesPerParticle;
+    double scalingEfficiency;
+};
+
+struct WaveResult {
+    WaveSolver solver;
+    size_t grid;
+    int threads;
+    double msPerStep;
+};
+
+struct BenchOptions {
+    size_t minParticles = 1000;
+    size_t maxParticles = 10000000;
+    std::vector<int> threadCounts;
+    std::vector<std::string> kernels;
+    std::vector<int> waveGrids;
+    double minSeconds = 0.2;
+    const char* jsonPath = nullptr;
+    bool checkOnly = false;
+};
+
+// The scalar kernel, or the dispatching one held to level.
+static void IntegrateChunked(ParticleSystem& particles, bool simd, SimdLevel level) {
+    float* x = particles.x.Data();
+    float* y = particles.y.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        if (simd) {
+            IntegrateAndReflect(x + begin, y + begin, vx + begin, vy + begin, end - begin, 1.0f, BENCH_WIDTH, BENCH_HEIGHT, level);
+        } else {
+            IntegrateAndReflectScalar(x + begin, y + begin, vx + begin, vy + begin, end - begin, 1.0f, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+    });
+}
+
+// A copy of particles spread over a domain of COLLISION_BENCH_AREA px^2 per
+// particle, regenerated when the count or seed changes, either as generated
+// or sorted by Morton key.
+struct SpreadParticles {
+    ParticleSystem particles;
+    int width = 0;
+    int height = 0;
+};
+
+static SpreadParticles& Spread(const ParticleSystem& particles, bool sorted) {
+    static SpreadParticles copies[2];
+    SpreadParticles& spread = copies[sorted ? 1 : 0];
+    if (spread.particles.Size() != particles.Size() || spread.particles.seed != particles.seed) {
+        const double scale = std::max(1.0, std::sqrt(particles.Size() * COLLISION_BENCH_AREA / (BENCH_WIDTH * BENCH_HEIGHT)));
+        spread.width = static_cast<int>(BENCH_WIDTH * scale);
+        spread.height = static_cast<int>(BENCH_HEIGHT * scale);
+        spread.particles.seed = particles.seed;
+        spread.particles.Resize(0);
+        ResizeParticles(spread.particles, particles.Size(), spread.width, spread.height);
+        if (sorted) ReorderParticles(spread.particles, static_cast<float>(spread.width), static_cast<float>(spread.height));
+    }
+    return spread;
+}
+
+static double PrincipleBytesPerParticle(QuantumPrinciple principle) {
+    switch (principle) {
+        case ENTANGLEMENT: return 28;
+        case CHAOS: return 68;
+        default: return 32;
+    }
+}
+
+static std::vector<BenchKernel> MakeKernels() {
+    std::vector<BenchKernel> kernels = {
+        {"integrate_scalar", 32, [](ParticleSystem& particles, ParticleFeatures&) { IntegrateChunked(particles, false, SIMD_SCALAR); }},
+        {"integrate_simd", 32, [](ParticleSystem& particles, ParticleFeatures&) { IntegrateChunked(particles, true, DetectSimdLevel()); }},
+    };
+    for (const PrincipleInfo& info : PRINCIPLE_TABLE) {
+        QuantumPrinciple principle = info.type;
+        // Each amplitude's real and imaginary floats are read and written back
+        // by the phase rotation and by both hop passes.
+        kernels.push_back({info.key, PrincipleBytesPerParticle(principle), [principle](ParticleSystem& particles, ParticleFeatures&) {
+            UpdateParticlesByPrinciple(particles, principle, BENCH_WIDTH, BENCH_HEIGHT);
+        }, principle == SUPERPOSITION ? 48.0 : 0.0});
+    }
+    kernels.push_back({"interactive", 32, [](ParticleSystem& particles, ParticleFeatures&) { UpdateInteractiveParticles(particles, BENCH_WIDTH, BENCH_HEIGHT); }});
+    // The same attraction under the other integrators: Verlet and RK4 pay for
+    // two and four force evaluations per particle.
+    const struct {
+        const char* name;
+        Integrator integrator;
+    } integrators[] = {{"interactive_euler", INTEGRATOR_EULER}, {"interactive_verlet", INTEGRATOR_VELOCITY_VERLET}, {"interactive_rk4", INTEGRATOR_RK4}};
+    for (const auto& variant : integrators) {
+        const Integrator integrator = variant.integrator;
+        kernels.push_back({variant.name, 32, [integrator](ParticleSystem& particles, ParticleFeatures&) {
+            particles.integrator = integrator;
+            UpdateInteractiveParticles(particles, BENCH_WIDTH, BENCH_HEIGHT);
+            particles.integrator = INTEGRATOR_SEMI_IMPLICIT_EULER;
+        }});
+    }
+    // Building the grid reads the particles, writes their cells, then scatters
+    // five floats and an index per particle.
+    kernels.push_back({"spatial_grid", 52, [](ParticleSystem& particles, ParticleFeatures&) {
+        BuildSpatialGrid(particles.grid, particles, BENCH_WIDTH, BENCH_HEIGHT, 1.0f, 0.0f);
+    }});
+    kernels.push_back({"collisions", 80, [](ParticleSystem& particles, ParticleFeatures&) {
+        SpreadParticles& spread = Spread(particles, false);
+        CollideParticles(spread.particles, spread.width, spread.height);
+    }});
+    // The Lennard-Jones neighbour lists at the collision density: a grid
+    // build, then two passes over the candidates around every particle.
+    kernels.push_back({"neighbor_list", 60, [](ParticleSystem& particles, ParticleFeatures&) {
+        SpreadParticles& spread = Spread(particles, false);
+        BuildNeighborList(spread.particles.neighbors, spread.particles, spread.particles.skin, spread.width, spread.height);
+    }});
+    // The force alone, over lists that stay current since nothing moves: the
+    // particle's own state and row offsets, not counting the neighbours it
+    // gathers.
+    kernels.push_back({"lennard_jones", 32, [](ParticleSystem& particles, ParticleFeatures&) {
+        SpreadParticles& spread = Spread(particles, false);
+        NeighborList& neighbors = spread.particles.neighbors;
+        if (!NeighborListCurrent(neighbors, spread.particles, spread.particles.skin)) {
+            BuildNeighborList(neighbors, spread.particles, spread.particles.skin, spread.width, spread.height);
+        }
+        ApplyLennardJones(neighbors, spread.particles, LENNARD_JONES_DEPTH);
+    }});
+    // The same two over particles sorted by Morton key, whose neighbours are
+    // mostly in cache.
+    kernels.push_back({"neighbor_list_sorted", 60, [](ParticleSystem& particles, ParticleFeatures&) {
+        SpreadParticles& spread = Spread(particles, true);
+        BuildNeighborList(spread.particles.neighbors, spread.particles, spread.particles.skin, spread.width, spread.height);
+    }});
+    kernels.push_back({"lennard_jones_sorted", 32, [](ParticleSystem& particles, ParticleFeatures&) {
+        SpreadParticles& spread = Spread(particles, true);
+        NeighborList& neighbors = spread.particles.neighbors;
+        if (!NeighborListCurrent(neighbors, spread.particles, spread.particles.skin)) {
+            BuildNeighborList(neighbors, spread.particles, spread.particles.skin, spread.width, spread.height);
+        }
+        ApplyLennardJones(neighbors, spread.particles, LENNARD_JONES_DEPTH);
+    }});
+    // A Morton re-sort: keys and slots, three sort passes over them, and the
+    // seven particle arrays gathered through the slots. After the first run
+    // the particles are already close to sorted, as they are when the
+    // simulation re-sorts them.
+    kernels.push_back({"reorder", 160, [](ParticleSystem& particles, ParticleFeatures&) {
+        ReorderParticles(particles, BENCH_WIDTH, BENCH_HEIGHT);
+    }});
+    // Keys, two sort passes' worth of key and index traffic, and the sorted
+    // position and mass copies.
+    kernels.push_back({"quadtree_build", 60, [](ParticleSystem& particles, ParticleFeatures&) { BuildQuadTree(particles.tree, particles); }});
+    kernels.push_back({"interactive_barnes_hut", 32, [](ParticleSystem& particles, ParticleFeatures&) {
+        particles.pairForce = PAIR_FORCE_GRAVITY;
+        UpdateInteractiveParticles(particles, BENCH_WIDTH, BENCH_HEIGHT);
+        particles.pairForce = 0.0f;
+    }});
+    kernels.push_back({"feature_prep", 32, [](ParticleSystem& particles, ParticleFeatures& features) { PrepareParticleFeatures(particles, features); }});
+    // The Uncertainty principle's per-step moments on their own, read from
+    // memory rather than from L1 as in the fused sweep.
+    kernels.push_back({"uncertainty_moments", 16, [](ParticleSystem& particles, ParticleFeatures&) {
+        UncertaintyState& state = particles.uncertainty;
+        PrepareUncertainty(state, particles.Size(), particles.seed, state.lastStep + 1, particles.dt, BENCH_WIDTH, BENCH_HEIGHT);
+        ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            for (size_t first = begin; first < end; first += RNG_BATCH_SIZE) {
+                const size_t n = end - first < RNG_BATCH_SIZE ? end - first : RNG_BATCH_SIZE;
+                MeasureUncertainty(state, particles.x.Data(), particles.y.Data(), particles.vx.Data(), particles.vy.Data(), first, n);
+            }
+        });
+        FinishUncertainty(state);
+    }});
+    kernels.push_back({"density_splat", 8, [](ParticleSystem& particles, ParticleFeatures&) {
+        static DensitySplat splat;
+        splat.Resize(BENCH_WIDTH, BENCH_HEIGHT);
+        splat.Render(particles, BENCH_WIDTH, BENCH_HEIGHT);
+    }});
+    return kernels;
+}
+
+static double TimeKernel(const BenchKernel& kernel, ParticleSystem& particles, ParticleFeatures& features, double minSeconds) {
+    kernel.run(particles, features);
+    std::vector<double> samples;
+    double total = 0.0;
+    while (samples.size() < 3 || total < minSeconds) {
+        auto start = std::chrono::steady_clock::now();
+        kernel.run(particles, features);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(seconds);
+        total += seconds;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// Median time of one wave update on a fresh grid.
+static double TimeWaveStep(WaveSolver solver, size_t grid, double minSeconds) {
+    WaveField field;
+    field.SetSolver(solver);
+    field.Resize(grid);
+    field.Step();
+    std::vector<double> samples;
+    double total = 0.0;
+    while (samples.size() < 3 || total < minSeconds) {
+        auto start = std::chrono::steady_clock::now();
+        field.Step();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        samples.push_back(seconds);
+        total += seconds;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// Runs the scalar integrate kernel and the dispatching one held to level from
+// the same initial state and compares the result bit for bit.
+static bool SimdMatchesScalar(size_t count, SimdLevel level) {
+    ParticleSystem scalar;
+    scalar.seed = 7;
+    ResizeParticles(scalar, count, BENCH_WIDTH, BENCH_HEIGHT);
+    ParticleSystem simd = scalar;
+    for (int step = 0; step < 64; step++) {
+        IntegrateChunked(scalar, false, SIMD_SCALAR);
+        IntegrateChunked(simd, true, level);
+    }
+    const size_t bytes = count * sizeof(float);
+    return std::memcmp(scalar.x.Data(), simd.x.Data(), bytes) == 0 && std::memcmp(scalar.y.Data(), simd.y.Data(), bytes) == 0 &&
+           std::memcmp(scalar.vx.Data(), simd.vx.Data(), bytes) == 0 && std::memcmp(scalar.vy.Data(), simd.vy.Data(), bytes) == 0;
+}
+
+// RMS difference between the Barnes-Hut accelerations and the exact sums,
+// relative to the RMS exact acceleration.
+static double BarnesHutError(size_t count, float theta) {
+    ParticleSystem particles;
+    particles.seed = 7;
+    ResizeParticles(particles, count, BENCH_WIDTH, BENCH_HEIGHT);
+    QuadTree& tree = particles.tree;
+    BuildQuadTree(tree, particles);
+    ComputePairAcceleration(tree, 1.0f, theta);
+    const float total = tree.nodes[0].mass;
+    double error = 0.0, magnitude = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        float ex, ey;
+        QuadTreeField(tree, particles.x[i], particles.y[i], 0.0f, ex, ey);
+        ex /= total;
+        ey /= total;
+        error += (tree.ax[i] - ex) * (tree.ax[i] - ex) + (tree.ay[i] - ey) * (tree.ay[i] - ey);
+        magnitude += ex * ex + ey * ey;
+    }
+    return magnitude > 0.0 ? std::sqrt(error / magnitude) : 0.0;
+}
+
+// A small deterministic run of a vectorized kernel, returning the floats it
+// produced. --check runs each at every SIMD level and compares the bits.
+struct KernelCheck {
+    std::string name;
+    std::function<std::vector<float>()> run;
+};
+
+static void AppendFloats(std::vector<float>& out, const float* values, size_t count) {
+    out.insert(out.end(), values, values + count);
+}
+
+// Odd lengths, so every path also runs its scalar tail.
+static std::vector<KernelCheck> MakeKernelChecks() {
+    std::vector<KernelCheck> checks = {
+        {"rotate_phase", [] {
+            const size_t count = 1003;
+            std::vector<float> re(count), im(count);
+            for (size_t i = 0; i < count; i++) {
+                re[i] = std::sin(0.1f * i);
+                im[i] = std::cos(0.3f * i);
+            }
+            for (int step = 0; step < 16; step++) RotatePhase(re.data(), im.data(), count, 0.8f, 0.6f);
+            AppendFloats(re, im.data(), count);
+            return re;
+        }},
+        {"mix_amplitudes", [] {
+            const size_t count = 1003;
+            std::vector<float> reA(count), imA(count), reB(count), imB(count);
+            for (size_t i = 0; i < count; i++) {
+                reA[i] = std::sin(0.1f * i);
+                imA[i] = std::cos(0.3f * i);
+                reB[i] = std::sin(0.7f * i);
+                imB[i] = std::cos(0.2f * i);
+            }
+            for (int step = 0; step < 16; step++) MixAmplitudes(reA.data(), imA.data(), reB.data(), imB.data(), count, 0.8f, 0.6f);
+            AppendFloats(reA, imA.data(), count);
+            AppendFloats(reA, reB.data(), count);
+            AppendFloats(reA, imB.data(), count);
+            return reA;
+        }},
+        {"sum_deviations", [] {
+            const size_t count = 1003;
+            std::vector<float> v(count * 8);
+            for (size_t i = 0; i < v.size(); i++) v[i] = 100.0f + std::sin(0.1f * i) * 40.0f;
+            float sum, sumSquares;
+            SumDeviations(v.data(), v.size(), 100.0f, sum, sumSquares);
+            return std::vector<float>{sum, sumSquares};
+        }},
+        {"fill_gaussian", [] {
+            const size_t count = 1003;
+            std::vector<float> out(count * 4);
+            const RandomStream stream = MakeRandomStream(7, RNG_STREAM_PRINCIPLE, 3);
+            FillGaussian(stream, 5, count, out.data(), out.data() + count, out.data() + 2 * count, out.data() + 3 * count);
+            return out;
+        }},
+        {"fill_uniform", [] {
+            const size_t count = 1003;
+            std::vector<float> out(count * 4);
+            const RandomStream stream = MakeRandomStream(7, RNG_STREAM_PRINCIPLE, 3);
+            FillUniform(stream, 5, count, out.data(), out.data() + count, out.data() + 2 * count, out.data() + 3 * count);
+            return out;
+        }},
+        {"fill_gaussian_by_id", [] {
+            const size_t count = 1003;
+            std::vector<uint32_t> id(count);
+            for (size_t i = 0; i < count; i++) id[i] = static_cast<uint32_t>((i * 7919) % count);
+            std::vector<float> out(count * 4);
+            const RandomStream stream = MakeRandomStream(7, RNG_STREAM_PRINCIPLE, 3);
+            FillGaussianById(stream, id.data(), count, out.data(), out.data() + count, out.data() + 2 * count, out.data() + 3 * count);
+            return out;
+        }},
+        // The spread copy is made once and copied, so every level starts from
+        // the same particles.
+        {"collisions", [] {
+            ParticleSystem source;
+            source.seed = 7;
+            ResizeParticles(source, 20011, BENCH_WIDTH, BENCH_HEIGHT);
+            SpreadParticles spread = Spread(source, false);
+            CollideParticles(spread.particles, spread.width, spread.height);
+            std::vector<float> out;
+            AppendFloats(out, spread.particles.vx.Data(), spread.particles.Size());
+            AppendFloats(out, spread.particles.vy.Data(), spread.particles.Size());
+            return out;
+        }},
+        {"lennard_jones", [] {
+            ParticleSystem source;
+            source.seed = 7;
+            ResizeParticles(source, 20011, BENCH_WIDTH, BENCH_HEIGHT);
+            SpreadParticles spread = Spread(source, false);
+            BuildNeighborList(spread.particles.neighbors, spread.particles, spread.particles.skin, spread.width, spread.height);
+            ApplyLennardJones(spread.particles.neighbors, spread.particles, LENNARD_JONES_DEPTH);
+            std::vector<float> out;
+            AppendFloats(out, spread.particles.vx.Data(), spread.particles.Size());
+            AppendFloats(out, spread.particles.vy.Data(), spread.particles.Size());
+            return out;
+        }},
+        {"barnes_hut", [] {
+            ParticleSystem particles;
+            particles.seed = 7;
+            ResizeParticles(particles, 20011, BENCH_WIDTH, BENCH_HEIGHT);
+            BuildQuadTree(particles.tree, particles);
+            ComputePairAcceleration(particles.tree, 1.0f, 0.5f);
+            std::vector<float> out;
+            AppendFloats(out, particles.tree.ax.Data(), particles.Size());
+            AppendFloats(out, particles.tree.ay.Data(), particles.Size());
+            return out;
+        }},
+    };
+    // The principle kernels, for the entanglement scatter, the Lyapunov
+    // tangents and the kernels above as the principles call them.
+    for (const PrincipleInfo& info : PRINCIPLE_TABLE) {
+        const QuantumPrinciple principle = info.type;
+        checks.push_back({info.key, [principle] {
+            ParticleSystem particles;
+            particles.seed = 7;
+            ResizeParticles(particles, 5003, BENCH_WIDTH, BENCH_HEIGHT);
+            // The wave principle steps the shared field; every run starts from
+            // a fresh packet.
+            GetWaveField().Resize(WAVE_GRID_DEFAULT);
+            for (int step = 0; step < 16; step++) UpdateParticlesByPrinciple(particles, principle, BENCH_WIDTH, BENCH_HEIGHT);
+            std::vector<float> out;
+            AppendFloats(out, particles.x.Data(), particles.Size());
+            AppendFloats(out, particles.y.Data(), particles.Size());
+            AppendFloats(out, particles.vx.Data(), particles.Size());
+            AppendFloats(out, particles.vy.Data(), particles.Size());
+            AppendFloats(out, particles.lyapunov.logGrowth.Data(), particles.lyapunov.members);
+            return out;
+        }});
+    }
+    for (int s = 0; s < WAVE_SOLVER_COUNT; s++) {
+        const WaveSolver solver = static_cast<WaveSolver>(s);
+        checks.push_back({std::string("wave_") + WaveSolverName(solver), [solver] {
+            WaveField field;
+            field.SetSolver(solver);
+            field.Resize(64);
+            for (int step = 0; step < 8; step++) field.Step();
+            field.UpdateDensity();
+            std::vector<float> out;
+            AppendFloats(out, field.Density(), field.Size() * field.Size());
+            return out;
+        }});
+    }
+    return checks;
+}
+
+// Runs every kernel check at each SIMD level the CPU supports and compares it
+// bit for bit with the scalar run.
+static bool KernelsMatchScalar() {
+    bool allMatch = true;
+    for (const KernelCheck& check : MakeKernelChecks()) {
+        LimitSimdLevel(SIMD_SCALAR);
+        const std::vector<float> expected = check.run();
+        std::fprintf(stderr, "%-22s", check.name.c_str());
+        for (int level = SIMD_SSE2; level <= DetectSimdLevel(); level++) {
+            LimitSimdLevel(static_cast<SimdLevel>(level));
+            const std::vector<float> result = check.run();
+            const bool matches = result.size() == expected.size() && std::memcmp(result.data(), expected.data(), expected.size() * sizeof(float)) == 0;
+            std::fprintf(stderr, " %s %s", SimdLevelName(static_cast<SimdLevel>(level)), matches ? "yes" : "NO");
+            allMatch = allMatch && matches;
+        }
+        std::fprintf(stderr, "\n");
+    }
+    LimitSimdLevel(DetectSimdLevel());
+    return allMatch;
+}
+
+static std::vector<int> ParseList(const char* text) {
+    std::vector<int> values;
+    while (*text) {
+        char* end = nullptr;
+        long value = std::strtol(text, &end, 10);
+        if (end == text || value <= 0) return {};
+        values.push_back(static_cast<int>(value));
+        text = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+static std::vector<std::string> ParseNames(const char* text) {
+    std::vector<std::string> names;
+    std::string current;
+    for (; *text; text++) {
+        if (*text == ',') {
+            if (!current.empty()) names.push_back(current);
+            current.clear();
+        } else {
+            current += *text;
+        }
+    }
+    if (!current.empty()) names.push_back(current);
+    return names;
+}
+
+static void PrintUsage(const char* program) {
+    std::fprintf(stderr,
+                 "Usage: %s [options]\n"
+                 "  --min N           smallest particle count (default 1000)\n"
+                 "  --max N           largest particle count, stepped by 10x (default 10000000)\n"
+                 "  --threads A,B,..  thread counts to run (default 1,2,4,... up to all cores)\n"
+                 "  --kernels K,..    subset of kernels to run (default all)\n"
+                 "  --wave N,..       time a step of each wave solver on these grid sizes; particle kernels\n"
+                 "                    then only run when --kernels is also given\n"
+                 "  --time S          minimum seconds per measurement (default 0.2)\n"
+                 "  --json PATH       write results as JSON to PATH ('-' for stdout)\n"
+                 "  --check           only check the SIMD kernels against the scalar ones at every level; exits 2 on a mismatch\n",
+                 program);
+}
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--check") {
+            options.checkOnly = true;
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (flag == "--min") {
+            options.minParticles = std::strtoull(value, nullptr, 10);
+        } else if (flag == "--max") {
+            options.maxParticles = std::strtoull(value, nullptr, 10);
+        } else if (flag == "--threads") {
+            options.threadCounts = ParseList(value);
+            if (options.threadCounts.empty()) return false;
+        } else if (flag == "--kernels") {
+            options.kernels = ParseNames(value);
+        } else if (flag == "--wave") {
+            options.waveGrids = ParseList(value);
+            for (int grid : options.waveGrids) {
+                if (grid < static_cast<int>(WAVE_GRID_MIN) || grid > static_cast<int>(WAVE_GRID_MAX) || (grid & (grid - 1)) != 0) return false;
+            }
+            if (options.waveGrids.empty()) return false;
+        } else if (flag == "--time") {
+            options.minSeconds = std::atof(value);
+        } else if (flag == "--json") {
+            options.jsonPath = value;
+        } else {
+            return false;
+        }
+    }
+    return options.minParticles > 0 && options.minParticles <= options.maxParticles;
+}
+
+static void WriteJson(std::FILE* out, const std::vector<BenchResult>& results, const std::vector<WaveResult>& waveResults, bool simdMatches,
+                      double barnesHutError) {
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"simd\": \"%s\",\n", SimdLevelName(DetectSimdLevel()));
+    std::fprintf(out, "  \"hardware_threads\": %d,\n", HardwareThreadCount());
+    std::fprintf(out, "  \"chunk_size\": %zu,\n", PARALLEL_CHUNK_SIZE);
+    std::fprintf(out, "  \"simd_matches_scalar\": %s,\n", simdMatches ? "true" : "false");
+    std::fprintf(out, "  \"barnes_hut_rms_error\": %.6f,\n", barnesHutError);
+    std::fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        std::fprintf(out,
+                     "    {\"kernel\": \"%s\", \"particles\": %zu, \"threads\": %d, \"ns_per_particle\": %.4f, "
+                     "\"bytes_per_particle\": %.1f, \"gb_per_s\": %.3f, \"scaling_efficiency\": %.3f}%s\n",
+                     r.kernel.c_str(), r.particles, r.threads, r.nsPerParticle, r.bytesPerParticle,
+                     r.bytesPerParticle / r.nsPerParticle, r.scalingEfficiency, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n  \"wave\": [\n");
+    for (size_t i = 0; i < waveResults.size(); i++) {
+        const WaveResult& r = waveResults[i];
+        std::fprintf(out, "    {\"solver\": \"%s\", \"grid\": %zu, \"threads\": %d, \"ms_per_step\": %.4f, \"steps_per_s\": %.2f}%s\n",
+                     WaveSolverName(r.solver), r.grid, r.threads, r.msPerStep, 1e3 / r.msPerStep, i + 1 < waveResults.size() ? "," : "");
+    }
+    std::fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    if (options.threadCounts.empty()) {
+        for (int t = 1; t < HardwareThreadCount(); t *= 2) options.threadCounts.push_back(t);
+        options.threadCounts.push_back(HardwareThreadCount());
+    }
+
+    std::vector<BenchKernel> kernels;
+    const bool runKernels = options.waveGrids.empty() || !options.kernels.empty();
+    for (const BenchKernel& kernel : runKernels ? MakeKernels() : std::vector<BenchKernel>()) {
+        if (options.kernels.empty() || std::find(options.kernels.begin(), options.kernels.end(), kernel.name) != options.kernels.end()) {
+            kernels.push_back(kernel);
+        }
+    }
+
+    // Every path the CPU can run, not just the one the kernels dispatch to.
+    bool simdMatches = true;
+    for (int level = SIMD_SCALAR; level <= DetectSimdLevel(); level++) {
+        const bool matches = SimdMatchesScalar(100003, static_cast<SimdLevel>(level));
+        std::fprintf(stderr, "simd %s matches scalar: %s\n", SimdLevelName(static_cast<SimdLevel>(level)), matches ? "yes" : "NO");
+        simdMatches = simdMatches && matches;
+    }
+    std::fprintf(stderr, "kernels vs scalar at each simd level:\n");
+    simdMatches = KernelsMatchScalar() && simdMatches;
+    if (options.checkOnly) return simdMatches ? 0 : 2;
+    const double barnesHutError = BarnesHutError(4096, 0.5f);
+    std::fprintf(stderr, "barnes-hut theta 0.5 vs direct sum: %.3f%% rms error\n", barnesHutError * 100.0);
+    if (!kernels.empty()) std::fprintf(stderr, "%-22s %10s %7s %10s %9s %9s %8s\n", "kernel", "particles", "threads", "ns/part", "B/part", "GB/s", "scaling");
+
+    std::vector<BenchResult> results;
+    for (size_t count = options.minParticles; !kernels.empty() && count <= options.maxParticles; count *= 10) {
+        ParticleSystem pristine;
+        pristine.seed = 1;
+        ResizeParticles(pristine, count, BENCH_WIDTH, BENCH_HEIGHT);
+        for (const BenchKernel& kernel : kernels) {
+            double singleThreadNs = 0.0;
+            for (int threads : options.threadCounts) {
+                GetThreadPool().SetThreadCount(threads);
+                ParticleSystem particles = pristine;
+                ParticleFeatures features;
+                double seconds = TimeKernel(kernel, particles, features, options.minSeconds);
+                BenchResult result;
+                result.kernel = kernel.name;
+                result.particles = count;
+                result.threads = threads;
+                result.nsPerParticle = seconds * 1e9 / static_cast<double>(count);
+                result.bytesPerParticle = kernel.bytesPerParticle + kernel.bytesPerBasisState * SuperpositionBasisCount(count);
+                if (threads == options.threadCounts.front()) singleThreadNs = result.nsPerParticle * threads;
+                result.scalingEfficiency = singleThreadNs / (result.nsPerParticle * threads);
+                results.push_back(result);
+                std::fprintf(stderr, "%-22s %10zu %7d %10.3f %9.1f %9.3f %8.3f\n", result.kernel.c_str(), count, threads,
+                             result.nsPerParticle, result.bytesPerParticle, result.bytesPerParticle / result.nsPerParticle,
+                             result.scalingEfficiency);
+            }
+        }
+        if (count > options.maxParticles / 10) break;
+    }
+
+    std::vector<WaveResult> waveResults;
+    if (!options.waveGrids.empty()) {
+        std::fprintf(stderr, "%-22s %10s %7s %10s %9s\n", "wave", "grid", "threads", "ms/step", "steps/s");
+    }
+    for (int solver = 0; solver < WAVE_SOLVER_COUNT; solver++) {
+        for (int grid : options.waveGrids) {
+            for (int threads : options.threadCounts) {
+                GetThreadPool().SetThreadCount(threads);
+                const WaveSolver waveSolver = static_cast<WaveSolver>(solver);
+                WaveResult result = {waveSolver, static_cast<size_t>(grid), threads, TimeWaveStep(waveSolver, static_cast<size_t>(grid), options.minSeconds) * 1e3};
+                waveResults.push_back(result);
+                std::fprintf(stderr, "%-22s %10d %7d %10.3f %9.1f\n", WaveSolverName(waveSolver), grid, threads, result.msPerStep, 1e3 / result.msPerStep);
+            }
+        }
+    }
+
+    if (options.jsonPath) {
+        bool toStdout = std::strcmp(options.jsonPath, "-") == 0;
+        std::FILE* out = toStdout ? stdout : std::fopen(options.jsonPath, "w");
+        if (!out) {
+            std::fprintf(stderr, "could not open %s\n", options.jsonPath);
+            return 1;
+        }
+        WriteJson(out, results, waveResults, simdMatches, barnesHutError);
+        if (!toStdout) std::fclose(out);
+    }
+    return simdMatches ? 0 : 2;
+}
@@ -0,0 +1,268 @@
+#include "crank_nicolson.h"
+#include "fft.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+
+// Rows handled per task when the potential is set up.
+static const size_t ADI_ROWS_PER_TASK = 16;
+
+// One row of forward elimination across a strip of column systems. With
+// g = dt/2 and q = dt/4, row r of every system reads
+//   (1 + i g (1 + v)) x[r] - i q (x[r-1] + x[r+1]) = d[r]
+// and d[r] is the explicit half of the step taken along the row,
+//   d = psi - i (g (1 + v) psi - q (psi[c-1] + psi[c+1])).
+// Lanes j - 1 and j + 1 are read for psi; at the grid's left or right edge
+// they are outside and count as zero. A row only writes c' and d', so the
+// vector loops finish with a vector overlapping the one before it instead of
+// a scalar tail.
+struct ThomasRow {
+    const float* re;
+    const float* im;
+    const float* v;
+    const float* prevCpRe;
+    const float* prevCpIm;
+    const float* prevDpRe;
+    const float* prevDpIm;
+    float* cpRe;
+    float* cpIm;
+    float* dpRe;
+    float* dpIm;
+    float g;
+    float q;
+    bool leftEdge;
+    bool rightEdge;
+    size_t width;
+};
+
+static void ForwardRowScalar(const ThomasRow& t, size_t first, size_t count) {
+    for (size_t j = first; j < first + count; j++) {
+        const bool hasLeft = j > 0 || !t.leftEdge;
+        const bool hasRight = j + 1 < t.width || !t.rightEdge;
+        const float sR = (hasLeft ? t.re[j - 1] : 0.0f) + (hasRight ? t.re[j + 1] : 0.0f);
+        const float sI = (hasLeft ? t.im[j - 1] : 0.0f) + (hasRight ? t.im[j + 1] : 0.0f);
+        const float gv = t.g * (1.0f + t.v[j]);
+        const float hR = gv * t.re[j] - t.q * sR;
+        const float hI = gv * t.im[j] - t.q * sI;
+        const float dR = t.re[j] + hI;
+        const float dI = t.im[j] - hR;
+        // Pivot b - a c'[r-1] with b = 1 + i g (1 + v) and a = -i q.
+        const float eR = 1.0f - t.q * t.prevCpIm[j];
+        const float eI = gv + t.q * t.prevCpRe[j];
+        const float scale = 1.0f / (eR * eR + eI * eI);
+        const float invR = eR * scale;
+        const float invI = -eI * scale;
+        t.cpRe[j] = t.q * invI;
+        t.cpIm[j] = -t.q * invR;
+        const float rR = dR - t.q * t.prevDpIm[j];
+        const float rI = dI + t.q * t.prevDpRe[j];
+        t.dpRe[j] = rR * invR - rI * invI;
+        t.dpIm[j] = rR * invI + rI * invR;
+    }
+}
+
+// Back substitution x[r] = d'[r] - c'[r] x[r+1], in place over d'.
+static void BackRowScalar(float* re, float* im, const float* cpRe, const float* cpIm, const float* nextRe, const float* nextIm, size_t first, size_t count) {
+    for (size_t j = first; j < first + count; j++) {
+        re[j] -= cpRe[j] * nextRe[j] - cpIm[j] * nextIm[j];
+        im[j] -= cpRe[j] * nextIm[j] + cpIm[j] * nextRe[j];
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+__attribute__((target("avx2")))
+static size_t ForwardRowAvx2(const ThomasRow& t, size_t first, size_t count) {
+    const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+    const __m256 g = _mm256_set1_ps(t.g), q = _mm256_set1_ps(t.q);
+    if (count < 8) return 0;
+    for (size_t k = 0; k < count; k += 8) {
+        const size_t j = first + (k + 8 <= count ? k : count - 8);
+        const __m256 pR = _mm256_loadu_ps(t.re + j), pI = _mm256_loadu_ps(t.im + j);
+        const __m256 sR = _mm256_add_ps(_mm256_loadu_ps(t.re + j - 1), _mm256_loadu_ps(t.re + j + 1));
+        const __m256 sI = _mm256_add_ps(_mm256_loadu_ps(t.im + j - 1), _mm256_loadu_ps(t.im + j + 1));
+        const __m256 gv = _mm256_mul_ps(g, _mm256_add_ps(one, _mm256_loadu_ps(t.v + j)));
+        const __m256 hR = _mm256_sub_ps(_mm256_mul_ps(gv, pR), _mm256_mul_ps(q, sR));
+        const __m256 hI = _mm256_sub_ps(_mm256_mul_ps(gv, pI), _mm256_mul_ps(q, sI));
+        const __m256 dR = _mm256_add_ps(pR, hI), dI = _mm256_sub_ps(pI, hR);
+        const __m256 eR = _mm256_sub_ps(one, _mm256_mul_ps(q, _mm256_loadu_ps(t.prevCpIm + j)));
+        const __m256 eI = _mm256_add_ps(gv, _mm256_mul_ps(q, _mm256_loadu_ps(t.prevCpRe + j)));
+        const __m256 scale = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(eR, eR), _mm256_mul_ps(eI, eI)));
+        const __m256 invR = _mm256_mul_ps(eR, scale), invI = _mm256_sub_ps(zero, _mm256_mul_ps(eI, scale));
+        _mm256_storeu_ps(t.cpRe + j, _mm256_mul_ps(q, invI));
+        _mm256_storeu_ps(t.cpIm + j, _mm256_sub_ps(zero, _mm256_mul_ps(q, invR)));
+        const __m256 rR = _mm256_sub_ps(dR, _mm256_mul_ps(q, _mm256_loadu_ps(t.prevDpIm + j)));
+        const __m256 rI = _mm256_add_ps(dI, _mm256_mul_ps(q, _mm256_loadu_ps(t.prevDpRe + j)));
+        _mm256_storeu_ps(t.dpRe + j, _mm256_sub_ps(_mm256_mul_ps(rR, invR), _mm256_mul_ps(rI, invI)));
+        _mm256_storeu_ps(t.dpIm + j, _mm256_add_ps(_mm256_mul_ps(rR, invI), _mm256_mul_ps(rI, invR)));
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static size_t BackRowAvx2(float* re, float* im, const float* cpRe, const float* cpIm, const float* nextRe, const float* nextIm, size_t count) {
+    size_t j = 0;
+    for (; j + 8 <= count; j += 8) {
+        const __m256 cR = _mm256_loadu_ps(cpRe + j), cI = _mm256_loadu_ps(cpIm + j);
+        const __m256 nR = _mm256_loadu_ps(nextRe + j), nI = _mm256_loadu_ps(nextIm + j);
+        _mm256_storeu_ps(re + j, _mm256_sub_ps(_mm256_loadu_ps(re + j), _mm256_sub_ps(_mm256_mul_ps(cR, nR), _mm256_mul_ps(cI, nI))));
+        _mm256_storeu_ps(im + j, _mm256_sub_ps(_mm256_loadu_ps(im + j), _mm256_add_ps(_mm256_mul_ps(cR, nI), _mm256_mul_ps(cI, nR))));
+    }
+    return j;
+}
+
+// The AVX2 rows sixteen columns wide.
+QPS_AVX512_TARGET
+static size_t ForwardRowAvx512(const ThomasRow& t, size_t first, size_t count) {
+    const __m512 one = _mm512_set1_ps(1.0f), zero = _mm512_setzero_ps();
+    const __m512 g = _mm512_set1_ps(t.g), q = _mm512_set1_ps(t.q);
+    if (count < 16) return 0;
+    for (size_t k = 0; k < count; k += 16) {
+        const size_t j = first + (k + 16 <= count ? k : count - 16);
+        const __m512 pR = _mm512_loadu_ps(t.re + j), pI = _mm512_loadu_ps(t.im + j);
+        const __m512 sR = _mm512_add_ps(_mm512_loadu_ps(t.re + j - 1), _mm512_loadu_ps(t.re + j + 1));
+        const __m512 sI = _mm512_add_ps(_mm512_loadu_ps(t.im + j - 1), _mm512_loadu_ps(t.im + j + 1));
+        const __m512 gv = _mm512_mul_ps(g, _mm512_add_ps(one, _mm512_loadu_ps(t.v + j)));
+        const __m512 hR = _mm512_sub_ps(_mm512_mul_ps(gv, pR), _mm512_mul_ps(q, sR));
+        const __m512 hI = _mm512_sub_ps(_mm512_mul_ps(gv, pI), _mm512_mul_ps(q, sI));
+        const __m512 dR = _mm512_add_ps(pR, hI), dI = _mm512_sub_ps(pI, hR);
+        const __m512 eR = _mm512_sub_ps(one, _mm512_mul_ps(q, _mm512_loadu_ps(t.prevCpIm + j)));
+        const __m512 eI = _mm512_add_ps(gv, _mm512_mul_ps(q, _mm512_loadu_ps(t.prevCpRe + j)));
+        const __m512 scale = _mm512_div_ps(one, _mm512_add_ps(_mm512_mul_ps(eR, eR), _mm512_mul_ps(eI, eI)));
+        const __m512 invR = _mm512_mul_ps(eR, scale), invI = _mm512_sub_ps(zero, _mm512_mul_ps(eI, scale));
+        _mm512_storeu_ps(t.cpRe + j, _mm512_mul_ps(q, invI));
+        _mm512_storeu_ps(t.cpIm + j, _mm512_sub_ps(zero, _mm512_mul_ps(q, invR)));
+        const __m512 rR = _mm512_sub_ps(dR, _mm512_mul_ps(q, _mm512_loadu_ps(t.prevDpIm + j)));
+        const __m512 rI = _mm512_add_ps(dI, _mm512_mul_ps(q, _mm512_loadu_ps(t.prevDpRe + j)));
+        _mm512_storeu_ps(t.dpRe + j, _mm512_sub_ps(_mm512_mul_ps(rR, invR), _mm512_mul_ps(rI, invI)));
+        _mm512_storeu_ps(t.dpIm + j, _mm512_add_ps(_mm512_mul_ps(rR, invI), _mm512_mul_ps(rI, invR)));
+    }
+    return count;
+}
+
+QPS_AVX512_TARGET
+static size_t BackRowAvx512(float* re, float* im, const float* cpRe, const float* cpIm, const float* nextRe, const float* nextIm, size_t count) {
+    size_t j = 0;
+    for (; j + 16 <= count; j += 16) {
+        const __m512 cR = _mm512_loadu_ps(cpRe + j), cI = _mm512_loadu_ps(cpIm + j);
+        const __m512 nR = _mm512_loadu_ps(nextRe + j), nI = _mm512_loadu_ps(nextIm + j);
+        _mm512_storeu_ps(re + j, _mm512_sub_ps(_mm512_loadu_ps(re + j), _mm512_sub_ps(_mm512_mul_ps(cR, nR), _mm512_mul_ps(cI, nI))));
+        _mm512_storeu_ps(im + j, _mm512_sub_ps(_mm512_loadu_ps(im + j), _mm512_add_ps(_mm512_mul_ps(cR, nI), _mm512_mul_ps(cI, nR))));
+    }
+    return j;
+}
+
+#endif
+
+static void ForwardRow(const ThomasRow& t) {
+    const SimdLevel level = ActiveSimdLevel();
+    // The vector loops read both neighbours unconditionally, so lanes on the
+    // grid's edges go to the scalar code.
+    const size_t first = t.leftEdge ? 1 : 0;
+    const size_t last = t.rightEdge ? t.width - 1 : t.width;
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = ForwardRowAvx512(t, first, last - first);
+    } else if (level == SIMD_AVX2) {
+        done = ForwardRowAvx2(t, first, last - first);
+    }
+#else
+    (void)level;
+#endif
+    ForwardRowScalar(t, 0, first);
+    ForwardRowScalar(t, first + done, t.width - first - done);
+}
+
+static void BackRow(float* re, float* im, const float* cpRe, const float* cpIm, const float* nextRe, const float* nextIm, size_t count) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = BackRowAvx512(re, im, cpRe, cpIm, nextRe, nextIm, count);
+    } else if (level == SIMD_AVX2) {
+        done = BackRowAvx2(re, im, cpRe, cpIm, nextRe, nextIm, count);
+    }
+#else
+    (void)level;
+#endif
+    BackRowScalar(re, im, cpRe, cpIm, nextRe, nextIm, done, count - done);
+}
+
+CrankNicolsonAdi::CrankNicolsonAdi() : n_(0), dt_(0.0f) {}
+
+void CrankNicolsonAdi::Resize(size_t n, float dt, const float* potential) {
+    n_ = n;
+    dt_ = dt;
+    halfPotential_.Reallocate(n * n, 0);
+    halfPotentialT_.Reallocate(n * n, 0);
+    stageRe_.Reallocate(n * n, 0);
+    stageIm_.Reallocate(n * n, 0);
+    float* half = halfPotential_.Data();
+    float* halfT = halfPotentialT_.Data();
+    ParallelFor(n, ADI_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            for (size_t c = 0; c < n; c++) {
+                half[r * n + c] = 0.5f * potential[r * n + c];
+                halfT[r * n + c] = 0.5f * potential[c * n + r];
+            }
+        }
+    });
+    for (AlignedArray<float>& buffer : scratch_) buffer.Reallocate(0, 0);
+}
+
+void CrankNicolsonAdi::HalfStep(const float* re, const float* im, float* outRe, float* outIm, const float* halfPotential) {
+    const size_t n = n_;
+    const size_t threads = static_cast<size_t>(GetThreadPool().ThreadCount());
+    size_t width = ADI_MAX_STRIP_WIDTH;
+    while (width > ADI_MIN_STRIP_WIDTH && n / width < threads) width /= 2;
+    if (width > n) width = n;
+    const size_t plane = n * width;
+    while (scratch_.size() < threads) scratch_.emplace_back();
+    // c' for every row of a strip, then a row of zeros standing in for the
+    // row above the first.
+    for (size_t t = 0; t < threads; t++) scratch_[t].Reallocate(2 * plane + width, 0);
+    AlignedArray<float>* scratch = scratch_.data();
+    const float g = 0.5f * dt_;
+    ParallelFor(n / width, 1, [&](size_t begin, size_t end) {
+        float* cpRe = scratch[ThreadPool::CurrentWorkerIndex()].Data();
+        float* cpIm = cpRe + plane;
+        const float* zero = cpRe + 2 * plane;
+        for (size_t strip = begin; strip < end; strip++) {
+            const size_t column = strip * width;
+            ThomasRow t;
+            t.g = g;
+            t.q = 0.5f * g;
+            t.leftEdge = column == 0;
+            t.rightEdge = column + width == n;
+            t.width = width;
+            for (size_t r = 0; r < n; r++) {
+                const size_t offset = r * n + column;
+                t.re = re + offset;
+                t.im = im + offset;
+                t.v = halfPotential + offset;
+                t.prevCpRe = r > 0 ? cpRe + (r - 1) * width : zero;
+                t.prevCpIm = r > 0 ? cpIm + (r - 1) * width : zero;
+                t.prevDpRe = r > 0 ? outRe + offset - n : zero;
+                t.prevDpIm = r > 0 ? outIm + offset - n : zero;
+                t.cpRe = cpRe + r * width;
+                t.cpIm = cpIm + r * width;
+                t.dpRe = outRe + offset;
+                t.dpIm = outIm + offset;
+                ForwardRow(t);
+            }
+            for (size_t r = n - 1; r-- > 0;) {
+                const size_t offset = r * n + column;
+                BackRow(outRe + offset, outIm + offset, cpRe + r * width, cpIm + r * width, outRe + offset + n, outIm + offset + n, width);
+            }
+        }
+    });
+}
+
+void CrankNicolsonAdi::Step(float* re, float* im) {
+    float* stageRe = stageRe_.Data();
+    float* stageIm = stageIm_.Data();
+    HalfStep(re, im, stageRe, stageIm, halfPotential_.Data());
+    TransposeSquare(stageRe, stageIm, n_);
+    HalfStep(stageRe, stageIm, re, im, halfPotentialT_.Data());
+    TransposeSquare(re, im, n_);
+}
@@ -0,0 +1,49 @@
+#ifndef CRANK_NICOLSON_H
+#define CRANK_NICOLSON_H
+
+#include "particle_system.h"
+#include <vector>
+
+// Tridiagonal systems solved together by one task, one per column; a strip
+// row is a run of SIMD lanes. A half step walks every strip down the whole
+// grid, touching a new page per row, so wider strips make fewer of those
+// walks; strips narrow towards the minimum only to give every thread one.
+const size_t ADI_MIN_STRIP_WIDTH = 32;
+const size_t ADI_MAX_STRIP_WIDTH = 256;
+
+// Crank-Nicolson for i dpsi/dt = H psi, H = -laplacian / 2 + V, on a square
+// power-of-two grid with psi = 0 outside it. Peaceman-Rachford ADI splits a
+// step into two halves that are each implicit along one axis only:
+//   (1 + i dt/2 Hy) psi* = (1 - i dt/2 Hx) psi
+//   (1 + i dt/2 Hx) psi' = (1 - i dt/2 Hy) psi*
+// with V shared equally between Hx and Hy. A half step is n independent
+// tridiagonal systems, solved by the Thomas algorithm down the columns so
+// that neighbouring columns are neighbouring SIMD lanes; the second half
+// works on the transposed grid. Every factor is unitary for any dt, so a
+// barrier can be as tall and sharp as one cell of large V.
+class CrankNicolsonAdi {
+public:
+    CrankNicolsonAdi();
+
+    // n must be a power of two; potential holds the n * n values of V.
+    void Resize(size_t n, float dt, const float* potential);
+    size_t Size() const { return n_; }
+
+    void Step(float* re, float* im);
+
+private:
+    // Explicit along rows, implicit along columns, from (re, im) into
+    // (outRe, outIm).
+    void HalfStep(const float* re, const float* im, float* outRe, float* outIm, const float* halfPotential);
+
+    size_t n_;
+    float dt_;
+    // V / 2 per cell, and the same transposed for the second half step.
+    AlignedArray<float> halfPotential_;
+    AlignedArray<float> halfPotentialT_;
+    AlignedArray<float> stageRe_;
+    AlignedArray<float> stageIm_;
+    std::vector<AlignedArray<float>> scratch_;
+};
+
+#endif
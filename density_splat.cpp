@@ -0,0 +1,142 @@
+#include "density_splat.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+DensitySplat::DensitySplat() : width_(0), height_(0), usedBuffers_(0) {
+    // Black through violet to white, so sparse regions stay dark and clusters
+    // saturate instead of clipping to one flat colour.
+    for (int k = 0; k < 256; k++) {
+        float v = k / 255.0f;
+        float low = v < 0.5f ? v * 2.0f : 1.0f;
+        float high = v < 0.5f ? 0.0f : (v - 0.5f) * 2.0f;
+        palette_[k] = {static_cast<unsigned char>(160.0f * low + 95.0f * high), static_cast<unsigned char>(255.0f * high),
+                       static_cast<unsigned char>(255.0f * low), 255};
+    }
+}
+
+void DensitySplat::Resize(int width, int height) {
+    if (width == width_ && height == height_) return;
+    width_ = width > 0 ? width : 0;
+    height_ = height > 0 ? height : 0;
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    for (AlignedArray<float>& buffer : buffers_) {
+        buffer.Reallocate(0, 0);
+        buffer.Reallocate(pixels + 1, 0);
+    }
+    density_.Reallocate(pixels, 0);
+    pixels_.Reallocate(pixels, 0);
+    usedBuffers_ = 0;
+}
+
+void DensitySplat::Accumulate(const ParticleSystem& particles, float domainWidth, float domainHeight) {
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    const size_t threads = static_cast<size_t>(GetThreadPool().ThreadCount());
+    // Buffers come back from calloc zeroed and Resolve clears them again, so a
+    // new buffer never needs its own clearing pass. The extra slot past the
+    // last pixel collects particles outside the domain.
+    while (buffers_.size() < threads) {
+        buffers_.emplace_back();
+        buffers_.back().Reallocate(pixels + 1, 0);
+    }
+    if (usedBuffers_ < threads) usedBuffers_ = threads;
+
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    const float scaleX = width_ / domainWidth;
+    const float scaleY = height_ / domainHeight;
+    const float width = static_cast<float>(width_);
+    const float height = static_cast<float>(height_);
+    const uint32_t stride = static_cast<uint32_t>(width_);
+    const uint32_t outside = static_cast<uint32_t>(pixels);
+    AlignedArray<float>* buffers = buffers_.data();
+    ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float* accumulator = buffers[ThreadPool::CurrentWorkerIndex()].Data();
+        uint32_t target[DENSITY_BATCH_SIZE];
+        for (size_t first = begin; first < end; first += DENSITY_BATCH_SIZE) {
+            const size_t n = end - first < DENSITY_BATCH_SIZE ? end - first : DENSITY_BATCH_SIZE;
+            // Branch-free so it vectorizes. The comparison also rejects NaN, and
+            // in-range coordinates are non-negative, so truncation is the floor.
+            for (size_t j = 0; j < n; j++) {
+                const float px = x[first + j] * scaleX;
+                const float py = y[first + j] * scaleY;
+                const bool inside = px >= 0.0f && px < width && py >= 0.0f && py < height;
+                const uint32_t index = static_cast<uint32_t>(inside ? py : 0.0f) * stride + static_cast<uint32_t>(inside ? px : 0.0f);
+                target[j] = inside ? index : outside;
+            }
+            // Unsorted particles hit a random pixel each, so the scatter is bound
+            // by cache misses; prefetching a few targets ahead overlaps them.
+            for (size_t j = 0; j < n; j++) {
+                if (j + DENSITY_PREFETCH_DISTANCE < n) __builtin_prefetch(accumulator + target[j + DENSITY_PREFETCH_DISTANCE], 1, 0);
+                accumulator[target[j]] += 1.0f;
+            }
+        }
+    });
+}
+
+void DensitySplat::Resolve(size_t particleCount) {
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    // Exposure follows the mean density so the picture keeps its brightness as
+    // the particle count moves across four orders of magnitude. Densities are
+    // whole counts, so the 1 - exp(-d * gain) curve is tabulated per frame up to
+    // the count where it saturates.
+    const float mean = pixels > 0 ? static_cast<float>(particleCount) / static_cast<float>(pixels) : 0.0f;
+    const float gain = 1.0f / std::fmax(1.0f, 4.0f * mean);
+    const int levels = static_cast<int>(std::fmin(8.0f / gain, 65535.0f)) + 1;
+    toneCurve_.resize(levels);
+    for (int d = 0; d < levels; d++) {
+        const float v = 1.0f - std::exp(-d * gain);
+        toneCurve_[d] = palette_[static_cast<int>(v * 255.0f)];
+    }
+
+    const size_t used = usedBuffers_;
+    AlignedArray<float>* buffers = buffers_.data();
+    float* density = density_.Data();
+    Color* out = pixels_.Data();
+    const Color* curve = toneCurve_.data();
+    const float last = static_cast<float>(levels - 1);
+    ParallelFor(pixels, DENSITY_TILE_SIZE, [&](size_t begin, size_t end) {
+        const size_t n = end - begin;
+        float* sum = density + begin;
+        for (size_t i = 0; i < n; i++) sum[i] = 0.0f;
+        for (size_t t = 0; t < used; t++) {
+            float* accumulator = buffers[t].Data() + begin;
+            for (size_t i = 0; i < n; i++) sum[i] += accumulator[i];
+            std::memset(accumulator, 0, n * sizeof(float));
+            if (end == pixels) accumulator[n] = 0.0f;
+        }
+        Color* tile = out + begin;
+        for (size_t i = 0; i < n; i++) {
+            tile[i] = curve[static_cast<int>(sum[i] < last ? sum[i] : last)];
+        }
+    });
+    usedBuffers_ = 0;
+}
+
+void DensitySplat::Render(const ParticleSystem& particles, float domainWidth, float domainHeight) {
+    if (width_ == 0 || height_ == 0) return;
+    Accumulate(particles, domainWidth, domainHeight);
+    Resolve(particles.Size());
+}
+
+bool WriteDensityImage(const DensitySplat& splat, const char* path) {
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file) return false;
+    const int width = splat.Width();
+    const int height = splat.Height();
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(static_cast<size_t>(width) * 3);
+    const Color* pixels = splat.Pixels();
+    bool ok = true;
+    for (int py = 0; py < height && ok; py++) {
+        const Color* source = pixels + static_cast<size_t>(py) * width;
+        for (int px = 0; px < width; px++) {
+            row[px * 3 + 0] = source[px].r;
+            row[px * 3 + 1] = source[px].g;
+            row[px * 3 + 2] = source[px].b;
+        }
+        ok = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return std::fclose(file) == 0 && ok;
+}
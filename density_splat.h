@@ -0,0 +1,59 @@
+#ifndef DENSITY_SPLAT_H
+#define DENSITY_SPLAT_H
+
+#include "particle_system.h"
+#include <vector>
+
+// Particle counts above this are drawn as a density image instead of circles;
+// most particles are sub-pixel by then.
+const size_t DENSITY_SPLAT_THRESHOLD = 300000;
+
+// Pixels reduced per task. 16K floats from each thread buffer stay in L2 while
+// they are summed, tone-mapped and cleared for the next frame.
+const size_t DENSITY_TILE_SIZE = 16384;
+
+// Particles whose pixel indices are computed in one branch-free pass before
+// they are scattered.
+const size_t DENSITY_BATCH_SIZE = 1024;
+
+// Scatter targets prefetched ahead of the particle being splatted.
+const size_t DENSITY_PREFETCH_DISTANCE = 16;
+
+// Bins particles into one float accumulation buffer per pool thread, then sums
+// the buffers tile by tile and tone-maps the result into RGBA8 pixels ready for
+// UpdateTexture or an image file. Every particle adds exactly 1.0, so the sums
+// are exact integers and the image does not depend on the thread count.
+class DensitySplat {
+public:
+    DensitySplat();
+
+    void Resize(int width, int height);
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+
+    // Maps [0, domainWidth) x [0, domainHeight) onto the image and fills
+    // Pixels(). Particles outside the domain are dropped.
+    void Render(const ParticleSystem& particles, float domainWidth, float domainHeight);
+
+    const Color* Pixels() const { return pixels_.Data(); }
+    // Particle count per pixel from the last Render.
+    const float* Density() const { return density_.Data(); }
+
+private:
+    void Accumulate(const ParticleSystem& particles, float domainWidth, float domainHeight);
+    void Resolve(size_t particleCount);
+
+    int width_;
+    int height_;
+    size_t usedBuffers_;
+    std::vector<AlignedArray<float>> buffers_;
+    AlignedArray<float> density_;
+    AlignedArray<Color> pixels_;
+    Color palette_[256];
+    std::vector<Color> toneCurve_;
+};
+
+// Binary PPM (P6), readable by most image tools without extra libraries.
+bool WriteDensityImage(const DensitySplat& splat, const char* path);
+
+#endif
@@ -0,0 +1,158 @@
+#include "entanglement.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+
+static const float TWO_PI = 6.28318530718f;
+
+size_t EntanglementGroupCount(size_t particles) {
+    size_t groups = static_cast<size_t>(std::sqrt(static_cast<double>(particles)));
+    return groups > 0 ? groups : 1;
+}
+
+void BuildEntanglementGroups(EntanglementGroups& groups, const uint32_t* id, size_t particles, uint64_t seed, float width, float height) {
+    const size_t groupCount = EntanglementGroupCount(particles);
+    groups.group.Reallocate(PaddedCapacity(particles), 0);
+    groups.offsetX.Reallocate(PaddedCapacity(particles), 0);
+    groups.offsetY.Reallocate(PaddedCapacity(particles), 0);
+    AlignedArray<float>* const perGroup[] = {&groups.centerX, &groups.centerY, &groups.velocityX, &groups.velocityY,
+                                             &groups.angle, &groups.spin, &groups.cosAngle, &groups.sinAngle};
+    for (AlignedArray<float>* array : perGroup) array->Reallocate(PaddedCapacity(groupCount), 0);
+
+    // Disk radius grows with the expected group size so dense groups stay legible.
+    const float spread = 8.0f + 2.0f * std::sqrt(static_cast<float>(particles) / groupCount);
+    const RandomStream memberStream = MakeRandomStream(seed, RNG_STREAM_ENTANGLEMENT, 0);
+    uint32_t* group = groups.group.Data();
+    float* offsetX = groups.offsetX.Data();
+    float* offsetY = groups.offsetY.Data();
+    ParallelFor(particles, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t words[4];
+            RandomWords(memberStream, id[i], words);
+            const float theta = BitsToUniform(words[1]) * TWO_PI;
+            const float r = spread * std::sqrt(BitsToUniform(words[2]));
+            group[i] = BitsBelow(words[0], static_cast<uint32_t>(groupCount));
+            offsetX[i] = r * std::cos(theta);
+            offsetY[i] = r * std::sin(theta);
+        }
+    });
+
+    const RandomStream groupStream = MakeRandomStream(seed, RNG_STREAM_ENTANGLEMENT, 1);
+    const float marginX = width > 2.0f * spread ? spread : 0.0f;
+    const float marginY = height > 2.0f * spread ? spread : 0.0f;
+    for (size_t g = 0; g < groupCount; g++) {
+        float u[4];
+        uint32_t words[4];
+        RandomWords(groupStream, g, words);
+        for (int k = 0; k < 4; k++) u[k] = BitsToUniform(words[k]);
+        groups.centerX[g] = marginX + u[0] * (width - 2.0f * marginX);
+        groups.centerY[g] = marginY + u[1] * (height - 2.0f * marginY);
+        groups.velocityX[g] = (u[2] * 2.0f - 1.0f) * 2.0f;
+        groups.velocityY[g] = (u[3] * 2.0f - 1.0f) * 2.0f;
+        groups.spin[g] = (BitsToUniform(words[0] ^ words[3]) * 2.0f - 1.0f) * 0.03f;
+        groups.angle[g] = 0.0f;
+        groups.cosAngle[g] = 1.0f;
+        groups.sinAngle[g] = 0.0f;
+    }
+    groups.members = particles;
+    groups.count = groupCount;
+}
+
+void AdvanceEntanglementGroups(EntanglementGroups& groups, float dt, float width, float height) {
+    IntegrateAndReflect(groups.centerX.Data(), groups.centerY.Data(), groups.velocityX.Data(), groups.velocityY.Data(),
+                        groups.count, dt, width, height);
+    for (size_t g = 0; g < groups.count; g++) {
+        float angle = groups.angle[g] + groups.spin[g] * dt;
+        if (angle >= TWO_PI) angle -= TWO_PI;
+        if (angle < 0.0f) angle += TWO_PI;
+        groups.angle[g] = angle;
+        groups.cosAngle[g] = std::cos(angle);
+        groups.sinAngle[g] = std::sin(angle);
+    }
+}
+
+static void ScatterEntanglementScalar(const EntanglementGroups& groups, float* x, float* y, float* vx, float* vy, size_t first, size_t count) {
+    const uint32_t* group = groups.group.Data();
+    const float* offsetX = groups.offsetX.Data();
+    const float* offsetY = groups.offsetY.Data();
+    for (size_t i = first; i < first + count; i++) {
+        const uint32_t g = group[i];
+        const float c = groups.cosAngle[g];
+        const float s = groups.sinAngle[g];
+        x[i] = groups.centerX[g] + (c * offsetX[i] - s * offsetY[i]);
+        y[i] = groups.centerY[g] + (s * offsetX[i] + c * offsetY[i]);
+        vx[i] = groups.velocityX[g];
+        vy[i] = groups.velocityY[g];
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+__attribute__((target("avx2")))
+static size_t ScatterEntanglementAvx2(const EntanglementGroups& groups, float* x, float* y, float* vx, float* vy, size_t first, size_t count) {
+    const int* group = reinterpret_cast<const int*>(groups.group.Data());
+    const float* offsetX = groups.offsetX.Data();
+    const float* offsetY = groups.offsetY.Data();
+    size_t i = first;
+    for (; i + 8 <= first + count; i += 8) {
+        const __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(group + i));
+        const __m256 c = _mm256_i32gather_ps(groups.cosAngle.Data(), g, 4);
+        const __m256 s = _mm256_i32gather_ps(groups.sinAngle.Data(), g, 4);
+        const __m256 ox = _mm256_loadu_ps(offsetX + i);
+        const __m256 oy = _mm256_loadu_ps(offsetY + i);
+        const __m256 rx = _mm256_sub_ps(_mm256_mul_ps(c, ox), _mm256_mul_ps(s, oy));
+        const __m256 ry = _mm256_add_ps(_mm256_mul_ps(s, ox), _mm256_mul_ps(c, oy));
+        _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_i32gather_ps(groups.centerX.Data(), g, 4), rx));
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_i32gather_ps(groups.centerY.Data(), g, 4), ry));
+        _mm256_storeu_ps(vx + i, _mm256_i32gather_ps(groups.velocityX.Data(), g, 4));
+        _mm256_storeu_ps(vy + i, _mm256_i32gather_ps(groups.velocityY.Data(), g, 4));
+    }
+    return i - first;
+}
+
+// The masked form with a zeroed source sidesteps GCC's uninitialized-source
+// warning on the plain gather.
+__attribute__((target("avx512f")))
+static inline __m512 GatherAvx512(const float* base, __m512i index) {
+    return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, index, base, 4);
+}
+
+QPS_AVX512_TARGET
+static size_t ScatterEntanglementAvx512(const EntanglementGroups& groups, float* x, float* y, float* vx, float* vy, size_t first, size_t count) {
+    const int* group = reinterpret_cast<const int*>(groups.group.Data());
+    const float* offsetX = groups.offsetX.Data();
+    const float* offsetY = groups.offsetY.Data();
+    size_t i = first;
+    for (; i + 16 <= first + count; i += 16) {
+        const __m512i g = _mm512_loadu_si512(group + i);
+        const __m512 c = GatherAvx512(groups.cosAngle.Data(), g);
+        const __m512 s = GatherAvx512(groups.sinAngle.Data(), g);
+        const __m512 ox = _mm512_loadu_ps(offsetX + i);
+        const __m512 oy = _mm512_loadu_ps(offsetY + i);
+        const __m512 rx = _mm512_sub_ps(_mm512_mul_ps(c, ox), _mm512_mul_ps(s, oy));
+        const __m512 ry = _mm512_add_ps(_mm512_mul_ps(s, ox), _mm512_mul_ps(c, oy));
+        _mm512_storeu_ps(x + i, _mm512_add_ps(GatherAvx512(groups.centerX.Data(), g), rx));
+        _mm512_storeu_ps(y + i, _mm512_add_ps(GatherAvx512(groups.centerY.Data(), g), ry));
+        _mm512_storeu_ps(vx + i, GatherAvx512(groups.velocityX.Data(), g));
+        _mm512_storeu_ps(vy + i, GatherAvx512(groups.velocityY.Data(), g));
+    }
+    return i - first;
+}
+
+#endif
+
+void ScatterEntanglementGroups(const EntanglementGroups& groups, float* x, float* y, float* vx, float* vy, size_t first, size_t count) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = ScatterEntanglementAvx512(groups, x, y, vx, vy, first, count);
+    } else if (level == SIMD_AVX2) {
+        done = ScatterEntanglementAvx2(groups, x, y, vx, vy, first, count);
+    }
+#else
+    (void)level;
+#endif
+    ScatterEntanglementScalar(groups, x, y, vx, vy, first + done, count - done);
+}
@@ -0,0 +1,47 @@
+#ifndef ENTANGLEMENT_H
+#define ENTANGLEMENT_H
+
+#include "aligned_array.h"
+#include <cstddef>
+#include <cstdint>
+
+// Entangled groups used by the ENTANGLEMENT principle, built on first use.
+// Every particle belongs to one group and keeps a fixed offset in that group's
+// frame; the frame (centre, velocity, rotation) is shared by all members.
+struct EntanglementGroups {
+    // Per particle.
+    AlignedArray<uint32_t> group;
+    AlignedArray<float> offsetX;
+    AlignedArray<float> offsetY;
+    // Per group.
+    AlignedArray<float> centerX;
+    AlignedArray<float> centerY;
+    AlignedArray<float> velocityX;
+    AlignedArray<float> velocityY;
+    AlignedArray<float> angle;
+    AlignedArray<float> spin;
+    AlignedArray<float> cosAngle;
+    AlignedArray<float> sinAngle;
+    size_t members = 0;
+    size_t count = 0;
+};
+
+// Groups built for a particle count: about sqrt(count) groups of about
+// sqrt(count) members, so 1M particles form ~1000 groups of ~1000.
+size_t EntanglementGroupCount(size_t particles);
+
+// Assigns every particle to a random group at a random offset inside the
+// group's disk and gives each group a random centre, velocity and spin. A
+// particle's group and offset follow from its id, so they survive re-sorting.
+// Deterministic for a seed at any thread count.
+void BuildEntanglementGroups(EntanglementGroups& groups, const uint32_t* id, size_t particles, uint64_t seed, float width, float height);
+
+// Moves and rotates every group frame by dt frames. Cost is per group, not per
+// member.
+void AdvanceEntanglementGroups(EntanglementGroups& groups, float dt, float width, float height);
+
+// Places members [first, first + count) at their offsets in their group's
+// frame and gives them the group velocity. Pure gathers from the group arrays.
+void ScatterEntanglementGroups(const EntanglementGroups& groups, float* x, float* y, float* vx, float* vy, size_t first, size_t count);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef FAST_LOG_H
+#define FAST_LOG_H
+
+#include "simd_kernels.h"
+#include <cstdint>
+#include <cstring>
+
+// ln v for positive normal v, as a short polynomial rather than a libm call so
+// the vector paths can evaluate it too: v = 2^e m with m in [sqrt(1/2),
+// sqrt(2)), and ln m = 2 atanh(s), s = (m - 1) / (m + 1), as an odd series in
+// s. ln 2 is split so e ln 2 stays exact. Every path does the same operations
+// in the same order and gives the same bits.
+const float LN2_HI = 0.693359375f;
+const float LN2_LO = -2.12194440e-4f;
+const float LOG_C3 = 1.0f / 3.0f;
+const float LOG_C5 = 1.0f / 5.0f;
+const float LOG_C7 = 1.0f / 7.0f;
+const float LOG_C9 = 1.0f / 9.0f;
+// sqrt(2) as a float, whose exponent field is that of 1.
+const uint32_t LOG_SQRT2_BITS = 0x3FB504F3u;
+
+inline float LogPositive(float v) {
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    int32_t exponent = static_cast<int32_t>(bits >> 23) - 127;
+    uint32_t mantissaBits = (bits & 0x007FFFFFu) | 0x3F800000u;
+    if (mantissaBits > LOG_SQRT2_BITS) {
+        mantissaBits -= 0x00800000u;
+        exponent += 1;
+    }
+    float m;
+    std::memcpy(&m, &mantissaBits, sizeof(m));
+    const float s = (m - 1.0f) / (m + 1.0f);
+    const float z = s * s;
+    const float series = z * (LOG_C3 + z * (LOG_C5 + z * (LOG_C7 + z * LOG_C9)));
+    const float e = static_cast<float>(exponent);
+    return e * LN2_HI + ((s + s) + ((s + s) * series + e * LN2_LO));
+}
+
+#ifdef QPS_X86_SIMD
+
+__attribute__((target("avx2")))
+inline __m256 LogPositiveAvx2(__m256 v) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i bits = _mm256_castps_si256(v);
+    __m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127));
+    __m256i mantissaBits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000));
+    const __m256i high = _mm256_cmpgt_epi32(mantissaBits, _mm256_set1_epi32(static_cast<int>(LOG_SQRT2_BITS)));
+    mantissaBits = _mm256_sub_epi32(mantissaBits, _mm256_and_si256(high, _mm256_set1_epi32(0x00800000)));
+    exponent = _mm256_sub_epi32(exponent, high);
+    const __m256 m = _mm256_castsi256_ps(mantissaBits);
+    const __m256 s = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    const __m256 z = _mm256_mul_ps(s, s);
+    __m256 series = _mm256_add_ps(_mm256_set1_ps(LOG_C7), _mm256_mul_ps(z, _mm256_set1_ps(LOG_C9)));
+    series = _mm256_add_ps(_mm256_set1_ps(LOG_C5), _mm256_mul_ps(z, series));
+    series = _mm256_add_ps(_mm256_set1_ps(LOG_C3), _mm256_mul_ps(z, series));
+    series = _mm256_mul_ps(z, series);
+    const __m256 e = _mm256_cvtepi32_ps(exponent);
+    const __m256 twoS = _mm256_add_ps(s, s);
+    return _mm256_add_ps(_mm256_mul_ps(e, _mm256_set1_ps(LN2_HI)),
+                         _mm256_add_ps(twoS, _mm256_add_ps(_mm256_mul_ps(twoS, series), _mm256_mul_ps(e, _mm256_set1_ps(LN2_LO)))));
+}
+
+// The maskz shift and conversion keep GCC from warning about the undefined
+// passthrough operand of the unmasked ones.
+QPS_AVX512_TARGET
+inline __m512 LogPositiveAvx512(__m512 v) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512i bits = _mm512_castps_si512(v);
+    __m512i exponent = _mm512_sub_epi32(_mm512_maskz_srli_epi32(0xFFFF, bits, 23), _mm512_set1_epi32(127));
+    __m512i mantissaBits = _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3F800000));
+    const __mmask16 high = _mm512_cmpgt_epi32_mask(mantissaBits, _mm512_set1_epi32(static_cast<int>(LOG_SQRT2_BITS)));
+    mantissaBits = _mm512_mask_sub_epi32(mantissaBits, high, mantissaBits, _mm512_set1_epi32(0x00800000));
+    exponent = _mm512_mask_add_epi32(exponent, high, exponent, _mm512_set1_epi32(1));
+    const __m512 m = _mm512_castsi512_ps(mantissaBits);
+    const __m512 s = _mm512_div_ps(_mm512_sub_ps(m, one), _mm512_add_ps(m, one));
+    const __m512 z = _mm512_mul_ps(s, s);
+    __m512 series = _mm512_add_ps(_mm512_set1_ps(LOG_C7), _mm512_mul_ps(z, _mm512_set1_ps(LOG_C9)));
+    series = _mm512_add_ps(_mm512_set1_ps(LOG_C5), _mm512_mul_ps(z, series));
+    series = _mm512_add_ps(_mm512_set1_ps(LOG_C3), _mm512_mul_ps(z, series));
+    series = _mm512_mul_ps(z, series);
+    const __m512 e = _mm512_maskz_cvtepi32_ps(0xFFFF, exponent);
+    const __m512 twoS = _mm512_add_ps(s, s);
+    return _mm512_add_ps(_mm512_mul_ps(e, _mm512_set1_ps(LN2_HI)),
+                         _mm512_add_ps(twoS, _mm512_add_ps(_mm512_mul_ps(twoS, series), _mm512_mul_ps(e, _mm512_set1_ps(LN2_LO)))));
+}
+
+#endif
+
+#endif
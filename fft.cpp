@@ -0,0 +1,356 @@
+#include "fft.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// One butterfly applied across a run of strip columns. Inputs are rows
+// in, in + inStride, ...; outputs are rows out, out + outStride, ...
+// Twiddles are (re, im) pairs: w1 for radix-2, w1..w3 for radix-4.
+struct ButterflySpan {
+    const float* inRe;
+    const float* inIm;
+    size_t inStride;
+    float* outRe;
+    float* outIm;
+    size_t outStride;
+    float w[6];
+};
+
+static void Radix4Scalar(const ButterflySpan& b, size_t first, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    for (size_t j = first; j < first + count; j++) {
+        const float apcR = b.inRe[j] + b.inRe[j + 2 * is];
+        const float apcI = b.inIm[j] + b.inIm[j + 2 * is];
+        const float amcR = b.inRe[j] - b.inRe[j + 2 * is];
+        const float amcI = b.inIm[j] - b.inIm[j + 2 * is];
+        const float bpdR = b.inRe[j + is] + b.inRe[j + 3 * is];
+        const float bpdI = b.inIm[j + is] + b.inIm[j + 3 * is];
+        const float bmdR = b.inRe[j + is] - b.inRe[j + 3 * is];
+        const float bmdI = b.inIm[j + is] - b.inIm[j + 3 * is];
+        // -i (b - d) = (bmdI, -bmdR)
+        const float t1R = amcR + bmdI;
+        const float t1I = amcI - bmdR;
+        const float t2R = apcR - bpdR;
+        const float t2I = apcI - bpdI;
+        const float t3R = amcR - bmdI;
+        const float t3I = amcI + bmdR;
+        b.outRe[j] = apcR + bpdR;
+        b.outIm[j] = apcI + bpdI;
+        b.outRe[j + os] = t1R * b.w[0] - t1I * b.w[1];
+        b.outIm[j + os] = t1R * b.w[1] + t1I * b.w[0];
+        b.outRe[j + 2 * os] = t2R * b.w[2] - t2I * b.w[3];
+        b.outIm[j + 2 * os] = t2R * b.w[3] + t2I * b.w[2];
+        b.outRe[j + 3 * os] = t3R * b.w[4] - t3I * b.w[5];
+        b.outIm[j + 3 * os] = t3R * b.w[5] + t3I * b.w[4];
+    }
+}
+
+static void Radix2Scalar(const ButterflySpan& b, size_t first, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    for (size_t j = first; j < first + count; j++) {
+        const float dR = b.inRe[j] - b.inRe[j + is];
+        const float dI = b.inIm[j] - b.inIm[j + is];
+        b.outRe[j] = b.inRe[j] + b.inRe[j + is];
+        b.outIm[j] = b.inIm[j] + b.inIm[j + is];
+        b.outRe[j + os] = dR * b.w[0] - dI * b.w[1];
+        b.outIm[j + os] = dR * b.w[1] + dI * b.w[0];
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+__attribute__((target("avx2")))
+static size_t Radix4Avx2(const ButterflySpan& b, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    const __m256 w1r = _mm256_set1_ps(b.w[0]), w1i = _mm256_set1_ps(b.w[1]);
+    const __m256 w2r = _mm256_set1_ps(b.w[2]), w2i = _mm256_set1_ps(b.w[3]);
+    const __m256 w3r = _mm256_set1_ps(b.w[4]), w3i = _mm256_set1_ps(b.w[5]);
+    size_t j = 0;
+    for (; j + 8 <= count; j += 8) {
+        const __m256 aR = _mm256_loadu_ps(b.inRe + j), aI = _mm256_loadu_ps(b.inIm + j);
+        const __m256 bR = _mm256_loadu_ps(b.inRe + j + is), bI = _mm256_loadu_ps(b.inIm + j + is);
+        const __m256 cR = _mm256_loadu_ps(b.inRe + j + 2 * is), cI = _mm256_loadu_ps(b.inIm + j + 2 * is);
+        const __m256 dR = _mm256_loadu_ps(b.inRe + j + 3 * is), dI = _mm256_loadu_ps(b.inIm + j + 3 * is);
+        const __m256 apcR = _mm256_add_ps(aR, cR), apcI = _mm256_add_ps(aI, cI);
+        const __m256 amcR = _mm256_sub_ps(aR, cR), amcI = _mm256_sub_ps(aI, cI);
+        const __m256 bpdR = _mm256_add_ps(bR, dR), bpdI = _mm256_add_ps(bI, dI);
+        const __m256 bmdR = _mm256_sub_ps(bR, dR), bmdI = _mm256_sub_ps(bI, dI);
+        const __m256 t1R = _mm256_add_ps(amcR, bmdI), t1I = _mm256_sub_ps(amcI, bmdR);
+        const __m256 t2R = _mm256_sub_ps(apcR, bpdR), t2I = _mm256_sub_ps(apcI, bpdI);
+        const __m256 t3R = _mm256_sub_ps(amcR, bmdI), t3I = _mm256_add_ps(amcI, bmdR);
+        _mm256_storeu_ps(b.outRe + j, _mm256_add_ps(apcR, bpdR));
+        _mm256_storeu_ps(b.outIm + j, _mm256_add_ps(apcI, bpdI));
+        _mm256_storeu_ps(b.outRe + j + os, _mm256_sub_ps(_mm256_mul_ps(t1R, w1r), _mm256_mul_ps(t1I, w1i)));
+        _mm256_storeu_ps(b.outIm + j + os, _mm256_add_ps(_mm256_mul_ps(t1R, w1i), _mm256_mul_ps(t1I, w1r)));
+        _mm256_storeu_ps(b.outRe + j + 2 * os, _mm256_sub_ps(_mm256_mul_ps(t2R, w2r), _mm256_mul_ps(t2I, w2i)));
+        _mm256_storeu_ps(b.outIm + j + 2 * os, _mm256_add_ps(_mm256_mul_ps(t2R, w2i), _mm256_mul_ps(t2I, w2r)));
+        _mm256_storeu_ps(b.outRe + j + 3 * os, _mm256_sub_ps(_mm256_mul_ps(t3R, w3r), _mm256_mul_ps(t3I, w3i)));
+        _mm256_storeu_ps(b.outIm + j + 3 * os, _mm256_add_ps(_mm256_mul_ps(t3R, w3i), _mm256_mul_ps(t3I, w3r)));
+    }
+    return j;
+}
+
+__attribute__((target("avx2")))
+static size_t Radix2Avx2(const ButterflySpan& b, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    const __m256 wr = _mm256_set1_ps(b.w[0]), wi = _mm256_set1_ps(b.w[1]);
+    size_t j = 0;
+    for (; j + 8 <= count; j += 8) {
+        const __m256 aR = _mm256_loadu_ps(b.inRe + j), aI = _mm256_loadu_ps(b.inIm + j);
+        const __m256 bR = _mm256_loadu_ps(b.inRe + j + is), bI = _mm256_loadu_ps(b.inIm + j + is);
+        const __m256 dR = _mm256_sub_ps(aR, bR), dI = _mm256_sub_ps(aI, bI);
+        _mm256_storeu_ps(b.outRe + j, _mm256_add_ps(aR, bR));
+        _mm256_storeu_ps(b.outIm + j, _mm256_add_ps(aI, bI));
+        _mm256_storeu_ps(b.outRe + j + os, _mm256_sub_ps(_mm256_mul_ps(dR, wr), _mm256_mul_ps(dI, wi)));
+        _mm256_storeu_ps(b.outIm + j + os, _mm256_add_ps(_mm256_mul_ps(dR, wi), _mm256_mul_ps(dI, wr)));
+    }
+    return j;
+}
+
+QPS_AVX512_TARGET
+static size_t Radix4Avx512(const ButterflySpan& b, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    const __m512 w1r = _mm512_set1_ps(b.w[0]), w1i = _mm512_set1_ps(b.w[1]);
+    const __m512 w2r = _mm512_set1_ps(b.w[2]), w2i = _mm512_set1_ps(b.w[3]);
+    const __m512 w3r = _mm512_set1_ps(b.w[4]), w3i = _mm512_set1_ps(b.w[5]);
+    size_t j = 0;
+    for (; j + 16 <= count; j += 16) {
+        const __m512 aR = _mm512_loadu_ps(b.inRe + j), aI = _mm512_loadu_ps(b.inIm + j);
+        const __m512 bR = _mm512_loadu_ps(b.inRe + j + is), bI = _mm512_loadu_ps(b.inIm + j + is);
+        const __m512 cR = _mm512_loadu_ps(b.inRe + j + 2 * is), cI = _mm512_loadu_ps(b.inIm + j + 2 * is);
+        const __m512 dR = _mm512_loadu_ps(b.inRe + j + 3 * is), dI = _mm512_loadu_ps(b.inIm + j + 3 * is);
+        const __m512 apcR = _mm512_add_ps(aR, cR), apcI = _mm512_add_ps(aI, cI);
+        const __m512 amcR = _mm512_sub_ps(aR, cR), amcI = _mm512_sub_ps(aI, cI);
+        const __m512 bpdR = _mm512_add_ps(bR, dR), bpdI = _mm512_add_ps(bI, dI);
+        const __m512 bmdR = _mm512_sub_ps(bR, dR), bmdI = _mm512_sub_ps(bI, dI);
+        const __m512 t1R = _mm512_add_ps(amcR, bmdI), t1I = _mm512_sub_ps(amcI, bmdR);
+        const __m512 t2R = _mm512_sub_ps(apcR, bpdR), t2I = _mm512_sub_ps(apcI, bpdI);
+        const __m512 t3R = _mm512_sub_ps(amcR, bmdI), t3I = _mm512_add_ps(amcI, bmdR);
+        _mm512_storeu_ps(b.outRe + j, _mm512_add_ps(apcR, bpdR));
+        _mm512_storeu_ps(b.outIm + j, _mm512_add_ps(apcI, bpdI));
+        _mm512_storeu_ps(b.outRe + j + os, _mm512_sub_ps(_mm512_mul_ps(t1R, w1r), _mm512_mul_ps(t1I, w1i)));
+        _mm512_storeu_ps(b.outIm + j + os, _mm512_add_ps(_mm512_mul_ps(t1R, w1i), _mm512_mul_ps(t1I, w1r)));
+        _mm512_storeu_ps(b.outRe + j + 2 * os, _mm512_sub_ps(_mm512_mul_ps(t2R, w2r), _mm512_mul_ps(t2I, w2i)));
+        _mm512_storeu_ps(b.outIm + j + 2 * os, _mm512_add_ps(_mm512_mul_ps(t2R, w2i), _mm512_mul_ps(t2I, w2r)));
+        _mm512_storeu_ps(b.outRe + j + 3 * os, _mm512_sub_ps(_mm512_mul_ps(t3R, w3r), _mm512_mul_ps(t3I, w3i)));
+        _mm512_storeu_ps(b.outIm + j + 3 * os, _mm512_add_ps(_mm512_mul_ps(t3R, w3i), _mm512_mul_ps(t3I, w3r)));
+    }
+    return j;
+}
+
+QPS_AVX512_TARGET
+static size_t Radix2Avx512(const ButterflySpan& b, size_t count) {
+    const size_t is = b.inStride;
+    const size_t os = b.outStride;
+    const __m512 wr = _mm512_set1_ps(b.w[0]), wi = _mm512_set1_ps(b.w[1]);
+    size_t j = 0;
+    for (; j + 16 <= count; j += 16) {
+        const __m512 aR = _mm512_loadu_ps(b.inRe + j), aI = _mm512_loadu_ps(b.inIm + j);
+        const __m512 bR = _mm512_loadu_ps(b.inRe + j + is), bI = _mm512_loadu_ps(b.inIm + j + is);
+        const __m512 dR = _mm512_sub_ps(aR, bR), dI = _mm512_sub_ps(aI, bI);
+        _mm512_storeu_ps(b.outRe + j, _mm512_add_ps(aR, bR));
+        _mm512_storeu_ps(b.outIm + j, _mm512_add_ps(aI, bI));
+        _mm512_storeu_ps(b.outRe + j + os, _mm512_sub_ps(_mm512_mul_ps(dR, wr), _mm512_mul_ps(dI, wi)));
+        _mm512_storeu_ps(b.outIm + j + os, _mm512_add_ps(_mm512_mul_ps(dR, wi), _mm512_mul_ps(dI, wr)));
+    }
+    return j;
+}
+
+#endif
+
+static void Radix4(const ButterflySpan& b, size_t count) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = Radix4Avx512(b, count);
+    } else if (level == SIMD_AVX2) {
+        done = Radix4Avx2(b, count);
+    }
+#else
+    (void)level;
+#endif
+    Radix4Scalar(b, done, count - done);
+}
+
+static void Radix2(const ButterflySpan& b, size_t count) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = Radix2Avx512(b, count);
+    } else if (level == SIMD_AVX2) {
+        done = Radix2Avx2(b, count);
+    }
+#else
+    (void)level;
+#endif
+    Radix2Scalar(b, done, count - done);
+}
+
+Fft2D::Fft2D() : n_(0) {}
+
+void Fft2D::Resize(size_t n) {
+    if (n == n_) return;
+    n_ = n;
+    twiddleRe_.Reallocate(n, 0);
+    twiddleIm_.Reallocate(n, 0);
+    for (size_t k = 0; k < n; k++) {
+        const double angle = -6.283185307179586 * static_cast<double>(k) / static_cast<double>(n);
+        twiddleRe_[k] = static_cast<float>(std::cos(angle));
+        twiddleIm_[k] = static_cast<float>(std::sin(angle));
+    }
+    for (AlignedArray<float>& buffer : scratch_) buffer.Reallocate(0, 0);
+}
+
+void Fft2D::ColumnPass(float* re, float* im) {
+    const size_t n = n_;
+    const size_t width = n < FFT_STRIP_WIDTH ? n : FFT_STRIP_WIDTH;
+    const size_t plane = n * width;
+    const size_t threads = static_cast<size_t>(GetThreadPool().ThreadCount());
+    while (scratch_.size() < threads) scratch_.emplace_back();
+    for (size_t t = 0; t < threads; t++) scratch_[t].Reallocate(4 * plane, 0);
+    const float* twRe = twiddleRe_.Data();
+    const float* twIm = twiddleIm_.Data();
+    AlignedArray<float>* scratch = scratch_.data();
+    size_t stages = 0;
+    for (size_t length = n; length >= 2; length /= (length >= 4 ? 4 : 2)) stages++;
+    ParallelFor(n / width, 1, [&](size_t begin, size_t end) {
+        float* buffer = scratch[ThreadPool::CurrentWorkerIndex()].Data();
+        for (size_t strip = begin; strip < end; strip++) {
+            const size_t column = strip * width;
+            // The first stage reads straight from the grid and the last writes
+            // straight back, so the strided strip rows are touched once each
+            // way; only a single-stage transform, which cannot run in place,
+            // goes through a copy.
+            float* srcRe = re + column;
+            float* srcIm = im + column;
+            size_t srcPitch = n;
+            float* dstRe = buffer;
+            float* dstIm = buffer + plane;
+            if (stages == 1) {
+                for (size_t r = 0; r < n; r++) {
+                    std::memcpy(buffer + 2 * plane + r * width, re + r * n + column, width * sizeof(float));
+                    std::memcpy(buffer + 3 * plane + r * width, im + r * n + column, width * sizeof(float));
+                }
+                srcRe = buffer + 2 * plane;
+                srcIm = buffer + 3 * plane;
+                srcPitch = width;
+            }
+            // Stockham: a stage reads rows q + s*(p + k*m) and writes rows
+            // q + s*(radix*p + k); the output is in natural order at the end.
+            size_t length = n;
+            size_t s = 1;
+            for (size_t stage = 0; stage < stages; stage++) {
+                const bool last = stage + 1 == stages;
+                size_t dstPitch = width;
+                if (last) {
+                    dstRe = re + column;
+                    dstIm = im + column;
+                    dstPitch = n;
+                }
+                ButterflySpan b;
+                if (length >= 4) {
+                    const size_t m = length / 4;
+                    const size_t step = n / length;
+                    b.inStride = s * m * srcPitch;
+                    b.outStride = s * dstPitch;
+                    for (size_t p = 0; p < m; p++) {
+                        b.w[0] = twRe[p * step];
+                        b.w[1] = twIm[p * step];
+                        b.w[2] = twRe[2 * p * step];
+                        b.w[3] = twIm[2 * p * step];
+                        b.w[4] = twRe[3 * p * step];
+                        b.w[5] = twIm[3 * p * step];
+                        for (size_t q = 0; q < s; q++) {
+                            b.inRe = srcRe + (q + s * p) * srcPitch;
+                            b.inIm = srcIm + (q + s * p) * srcPitch;
+                            b.outRe = dstRe + (q + s * 4 * p) * dstPitch;
+                            b.outIm = dstIm + (q + s * 4 * p) * dstPitch;
+                            Radix4(b, width);
+                        }
+                    }
+                    length /= 4;
+                    s *= 4;
+                } else {
+                    // Last stage of an odd power of two; its only twiddle is 1.
+                    b.inStride = s * srcPitch;
+                    b.outStride = s * dstPitch;
+                    b.w[0] = 1.0f;
+                    b.w[1] = 0.0f;
+                    for (size_t q = 0; q < s; q++) {
+                        b.inRe = srcRe + q * srcPitch;
+                        b.inIm = srcIm + q * srcPitch;
+                        b.outRe = dstRe + q * dstPitch;
+                        b.outIm = dstIm + q * dstPitch;
+                        Radix2(b, width);
+                    }
+                    length /= 2;
+                    s *= 2;
+                }
+                if (!last) {
+                    // Ping-pong between the two scratch plane pairs.
+                    srcRe = dstRe;
+                    srcIm = dstIm;
+                    srcPitch = width;
+                    dstRe = dstRe == buffer ? buffer + 2 * plane : buffer;
+                    dstIm = dstRe + plane;
+                }
+            }
+        }
+    });
+}
+
+// Copies one tile out transposed through a contiguous buffer. Rows of a
+// power-of-two grid are a power-of-two stride apart and would all land in the
+// same L1 set if a tile's column were walked in place.
+static void LoadTile(const float* grid, size_t n, size_t row, size_t column, size_t tile, float* buffer) {
+    for (size_t i = 0; i < tile; i++) std::memcpy(buffer + i * tile, grid + (row + i) * n + column, tile * sizeof(float));
+}
+
+static void StoreTileTransposed(float* grid, size_t n, size_t row, size_t column, size_t tile, const float* buffer) {
+    for (size_t j = 0; j < tile; j++) {
+        float* out = grid + (row + j) * n + column;
+        for (size_t i = 0; i < tile; i++) out[i] = buffer[i * tile + j];
+    }
+}
+
+void TransposeSquare(float* re, float* im, size_t n) {
+    const size_t tile = n < FFT_TRANSPOSE_TILE ? n : FFT_TRANSPOSE_TILE;
+    const size_t tiles = n / tile;
+    // Tile row i swaps with tile column i; later rows have less work, and the
+    // pool hands rows out one at a time to even that out.
+    ParallelFor(tiles, 1, [&](size_t begin, size_t end) {
+        float upper[FFT_TRANSPOSE_TILE * FFT_TRANSPOSE_TILE];
+        float lower[FFT_TRANSPOSE_TILE * FFT_TRANSPOSE_TILE];
+        for (size_t ti = begin; ti < end; ti++) {
+            for (size_t tj = ti; tj < tiles; tj++) {
+                for (float* grid : {re, im}) {
+                    LoadTile(grid, n, ti * tile, tj * tile, tile, upper);
+                    if (ti != tj) LoadTile(grid, n, tj * tile, ti * tile, tile, lower);
+                    StoreTileTransposed(grid, n, tj * tile, ti * tile, tile, upper);
+                    if (ti != tj) StoreTileTransposed(grid, n, ti * tile, tj * tile, tile, lower);
+                }
+            }
+        }
+    });
+}
+
+void Fft2D::Forward(float* re, float* im) {
+    ColumnPass(re, im);
+    TransposeSquare(re, im, n_);
+    ColumnPass(re, im);
+}
+
+void Fft2D::Inverse(float* re, float* im) {
+    // Swapping the real and imaginary parts is i * conj(x), so a forward
+    // transform of the swapped data, swapped back, is the inverse transform.
+    Forward(im, re);
+}
@@ -0,0 +1,48 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "particle_system.h"
+#include <vector>
+
+// Columns transformed together. Each butterfly works on whole rows of a strip,
+// so one strip row is a run of SIMD lanes and a strip of a 2048-point column
+// set (two 512 KB ping-pong buffers) stays in L2.
+const size_t FFT_STRIP_WIDTH = 32;
+
+// Rows per transpose tile.
+const size_t FFT_TRANSPOSE_TILE = 32;
+
+// Transposes two square n x n grids in place, a tile pair at a time on the
+// thread pool; n must be a power of two.
+void TransposeSquare(float* re, float* im, size_t n);
+
+// 2D complex FFT of a square, power-of-two grid in split (real, imaginary)
+// row-major arrays. Columns are transformed in strips by a Stockham radix-4
+// pass (radix-2 for an odd power), which needs no bit reversal; rows are
+// reached by transposing. Strips and transpose tiles run on the thread pool.
+//
+// Forward leaves the spectrum transposed, which saves two transposes per
+// round trip: callers that only apply a symmetric k-space factor never need
+// it the right way round. Inverse takes that transposed spectrum back to the
+// original layout, unnormalized (scale by 1 / n^2).
+class Fft2D {
+public:
+    Fft2D();
+
+    // n must be a power of two of at least 2.
+    void Resize(size_t n);
+    size_t Size() const { return n_; }
+
+    void Forward(float* re, float* im);
+    void Inverse(float* re, float* im);
+
+private:
+    void ColumnPass(float* re, float* im);
+
+    size_t n_;
+    AlignedArray<float> twiddleRe_;
+    AlignedArray<float> twiddleIm_;
+    std::vector<AlignedArray<float>> scratch_;
+};
+
+#endif
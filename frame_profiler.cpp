@@ -0,0 +1,234 @@
+#include "frame_profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+static const char* const PROFILE_STAGE_NAMES[] = {
+    "frame",
+    "update",
+    "reorder",
+#define QUANTUM_PRINCIPLE_PROFILE_NAME(id, key, name, description, equation) "kernel " key,
+    QUANTUM_PRINCIPLE_LIST(QUANTUM_PRINCIPLE_PROFILE_NAME)
+#undef QUANTUM_PRINCIPLE_PROFILE_NAME
+    "spatial grid",
+    "collisions",
+    "pair forces",
+    "neighbor list",
+    "short-range forces",
+    "draw particles",
+    "draw text",
+    "end drawing",
+};
+
+static_assert(sizeof(PROFILE_STAGE_NAMES) / sizeof(PROFILE_STAGE_NAMES[0]) == PROFILE_STAGE_COUNT, "every profile stage needs a name");
+
+const char* ProfileStageName(ProfileStage stage) {
+    return PROFILE_STAGE_NAMES[stage];
+}
+
+uint64_t ProfileNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+size_t ProfileRing::Snapshot(float* out) const {
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    const size_t count = head < PROFILE_RING_SIZE ? static_cast<size_t>(head) : PROFILE_RING_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = samples_[(head - count + i) & (PROFILE_RING_SIZE - 1)].load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+std::atomic<bool> FrameProfiler::enabled_(false);
+
+FrameProfiler::FrameProfiler() : frameStart_(0) {
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        accumulated_[stage].store(0, std::memory_order_relaxed);
+        hits_[stage].store(0, std::memory_order_relaxed);
+    }
+    for (int counter = 0; counter < PROFILE_COUNTER_COUNT; counter++) {
+        counted_[counter].store(0, std::memory_order_relaxed);
+        counterHits_[counter].store(0, std::memory_order_relaxed);
+    }
+}
+
+void FrameProfiler::SetEnabled(bool enabled) {
+    if (enabled && !Enabled()) {
+        // Drop whatever scopes that straddled the last toggle left behind.
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+            accumulated_[stage].store(0, std::memory_order_relaxed);
+            hits_[stage].store(0, std::memory_order_relaxed);
+        }
+        for (int counter = 0; counter < PROFILE_COUNTER_COUNT; counter++) {
+            counted_[counter].store(0, std::memory_order_relaxed);
+            counterHits_[counter].store(0, std::memory_order_relaxed);
+        }
+        frameStart_ = 0;
+    }
+    enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void FrameProfiler::BeginFrame() {
+    if (!Enabled()) return;
+    frameStart_ = ProfileNow();
+}
+
+void FrameProfiler::EndFrame() {
+    if (!Enabled()) return;
+    if (frameStart_ != 0) Record(PROFILE_FRAME, ProfileNow() - frameStart_);
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        if (hits_[stage].exchange(0, std::memory_order_relaxed) == 0) continue;
+        const uint64_t nanoseconds = accumulated_[stage].exchange(0, std::memory_order_relaxed);
+        rings_[stage].Push(static_cast<float>(nanoseconds * 1e-6));
+    }
+    for (int counter = 0; counter < PROFILE_COUNTER_COUNT; counter++) {
+        if (counterHits_[counter].exchange(0, std::memory_order_relaxed) == 0) continue;
+        counterRings_[counter].Push(static_cast<float>(counted_[counter].exchange(0, std::memory_order_relaxed)));
+    }
+}
+
+static ProfileStats RingStats(const ProfileRing& ring) {
+    float samples[PROFILE_RING_SIZE];
+    ProfileStats stats = {0.0f, 0.0f, 0.0f, ring.Snapshot(samples)};
+    if (stats.samples == 0) return stats;
+    stats.current = samples[stats.samples - 1];
+    double sum = 0.0;
+    for (size_t i = 0; i < stats.samples; i++) sum += samples[i];
+    stats.average = static_cast<float>(sum / stats.samples);
+    const size_t rank = (stats.samples * 99) / 100;
+    std::nth_element(samples, samples + rank, samples + stats.samples);
+    stats.p99 = samples[rank];
+    return stats;
+}
+
+ProfileStats FrameProfiler::Stats(ProfileStage stage) const {
+    return RingStats(rings_[stage]);
+}
+
+ProfileStats FrameProfiler::CounterStats(ProfileCounter counter) const {
+    return RingStats(counterRings_[counter]);
+}
+
+size_t FrameProfiler::FrameHistogram(unsigned* bins, size_t binCount, float binMilliseconds) const {
+    float samples[PROFILE_RING_SIZE];
+    const size_t count = rings_[PROFILE_FRAME].Snapshot(samples);
+    std::fill(bins, bins + binCount, 0u);
+    if (binCount == 0) return count;
+    for (size_t i = 0; i < count; i++) {
+        size_t bin = static_cast<size_t>(samples[i] / binMilliseconds);
+        bins[bin < binCount ? bin : binCount - 1]++;
+    }
+    return count;
+}
+
+FrameProfiler& GetFrameProfiler() {
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+void ScopedProfile::Finish() {
+    const uint64_t end = ProfileNow();
+    if (FrameProfiler::Enabled()) GetFrameProfiler().Record(stage_, end - start_);
+    if (TraceRecorder::Enabled()) GetTraceRecorder().Record(ProfileStageName(stage_), "stage", start_, end);
+}
+
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    uint64_t head = 0;
+    uint64_t dropped = 0;
+    int threadId = 0;
+    std::string threadName;
+    std::atomic<bool> attached{false};
+};
+
+// A thread's buffer goes back to the recorder when the thread exits, so pool
+// restarts reuse buffers instead of growing the set.
+struct TraceThreadSlot {
+    TraceBuffer* buffer = nullptr;
+    ~TraceThreadSlot() {
+        if (buffer) buffer->attached.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local TraceThreadSlot traceSlot;
+
+std::atomic<bool> TraceRecorder::enabled_(false);
+
+TraceRecorder::TraceRecorder() : epoch_(ProfileNow()) {}
+
+TraceRecorder::~TraceRecorder() {
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+TraceBuffer* TraceRecorder::AttachThread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    TraceBuffer* buffer = nullptr;
+    for (const std::unique_ptr<TraceBuffer>& candidate : buffers_) {
+        bool expected = false;
+        if (candidate->attached.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            buffer = candidate.get();
+            break;
+        }
+    }
+    if (!buffer) {
+        buffers_.emplace_back(new TraceBuffer());
+        buffer = buffers_.back().get();
+        buffer->events.resize(TRACE_EVENTS_PER_THREAD);
+        buffer->threadId = static_cast<int>(buffers_.size());
+        buffer->attached.store(true, std::memory_order_relaxed);
+    }
+    const int worker = ThreadPool::CurrentWorkerIndex();
+    buffer->threadName = worker == 0 ? "main" : "worker " + std::to_string(worker);
+    return buffer;
+}
+
+void TraceRecorder::Record(const char* name, const char* category, uint64_t start, uint64_t end) {
+    TraceBuffer* buffer = traceSlot.buffer;
+    if (!buffer) buffer = traceSlot.buffer = AttachThread();
+    if (buffer->head >= TRACE_EVENTS_PER_THREAD) buffer->dropped++;
+    buffer->events[buffer->head & (TRACE_EVENTS_PER_THREAD - 1)] = {name, category, start, end - start};
+    buffer->head++;
+}
+
+bool TraceRecorder::HasEvents() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<TraceBuffer>& buffer : buffers_) {
+        if (buffer->head > 0) return true;
+    }
+    return false;
+}
+
+bool TraceRecorder::Flush(const char* path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::FILE* file = std::fopen(path, "w");
+    if (!file) return false;
+    uint64_t dropped = 0;
+    const char* separator = "";
+    std::fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (const std::unique_ptr<TraceBuffer>& buffer : buffers_) {
+        std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                     separator, buffer->threadId, buffer->threadName.c_str());
+        separator = ",\n";
+        const uint64_t head = buffer->head;
+        const uint64_t count = head < TRACE_EVENTS_PER_THREAD ? head : TRACE_EVENTS_PER_THREAD;
+        for (uint64_t i = head - count; i < head; i++) {
+            const TraceEvent& event = buffer->events[i & (TRACE_EVENTS_PER_THREAD - 1)];
+            // Chrome trace timestamps are microseconds.
+            std::fprintf(file, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                         separator, event.name, event.category, buffer->threadId,
+                         (event.start - epoch_) * 1e-3, event.duration * 1e-3);
+        }
+        dropped += buffer->dropped;
+        buffer->head = 0;
+        buffer->dropped = 0;
+    }
+    std::fprintf(file, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", static_cast<unsigned long long>(dropped));
+    return std::fclose(file) == 0;
+}
+
+TraceRecorder& GetTraceRecorder() {
+    static TraceRecorder recorder;
+    return recorder;
+}
@@ -0,0 +1,208 @@
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include "principles.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Stages timed every frame. The kernel stages follow the principle list so
+// ProfileKernelStage can index them directly.
+enum ProfileStage {
+    PROFILE_FRAME,
+    PROFILE_UPDATE,
+    PROFILE_REORDER,
+#define QUANTUM_PRINCIPLE_PROFILE_STAGE(id, key, name, description, equation) PROFILE_KERNEL_##id,
+    QUANTUM_PRINCIPLE_LIST(QUANTUM_PRINCIPLE_PROFILE_STAGE)
+#undef QUANTUM_PRINCIPLE_PROFILE_STAGE
+    PROFILE_SPATIAL_GRID,
+    PROFILE_COLLISIONS,
+    PROFILE_PAIR_FORCES,
+    PROFILE_NEIGHBOR_LIST,
+    PROFILE_SHORT_RANGE,
+    PROFILE_DRAW_PARTICLES,
+    PROFILE_DRAW_TEXT,
+    PROFILE_END_DRAWING,
+    PROFILE_STAGE_COUNT
+};
+
+inline ProfileStage ProfileKernelStage(QuantumPrinciple principle) {
+    return static_cast<ProfileStage>(PROFILE_KERNEL_SUPERPOSITION + principle);
+}
+
+const char* ProfileStageName(ProfileStage stage);
+
+// Quantities summed over each frame alongside the stage times.
+enum ProfileCounter {
+    // Steps that used the neighbour lists, and those that rebuilt them.
+    PROFILE_COUNT_NEIGHBOR_STEPS,
+    PROFILE_COUNT_NEIGHBOR_BUILDS,
+    // Neighbour pairs the short-range force went through.
+    PROFILE_COUNT_NEIGHBOR_PAIRS,
+    PROFILE_COUNTER_COUNT
+};
+
+// Frames of history kept per stage. A power of two so the ring index is a mask.
+const size_t PROFILE_RING_SIZE = 512;
+
+// Single-producer ring of per-frame stage times in milliseconds. EndFrame is
+// the only writer; readers may run on any thread and never block it.
+class ProfileRing {
+public:
+    ProfileRing() : head_(0) {
+        for (std::atomic<float>& sample : samples_) sample.store(0.0f, std::memory_order_relaxed);
+    }
+
+    void Push(float milliseconds) {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        samples_[head & (PROFILE_RING_SIZE - 1)].store(milliseconds, std::memory_order_relaxed);
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // Copies up to PROFILE_RING_SIZE samples, oldest first, and returns how many.
+    size_t Snapshot(float* out) const;
+    uint64_t Count() const { return head_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<uint64_t> head_;
+    std::atomic<float> samples_[PROFILE_RING_SIZE];
+};
+
+struct ProfileStats {
+    float current;
+    float average;
+    float p99;
+    size_t samples;
+};
+
+uint64_t ProfileNow();
+
+// Collects scoped timings into per-stage accumulators during a frame and
+// commits them to the rings in EndFrame. Stages not hit in a frame record
+// nothing, so an idle principle kernel does not drag its average to zero.
+class FrameProfiler {
+public:
+    FrameProfiler();
+
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+    void SetEnabled(bool enabled);
+
+    void BeginFrame();
+    void EndFrame();
+
+    // Safe to call from any thread, including pool workers.
+    void Record(ProfileStage stage, uint64_t nanoseconds) {
+        accumulated_[stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+        hits_[stage].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Safe to call from any thread; does nothing while the profiler is off.
+    void Count(ProfileCounter counter, uint64_t amount) {
+        if (!Enabled()) return;
+        counted_[counter].fetch_add(amount, std::memory_order_relaxed);
+        counterHits_[counter].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ProfileStats Stats(ProfileStage stage) const;
+    // Per-frame totals of a counter, over the frames that counted it.
+    ProfileStats CounterStats(ProfileCounter counter) const;
+    // Buckets the recorded frame times into binCount bins of binMilliseconds;
+    // the last bin also holds everything slower. Returns the sample count.
+    size_t FrameHistogram(unsigned* bins, size_t binCount, float binMilliseconds) const;
+
+private:
+    static std::atomic<bool> enabled_;
+    uint64_t frameStart_;
+    std::atomic<uint64_t> accumulated_[PROFILE_STAGE_COUNT];
+    std::atomic<uint32_t> hits_[PROFILE_STAGE_COUNT];
+    ProfileRing rings_[PROFILE_STAGE_COUNT];
+    std::atomic<uint64_t> counted_[PROFILE_COUNTER_COUNT];
+    std::atomic<uint32_t> counterHits_[PROFILE_COUNTER_COUNT];
+    ProfileRing counterRings_[PROFILE_COUNTER_COUNT];
+};
+
+FrameProfiler& GetFrameProfiler();
+
+// Events kept per thread. Older events are overwritten once a thread's ring is
+// full, so a long session holds at most this many per thread (32 bytes each).
+const size_t TRACE_EVENTS_PER_THREAD = 32768;
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    uint64_t start;
+    uint64_t duration;
+};
+
+struct TraceBuffer;
+
+// Records complete (begin + duration) events into one ring per thread and
+// writes them as Chrome trace-event JSON, which chrome://tracing and Perfetto
+// open directly. Names and categories must be string literals. Recording
+// never locks after a thread's first event; Flush must run on the thread that
+// drives the pool, between parallel runs, so no worker is writing.
+class TraceRecorder {
+public:
+    TraceRecorder();
+    ~TraceRecorder();
+
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+    void SetEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+    void Record(const char* name, const char* category, uint64_t start, uint64_t end);
+
+    // Writes every buffered event to path and empties the buffers.
+    bool Flush(const char* path);
+    bool HasEvents() const;
+
+private:
+    TraceBuffer* AttachThread();
+
+    static std::atomic<bool> enabled_;
+    uint64_t epoch_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+};
+
+TraceRecorder& GetTraceRecorder();
+
+// Times the enclosing scope into a stage, and into the trace when recording.
+// With both off this costs two relaxed loads and a branch.
+class ScopedProfile {
+public:
+    explicit ScopedProfile(ProfileStage stage)
+        : stage_(stage), start_(FrameProfiler::Enabled() || TraceRecorder::Enabled() ? ProfileNow() : 0) {}
+    ~ScopedProfile() {
+        if (start_ != 0) Finish();
+    }
+    ScopedProfile(const ScopedProfile&) = delete;
+    ScopedProfile& operator=(const ScopedProfile&) = delete;
+
+private:
+    void Finish();
+
+    ProfileStage stage_;
+    uint64_t start_;
+};
+
+// A trace-only span for code that is not a profiler stage.
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category)
+        : name_(name), category_(category), start_(TraceRecorder::Enabled() ? ProfileNow() : 0) {}
+    ~TraceScope() {
+        if (start_ != 0) GetTraceRecorder().Record(name_, category_, start_, ProfileNow());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+    const char* category_;
+    uint64_t start_;
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "barnes_hut.h"
+#include "density_splat.h"
+#include "frame_profiler.h"
+#include "particle_system.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include "lyapunov.h"
+#include "neighbor_list.h"
+#include "uncertainty.h"
+#include "wave_field.h"
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Largest --threads, and largest --width and --height, which leave the
+// domain's int coordinates room to spare.
+const unsigned long long HEADLESS_MAX_THREADS = 256;
+const unsigned long long HEADLESS_MAX_DIMENSION = INT_MAX / 2;
+// Beyond this the Barnes-Hut walk takes the whole domain as one mass.
+const double HEADLESS_MAX_THETA = 2.0;
+
+struct HeadlessOptions {
+    size_t particleCount = 1000000;
+    int screenWidth = 1920;
+    int screenHeight = 1080;
+    QuantumPrinciple principle = SUPERPOSITION;
+    unsigned long long steps = 100;
+    unsigned long long seed = 1;
+    int threadCount = HardwareThreadCount();
+    size_t waveGrid = WAVE_GRID_DEFAULT;
+    WaveSolver waveSolver = WAVE_SOLVER_SPLIT_STEP;
+    unsigned long long stepRate = 60;
+    Integrator integrator = INTEGRATOR_SEMI_IMPLICIT_EULER;
+    bool collisions = false;
+    bool lennardJones = false;
+    unsigned long long skin = 6;
+    bool reorder = false;
+    double pairForce = 0.0;
+    double theta = 0.5;
+    const char* imagePath = nullptr;
+    const char* tracePath = nullptr;
+};
+
+static void PrintUsage(const char* program) {
+    std::fprintf(stderr,
+                 "Usage: %s [options]\n"
+                 "  --particles N     number of particles, up to 10000000 (default 1000000)\n"
+                 "  --width W         domain width (default 1920)\n"
+                 "  --height H        domain height (default 1080)\n"
+                 "  --principle P     principle name (superposition, chaos, ...) or its 1-based number\n"
+                 "  --steps S         simulation steps (default 100)\n"
+                 "  --step-rate HZ    simulation steps per second of simulated time, at least 60 (default 60)\n"
+                 "  --integrator I    euler, semi_implicit_euler (default), velocity_verlet or rk4\n"
+                 "  --collisions 0|1  elastic collisions between the particles after every step (default 0)\n"
+                 "  --lennard-jones 0|1  Lennard-Jones forces between neighbouring particles (default 0)\n"
+                 "  --skin PX         Verlet skin of the Lennard-Jones neighbour lists (default 6)\n"
+                 "  --pair-force G    Barnes-Hut pair force strength in px^3/frame^2, negative repels (default 0, off)\n"
+                 "  --theta T         Barnes-Hut opening angle, 0 for the exact sum (default 0.5)\n"
+                 "  --reorder 0|1     re-sort the particles by Morton key as their locality decays (default 0)\n"
+                 "  --seed S          random seed (default 1)\n"
+                 "  --threads T       worker threads including the main thread, up to 256 (default: all cores)\n"
+                 "  --wave-grid N     wave function grid for the wave principle, a power of two up to 2048 (default 512)\n"
+                 "  --wave-solver S   split_step (default) or crank_nicolson\n"
+                 "  --image PATH      write the final density image as a PPM file\n"
+                 "  --trace PATH      record a Chrome trace-event JSON timeline of every step\n",
+                 program);
+}
+
+static bool ParseCount(const char* text, unsigned long long& out) {
+    char* end = nullptr;
+    out = std::strtoull(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+static bool ParseReal(const char* text, double& out) {
+    char* end = nullptr;
+    out = std::strtod(text, &end);
+    return end != text && *end == '\0' && std::isfinite(out);
+}
+
+static bool ParseWaveSolver(const char* text, WaveSolver& out) {
+    for (int solver = 0; solver < WAVE_SOLVER_COUNT; solver++) {
+        if (std::strcmp(text, WaveSolverName(static_cast<WaveSolver>(solver))) == 0) {
+            out = static_cast<WaveSolver>(solver);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseIntegrator(const char* text, Integrator& out) {
+    for (int integrator = 0; integrator < INTEGRATOR_COUNT; integrator++) {
+        if (std::strcmp(text, IntegratorName(static_cast<Integrator>(integrator))) == 0) {
+            out = static_cast<Integrator>(integrator);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParsePrinciple(const char* text, QuantumPrinciple& out) {
+    char* end = nullptr;
+    long number = std::strtol(text, &end, 10);
+    for (const PrincipleInfo& info : PRINCIPLE_TABLE) {
+        if (std::strcmp(text, info.key) == 0 || (*end == '\0' && end != text && number == info.type + 1)) {
+            out = info.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool ParseOptions(int argc, char** argv, HeadlessOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--help" || flag == "-h" || i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        unsigned long long number = 0;
+        if (flag == "--principle") {
+            if (!ParsePrinciple(value, options.principle)) return false;
+            continue;
+        }
+        if (flag == "--wave-solver") {
+            if (!ParseWaveSolver(value, options.waveSolver)) return false;
+            continue;
+        }
+        if (flag == "--integrator") {
+            if (!ParseIntegrator(value, options.integrator)) return false;
+            continue;
+        }
+        if (flag == "--pair-force") {
+            if (!ParseReal(value, options.pairForce)) return false;
+            continue;
+        }
+        if (flag == "--theta") {
+            if (!ParseReal(value, options.theta) || options.theta < 0.0 || options.theta > HEADLESS_MAX_THETA) return false;
+            continue;
+        }
+        if (flag == "--image") {
+            options.imagePath = value;
+            continue;
+        }
+        if (flag == "--trace") {
+            options.tracePath = value;
+            continue;
+        }
+        if (!ParseCount(value, number)) return false;
+        if (flag == "--particles" && number <= MAX_PARTICLE_COUNT) {
+            options.particleCount = static_cast<size_t>(number);
+        } else if (flag == "--width" && number > 0 && number <= HEADLESS_MAX_DIMENSION) {
+            options.screenWidth = static_cast<int>(number);
+        } else if (flag == "--height" && number > 0 && number <= HEADLESS_MAX_DIMENSION) {
+            options.screenHeight = static_cast<int>(number);
+        } else if (flag == "--steps") {
+            options.steps = number;
+        } else if (flag == "--step-rate" && number >= 60) {
+            options.stepRate = number;
+        } else if (flag == "--collisions" && number <= 1) {
+            options.collisions = number == 1;
+        } else if (flag == "--lennard-jones" && number <= 1) {
+            options.lennardJones = number == 1;
+        } else if (flag == "--skin") {
+            options.skin = number;
+        } else if (flag == "--reorder" && number <= 1) {
+            options.reorder = number == 1;
+        } else if (flag == "--seed") {
+            options.seed = number;
+        } else if (flag == "--threads" && number > 0 && number <= HEADLESS_MAX_THREADS) {
+            options.threadCount = static_cast<int>(number);
+        } else if (flag == "--wave-grid" && number >= WAVE_GRID_MIN && number <= WAVE_GRID_MAX && (number & (number - 1)) == 0) {
+            options.waveGrid = static_cast<size_t>(number);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static unsigned long long HashBytes(unsigned long long hash, const void* data, size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// values in id order, which is memory order until a re-sort, so a sorted run
+// hashes the same as an unsorted one that reached the same state.
+template <typename T>
+static std::vector<T> InIdOrder(const AlignedArray<T>& values, const ParticleSystem& particles) {
+    std::vector<T> ordered(particles.Size());
+    for (size_t i = 0; i < particles.Size(); i++) ordered[particles.id[i]] = values[i];
+    return ordered;
+}
+
+int main(int argc, char** argv) {
+    HeadlessOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+    GetThreadPool().SetThreadCount(options.threadCount);
+
+    ParticleSystem particles;
+    particles.seed = options.seed;
+    particles.dt = SIMULATION_FRAME_RATE / static_cast<float>(options.stepRate);
+    particles.integrator = options.integrator;
+    particles.collisions = options.collisions;
+    particles.lennardJones = options.lennardJones ? LENNARD_JONES_DEPTH : 0.0f;
+    particles.skin = static_cast<float>(options.skin);
+    particles.pairForce = static_cast<float>(options.pairForce);
+    particles.theta = static_cast<float>(options.theta);
+    particles.reorder = options.reorder;
+    ResizeParticles(particles, options.particleCount, options.screenWidth, options.screenHeight);
+    if (options.principle == WAVE_PARTICLE_DUALITY) {
+        GetWaveField().SetSolver(options.waveSolver);
+        GetWaveField().Resize(options.waveGrid);
+    }
+
+    if (options.tracePath) GetTraceRecorder().SetEnabled(true);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long long step = 0; step < options.steps; step++) {
+        TraceScope stepScope("step", "headless");
+        UpdateParticlesByPrinciple(particles, options.principle, options.screenWidth, options.screenHeight);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double updates = static_cast<double>(options.particleCount) * static_cast<double>(options.steps);
+
+    const size_t count = particles.Size();
+    const unsigned long long basis = 14695981039346656037ull;
+    unsigned long long positionHash = HashBytes(HashBytes(basis, InIdOrder(particles.x, particles).data(), count * sizeof(float)),
+                                                InIdOrder(particles.y, particles).data(), count * sizeof(float));
+    unsigned long long velocityHash = HashBytes(HashBytes(basis, InIdOrder(particles.vx, particles).data(), count * sizeof(float)),
+                                                InIdOrder(particles.vy, particles).data(), count * sizeof(float));
+    unsigned long long colorHash = HashBytes(basis, InIdOrder(particles.color, particles).data(), count * sizeof(Color));
+    double sumX = 0.0, sumY = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sumX += particles.x[i];
+        sumY += particles.y[i];
+    }
+
+    std::printf("particles:  %zu\n", count);
+    std::printf("domain:     %dx%d\n", options.screenWidth, options.screenHeight);
+    std::printf("principle:  %s\n", PRINCIPLE_TABLE[options.principle].key);
+    std::printf("steps:      %llu\n", options.steps);
+    std::printf("seed:       %llu\n", options.seed);
+    std::printf("clock:      %llu Hz (dt = %g frames), %s\n", options.stepRate, particles.dt, IntegratorName(options.integrator));
+    std::printf("threads:    %d\n", GetThreadPool().ThreadCount());
+    std::printf("simd:       %s\n", SimdLevelName(DetectSimdLevel()));
+    std::printf("elapsed:    %.6f s\n", seconds);
+    std::printf("throughput: %.4e particle-updates/s\n", seconds > 0.0 ? updates / seconds : 0.0);
+    std::printf("mean:       x=%.6f y=%.6f\n", count ? sumX / count : 0.0, count ? sumY / count : 0.0);
+    if (options.collisions) {
+        const SpatialGrid& grid = particles.grid;
+        std::printf("collisions: %zux%zu grid of %.2f px cells, %.1f particles per cell\n", grid.columns, grid.rows, grid.cellSize,
+                    grid.cells ? static_cast<double>(grid.members) / grid.cells : 0.0);
+    }
+    if (particles.pairForce != 0.0f) {
+        const QuadTree& tree = particles.tree;
+        std::printf("pair force: G=%g %s, theta %g, %zu tree nodes over %zu levels\n", particles.pairForce,
+                    particles.pairForce > 0.0f ? "attracting" : "repelling", particles.theta, tree.levelStart[tree.levels], tree.levels);
+    }
+    if (options.lennardJones) {
+        const NeighborList& neighbors = particles.neighbors;
+        std::printf("neighbors:  %zu pairs, %.2f per particle, rebuilt %llu times in %llu steps (%g px skin)%s\n", neighbors.pairs / 2,
+                    count ? static_cast<double>(neighbors.pairs) / count : 0.0, static_cast<unsigned long long>(neighbors.builds),
+                    static_cast<unsigned long long>(neighbors.steps), neighbors.skin,
+                    neighbors.members == count ? "" : ", too many to list");
+    }
+    if (options.reorder) {
+        const ParticleOrder& order = particles.order;
+        std::printf("reorder:    %llu sorts in %llu checks, checking every %llu steps, %.1f%% scattered (%.1f%% after the last sort)\n",
+                    static_cast<unsigned long long>(order.sorts), static_cast<unsigned long long>(order.checks),
+                    static_cast<unsigned long long>(order.interval), 100.0f * order.scatter, 100.0f * order.sortedScatter);
+    }
+    if (options.principle == WAVE_PARTICLE_DUALITY) {
+        std::printf("wave:       %zux%zu grid, %s, norm %.6f\n", GetWaveField().Size(), GetWaveField().Size(),
+                    WaveSolverName(GetWaveField().Solver()), GetWaveField().Norm());
+    }
+    if (options.principle == UNCERTAINTY) {
+        const UncertaintyState& packet = particles.uncertainty;
+        const float dx = MomentsDeviation(packet.moments[UNCERTAINTY_X]);
+        const float dp = MomentsDeviation(packet.moments[UNCERTAINTY_VX]);
+        std::printf("uncertainty: packet %llu age %zu, sigma_x=%.3f dx=%.4f dp=%.4f dx*dp=%.4f hbar/2\n",
+                    static_cast<unsigned long long>(packet.packet), packet.age, packet.sigmaX, dx, dp, dx * dp / (0.5f * UNCERTAINTY_HBAR));
+    }
+    if (options.principle == CHAOS && !LyapunovTracksParticles(particles)) {
+        std::printf("lyapunov:   n/a, the tangents do not follow pair forces, Lennard-Jones or collisions\n");
+    } else if (options.principle == CHAOS) {
+        const LyapunovState& tangents = particles.lyapunov;
+        std::printf("lyapunov:   lambda=%.5f +- %.1e /frame over %llu steps (%.5f for the flow without walls)\n", LyapunovExponent(tangents),
+                    LyapunovStandardError(tangents), static_cast<unsigned long long>(tangents.measuredSteps), SawtoothLyapunovExponent());
+        std::printf("converging:");
+        for (size_t i = 0; i < tangents.historyCount; i++) {
+            std::printf(" %llu:%.4f", static_cast<unsigned long long>(LYAPUNOV_RENORMALIZE_STEPS << i), tangents.history[i]);
+        }
+        std::printf("\n");
+    }
+    std::printf("checksum:   position=%016llx velocity=%016llx color=%016llx\n", positionHash, velocityHash, colorHash);
+
+    if (options.tracePath) {
+        GetTraceRecorder().SetEnabled(false);
+        if (!GetTraceRecorder().Flush(options.tracePath)) {
+            std::fprintf(stderr, "could not write %s\n", options.tracePath);
+            return 1;
+        }
+        std::printf("trace:      %s\n", options.tracePath);
+    }
+
+    if (options.imagePath) {
+        DensitySplat splat;
+        splat.Resize(options.screenWidth, options.screenHeight);
+        auto splatStart = std::chrono::steady_clock::now();
+        splat.Render(particles, static_cast<float>(options.screenWidth), static_cast<float>(options.screenHeight));
+        double splatSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - splatStart).count();
+        const size_t pixels = static_cast<size_t>(options.screenWidth) * options.screenHeight;
+        unsigned long long imageHash = HashBytes(basis, splat.Pixels(), pixels * sizeof(Color));
+        if (!WriteDensityImage(splat, options.imagePath)) {
+            std::fprintf(stderr, "could not write %s\n", options.imagePath);
+            return 1;
+        }
+        std::printf("image:      %s (%.3f ms splat, checksum %016llx)\n", options.imagePath, splatSeconds * 1e3, imageHash);
+    }
+    return 0;
+}
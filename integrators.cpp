@@ -0,0 +1,8 @@
+#include "integrators.h"
+
+static const char* const INTEGRATOR_NAMES[] = {"euler", "semi_implicit_euler", "velocity_verlet", "rk4"};
+static_assert(sizeof(INTEGRATOR_NAMES) / sizeof(INTEGRATOR_NAMES[0]) == INTEGRATOR_COUNT, "every integrator needs a name");
+
+const char* IntegratorName(Integrator integrator) {
+    return INTEGRATOR_NAMES[integrator];
+}
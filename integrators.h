@@ -0,0 +1,152 @@
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+
+#include "simd_kernels.h"
+#include <cstddef>
+
+// Time is measured in frames: one frame is 1/60 s of simulated time, the step
+// the simulation took before it had a clock, so velocities stay in px per frame
+// and accelerations in px per frame^2.
+const float SIMULATION_FRAME_RATE = 60.0f;
+
+// How one step of dt frames advances position and velocity under an
+// acceleration that depends on position.
+enum Integrator {
+    // x += v dt and v += a(x) dt, both from the start of the step. First
+    // order and not symplectic: orbits slowly gain energy.
+    INTEGRATOR_EULER,
+    // v += a(x) dt, then x += v dt with the new velocity. First order but
+    // symplectic, one force evaluation; what every principle has always done.
+    INTEGRATOR_SEMI_IMPLICIT_EULER,
+    // Half kick, drift, half kick with the force at the new position. Second
+    // order and symplectic, two force evaluations.
+    INTEGRATOR_VELOCITY_VERLET,
+    // Classical fourth-order Runge-Kutta, four force evaluations. The most
+    // accurate for smooth forces, but not symplectic.
+    INTEGRATOR_RK4,
+    INTEGRATOR_COUNT
+};
+
+// Command-line name: "euler", "semi_implicit_euler", "velocity_verlet", "rk4".
+const char* IntegratorName(Integrator integrator);
+
+// Forces are functors mapping a position to an acceleration,
+//   void operator()(float x, float y, float& ax, float& ay) const
+// with `active` false when the acceleration is always zero.
+struct NoForce {
+    static const bool active = false;
+    void operator()(float, float, float& ax, float& ay) const {
+        ax = 0.0f;
+        ay = 0.0f;
+    }
+};
+
+template <Integrator I>
+struct IntegratorStep;
+
+template <>
+struct IntegratorStep<INTEGRATOR_EULER> {
+    template <typename Force>
+    static void Apply(float& x, float& y, float& vx, float& vy, float dt, const Force& force) {
+        float ax, ay;
+        force(x, y, ax, ay);
+        x += vx * dt;
+        y += vy * dt;
+        vx += ax * dt;
+        vy += ay * dt;
+    }
+};
+
+template <>
+struct IntegratorStep<INTEGRATOR_SEMI_IMPLICIT_EULER> {
+    template <typename Force>
+    static void Apply(float& x, float& y, float& vx, float& vy, float dt, const Force& force) {
+        float ax, ay;
+        force(x, y, ax, ay);
+        vx += ax * dt;
+        vy += ay * dt;
+        x += vx * dt;
+        y += vy * dt;
+    }
+};
+
+template <>
+struct IntegratorStep<INTEGRATOR_VELOCITY_VERLET> {
+    template <typename Force>
+    static void Apply(float& x, float& y, float& vx, float& vy, float dt, const Force& force) {
+        const float half = 0.5f * dt;
+        float ax, ay;
+        force(x, y, ax, ay);
+        vx += ax * half;
+        vy += ay * half;
+        x += vx * dt;
+        y += vy * dt;
+        force(x, y, ax, ay);
+        vx += ax * half;
+        vy += ay * half;
+    }
+};
+
+template <>
+struct IntegratorStep<INTEGRATOR_RK4> {
+    template <typename Force>
+    static void Apply(float& x, float& y, float& vx, float& vy, float dt, const Force& force) {
+        const float half = 0.5f * dt;
+        float ax1, ay1, ax2, ay2, ax3, ay3, ax4, ay4;
+        force(x, y, ax1, ay1);
+        const float vx2 = vx + ax1 * half;
+        const float vy2 = vy + ay1 * half;
+        force(x + vx * half, y + vy * half, ax2, ay2);
+        const float vx3 = vx + ax2 * half;
+        const float vy3 = vy + ay2 * half;
+        force(x + vx2 * half, y + vy2 * half, ax3, ay3);
+        const float vx4 = vx + ax3 * dt;
+        const float vy4 = vy + ay3 * dt;
+        force(x + vx3 * dt, y + vy3 * dt, ax4, ay4);
+        const float sixth = dt * (1.0f / 6.0f);
+        x += sixth * ((vx + vx4) + 2.0f * (vx2 + vx3));
+        y += sixth * ((vy + vy4) + 2.0f * (vy2 + vy3));
+        vx += sixth * ((ax1 + ax4) + 2.0f * (ax2 + ax3));
+        vy += sixth * ((ay1 + ay4) + 2.0f * (ay2 + ay3));
+    }
+};
+
+// Steps count particles by dt under force with integrator I, then reflects
+// them off the walls as IntegrateAndReflect does. Without a force every
+// integrator is the same straight drift, and semi-implicit Euler is a kick
+// followed by that drift, so both hand the drift to the vector kernel.
+template <Integrator I, typename Force>
+void StepAndReflect(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height, const Force& force) {
+    if (Force::active && I == INTEGRATOR_SEMI_IMPLICIT_EULER) {
+        for (size_t i = 0; i < count; i++) {
+            float ax, ay;
+            force(x[i], y[i], ax, ay);
+            vx[i] += ax * dt;
+            vy[i] += ay * dt;
+        }
+    }
+    if (!Force::active || I == INTEGRATOR_SEMI_IMPLICIT_EULER) {
+        IntegrateAndReflect(x, y, vx, vy, count, dt, width, height);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        IntegratorStep<I>::Apply(x[i], y[i], vx[i], vy[i], dt, force);
+        if (x[i] <= 0 || x[i] >= width) vx[i] = -vx[i];
+        if (y[i] <= 0 || y[i] >= height) vy[i] = -vy[i];
+    }
+}
+
+// Picks the kernel compiled for integrator; the switch is per call, not per
+// particle.
+template <typename Force>
+void StepAndReflect(Integrator integrator, float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height,
+                    const Force& force) {
+    switch (integrator) {
+        case INTEGRATOR_EULER: StepAndReflect<INTEGRATOR_EULER>(x, y, vx, vy, count, dt, width, height, force); break;
+        case INTEGRATOR_VELOCITY_VERLET: StepAndReflect<INTEGRATOR_VELOCITY_VERLET>(x, y, vx, vy, count, dt, width, height, force); break;
+        case INTEGRATOR_RK4: StepAndReflect<INTEGRATOR_RK4>(x, y, vx, vy, count, dt, width, height, force); break;
+        default: StepAndReflect<INTEGRATOR_SEMI_IMPLICIT_EULER>(x, y, vx, vy, count, dt, width, height, force); break;
+    }
+}
+
+#endif
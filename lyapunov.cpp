@@ -0,0 +1,243 @@
+#include "lyapunov.h"
+#include "fast_log.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+
+// The sawtooth's slope is K everywhere, so the linearized step is the same
+// integrator step under the force K d on the tangent d itself.
+struct TangentForce {
+    static const bool active = true;
+    void operator()(float dx, float dy, float& ax, float& ay) const {
+        ax = CHAOS_SAWTOOTH_STRENGTH * dx;
+        ay = CHAOS_SAWTOOTH_STRENGTH * dy;
+    }
+};
+
+// One linearized step, then dv flips wherever the wall flipped v.
+// Renormalizing rescales (dx, dy, dvx, dvy) to unit length.
+template <Integrator I>
+static void AdvanceTangentsScalar(float* dx, float* dy, float* dvx, float* dvy, float* logGrowth, const float* x, const float* y,
+                                  size_t first, size_t count, float dt, float width, float height, bool renormalize) {
+    const TangentForce force;
+    for (size_t i = first; i < count; i++) {
+        float ex = dx[i];
+        float ey = dy[i];
+        float evx = dvx[i];
+        float evy = dvy[i];
+        IntegratorStep<I>::Apply(ex, ey, evx, evy, dt, force);
+        if (x[i] <= 0 || x[i] >= width) evx = -evx;
+        if (y[i] <= 0 || y[i] >= height) evy = -evy;
+        if (renormalize) {
+            const float norm2 = ((ex * ex + ey * ey) + evx * evx) + evy * evy;
+            const float inverse = 1.0f / std::sqrt(norm2);
+            ex *= inverse;
+            ey *= inverse;
+            evx *= inverse;
+            evy *= inverse;
+            logGrowth[i] += 0.5f * LogPositive(norm2);
+        }
+        dx[i] = ex;
+        dy[i] = ey;
+        dvx[i] = evx;
+        dvy[i] = evy;
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+// Semi-implicit Euler only, as AdvanceTangentsScalar<INTEGRATOR_SEMI_IMPLICIT_EULER>.
+__attribute__((target("avx2")))
+static size_t AdvanceTangentsAvx2(float* dx, float* dy, float* dvx, float* dvy, float* logGrowth, const float* x, const float* y,
+                                  size_t count, float dt, float width, float height, bool renormalize) {
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 k = _mm256_set1_ps(CHAOS_SAWTOOTH_STRENGTH);
+    const __m256 w = _mm256_set1_ps(width);
+    const __m256 h = _mm256_set1_ps(height);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 ex = _mm256_loadu_ps(dx + i);
+        __m256 ey = _mm256_loadu_ps(dy + i);
+        __m256 evx = _mm256_add_ps(_mm256_loadu_ps(dvx + i), _mm256_mul_ps(_mm256_mul_ps(k, ex), step));
+        __m256 evy = _mm256_add_ps(_mm256_loadu_ps(dvy + i), _mm256_mul_ps(_mm256_mul_ps(k, ey), step));
+        ex = _mm256_add_ps(ex, _mm256_mul_ps(evx, step));
+        ey = _mm256_add_ps(ey, _mm256_mul_ps(evy, step));
+        const __m256 px = _mm256_loadu_ps(x + i);
+        const __m256 py = _mm256_loadu_ps(y + i);
+        const __m256 hitX = _mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LE_OQ), _mm256_cmp_ps(px, w, _CMP_GE_OQ));
+        const __m256 hitY = _mm256_or_ps(_mm256_cmp_ps(py, zero, _CMP_LE_OQ), _mm256_cmp_ps(py, h, _CMP_GE_OQ));
+        evx = _mm256_xor_ps(evx, _mm256_and_ps(hitX, signBit));
+        evy = _mm256_xor_ps(evy, _mm256_and_ps(hitY, signBit));
+        if (renormalize) {
+            const __m256 norm2 = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(evx, evx)), _mm256_mul_ps(evy, evy));
+            const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(norm2));
+            ex = _mm256_mul_ps(ex, inverse);
+            ey = _mm256_mul_ps(ey, inverse);
+            evx = _mm256_mul_ps(evx, inverse);
+            evy = _mm256_mul_ps(evy, inverse);
+            _mm256_storeu_ps(logGrowth + i, _mm256_add_ps(_mm256_loadu_ps(logGrowth + i), _mm256_mul_ps(_mm256_set1_ps(0.5f), LogPositiveAvx2(norm2))));
+        }
+        _mm256_storeu_ps(dx + i, ex);
+        _mm256_storeu_ps(dy + i, ey);
+        _mm256_storeu_ps(dvx + i, evx);
+        _mm256_storeu_ps(dvy + i, evy);
+    }
+    return i;
+}
+
+QPS_AVX512_TARGET
+static size_t AdvanceTangentsAvx512(float* dx, float* dy, float* dvx, float* dvy, float* logGrowth, const float* x, const float* y,
+                                    size_t count, float dt, float width, float height, bool renormalize) {
+    const __m512 step = _mm512_set1_ps(dt);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i signBit = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+    const __m512 k = _mm512_set1_ps(CHAOS_SAWTOOTH_STRENGTH);
+    const __m512 w = _mm512_set1_ps(width);
+    const __m512 h = _mm512_set1_ps(height);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 ex = _mm512_loadu_ps(dx + i);
+        __m512 ey = _mm512_loadu_ps(dy + i);
+        __m512 evx = _mm512_add_ps(_mm512_loadu_ps(dvx + i), _mm512_mul_ps(_mm512_mul_ps(k, ex), step));
+        __m512 evy = _mm512_add_ps(_mm512_loadu_ps(dvy + i), _mm512_mul_ps(_mm512_mul_ps(k, ey), step));
+        ex = _mm512_add_ps(ex, _mm512_mul_ps(evx, step));
+        ey = _mm512_add_ps(ey, _mm512_mul_ps(evy, step));
+        const __m512 px = _mm512_loadu_ps(x + i);
+        const __m512 py = _mm512_loadu_ps(y + i);
+        const __mmask16 hitX = _mm512_cmp_ps_mask(px, zero, _CMP_LE_OQ) | _mm512_cmp_ps_mask(px, w, _CMP_GE_OQ);
+        const __mmask16 hitY = _mm512_cmp_ps_mask(py, zero, _CMP_LE_OQ) | _mm512_cmp_ps_mask(py, h, _CMP_GE_OQ);
+        evx = _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(evx), hitX, _mm512_castps_si512(evx), signBit));
+        evy = _mm512_castsi512_ps(_mm512_mask_xor_epi32(_mm512_castps_si512(evy), hitY, _mm512_castps_si512(evy), signBit));
+        if (renormalize) {
+            const __m512 norm2 = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ex, ex), _mm512_mul_ps(ey, ey)), _mm512_mul_ps(evx, evx)), _mm512_mul_ps(evy, evy));
+            const __m512 inverse = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_maskz_sqrt_ps(0xFFFF, norm2));
+            ex = _mm512_mul_ps(ex, inverse);
+            ey = _mm512_mul_ps(ey, inverse);
+            evx = _mm512_mul_ps(evx, inverse);
+            evy = _mm512_mul_ps(evy, inverse);
+            _mm512_storeu_ps(logGrowth + i, _mm512_add_ps(_mm512_loadu_ps(logGrowth + i), _mm512_mul_ps(_mm512_set1_ps(0.5f), LogPositiveAvx512(norm2))));
+        }
+        _mm512_storeu_ps(dx + i, ex);
+        _mm512_storeu_ps(dy + i, ey);
+        _mm512_storeu_ps(dvx + i, evx);
+        _mm512_storeu_ps(dvy + i, evy);
+    }
+    return i;
+}
+
+#endif
+
+double SawtoothLyapunovExponent() {
+    return std::sqrt(static_cast<double>(CHAOS_SAWTOOTH_STRENGTH));
+}
+
+void PrepareLyapunov(LyapunovState& state, const uint32_t* id, size_t particles, uint64_t seed, uint64_t step, float dt, Integrator integrator) {
+    if (state.members != particles || state.seed != seed || state.lastStep + 1 != step || state.dt != dt || state.integrator != integrator) {
+        AlignedArray<float>* const arrays[] = {&state.dx, &state.dy, &state.dvx, &state.dvy, &state.logGrowth};
+        for (AlignedArray<float>* array : arrays) array->Reallocate(PaddedCapacity(particles), 0);
+        const RandomStream stream = MakeRandomStream(seed, RNG_STREAM_LYAPUNOV, 0);
+        float* dx = state.dx.Data();
+        float* dy = state.dy.Data();
+        float* dvx = state.dvx.Data();
+        float* dvy = state.dvy.Data();
+        float* logGrowth = state.logGrowth.Data();
+        // Gaussian components, normalized, point in a uniformly random direction.
+        ParallelFor(particles, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+            FillGaussianById(stream, id + begin, end - begin, dx + begin, dy + begin, dvx + begin, dvy + begin);
+            for (size_t i = begin; i < end; i++) {
+                const float norm2 = dx[i] * dx[i] + dy[i] * dy[i] + dvx[i] * dvx[i] + dvy[i] * dvy[i];
+                const float inverse = norm2 > 0.0f ? 1.0f / std::sqrt(norm2) : 0.0f;
+                dx[i] = norm2 > 0.0f ? dx[i] * inverse : 1.0f;
+                dy[i] *= inverse;
+                dvx[i] *= inverse;
+                dvy[i] *= inverse;
+                logGrowth[i] = 0.0f;
+            }
+        });
+        state.members = particles;
+        state.seed = seed;
+        state.dt = dt;
+        state.integrator = integrator;
+        state.steps = 0;
+        state.measuredSteps = 0;
+        state.growth = RunningMoments();
+        state.shift = 0.0f;
+        state.historyCount = 0;
+    }
+    state.lastStep = step;
+    state.steps++;
+    state.renormalizing = state.steps % LYAPUNOV_RENORMALIZE_STEPS == 0;
+    if (!state.renormalizing) return;
+    state.chunks = (particles + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    state.partial.Reallocate(state.chunks, 0);
+    for (size_t chunk = 0; chunk < state.chunks; chunk++) state.partial[chunk] = DeviationSums();
+}
+
+void AdvanceTangents(LyapunovState& state, const float* x, const float* y, size_t first, size_t count, float width, float height) {
+    const SimdLevel level = ActiveSimdLevel();
+    float* dx = state.dx.Data() + first;
+    float* dy = state.dy.Data() + first;
+    float* dvx = state.dvx.Data() + first;
+    float* dvy = state.dvy.Data() + first;
+    float* logGrowth = state.logGrowth.Data() + first;
+    x += first;
+    y += first;
+    const float dt = state.dt;
+    const bool renormalize = state.renormalizing;
+    switch (state.integrator) {
+        case INTEGRATOR_EULER:
+            AdvanceTangentsScalar<INTEGRATOR_EULER>(dx, dy, dvx, dvy, logGrowth, x, y, 0, count, dt, width, height, renormalize);
+            break;
+        case INTEGRATOR_VELOCITY_VERLET:
+            AdvanceTangentsScalar<INTEGRATOR_VELOCITY_VERLET>(dx, dy, dvx, dvy, logGrowth, x, y, 0, count, dt, width, height, renormalize);
+            break;
+        case INTEGRATOR_RK4:
+            AdvanceTangentsScalar<INTEGRATOR_RK4>(dx, dy, dvx, dvy, logGrowth, x, y, 0, count, dt, width, height, renormalize);
+            break;
+        default: {
+            size_t done = 0;
+#ifdef QPS_X86_SIMD
+            if (level == SIMD_AVX512) {
+                done = AdvanceTangentsAvx512(dx, dy, dvx, dvy, logGrowth, x, y, count, dt, width, height, renormalize);
+            } else if (level == SIMD_AVX2) {
+                done = AdvanceTangentsAvx2(dx, dy, dvx, dvy, logGrowth, x, y, count, dt, width, height, renormalize);
+            }
+#else
+            (void)level;
+#endif
+            AdvanceTangentsScalar<INTEGRATOR_SEMI_IMPLICIT_EULER>(dx, dy, dvx, dvy, logGrowth, x, y, done, count, dt, width, height, renormalize);
+            break;
+        }
+    }
+    if (!state.renormalizing) return;
+    float sum, sumSquares;
+    SumDeviations(logGrowth, count, state.shift, sum, sumSquares);
+    DeviationSums& partial = state.partial[first / PARALLEL_CHUNK_SIZE];
+    partial.count += static_cast<double>(count);
+    partial.sum += sum;
+    partial.squares += sumSquares;
+}
+
+void FinishLyapunov(LyapunovState& state) {
+    if (!state.renormalizing) return;
+    RunningMoments total;
+    for (size_t chunk = 0; chunk < state.chunks; chunk++) MergeMoments(total, SumsToMoments(state.partial[chunk], state.shift));
+    state.growth = total;
+    state.shift = static_cast<float>(total.mean);
+    state.measuredSteps = state.steps;
+    const uint64_t doublings = state.measuredSteps / LYAPUNOV_RENORMALIZE_STEPS;
+    if ((doublings & (doublings - 1)) == 0 && state.historyCount < LYAPUNOV_HISTORY) {
+        state.history[state.historyCount++] = static_cast<float>(LyapunovExponent(state));
+    }
+}
+
+double LyapunovExponent(const LyapunovState& state) {
+    return state.measuredSteps > 0 ? state.growth.mean / (static_cast<double>(state.measuredSteps) * state.dt) : 0.0;
+}
+
+double LyapunovStandardError(const LyapunovState& state) {
+    if (state.measuredSteps == 0 || state.growth.count < 2) return 0.0;
+    return MomentsDeviation(state.growth) / std::sqrt(state.growth.count) / (static_cast<double>(state.measuredSteps) * state.dt);
+}
@@ -0,0 +1,105 @@
+#ifndef LYAPUNOV_H
+#define LYAPUNOV_H
+
+#include "aligned_array.h"
+#include "integrators.h"
+#include "running_moments.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Estimates the CHAOS principle keeps, one per doubling of the measured steps.
+const size_t LYAPUNOV_HISTORY = 24;
+
+// Tangent vectors for the CHAOS principle's Lyapunov estimate, built on first
+// use. Every particle carries a displacement (dx, dy, dvx, dvy) evolved by the
+// linearized step and rescaled to unit length every few steps; logGrowth sums
+// the logs of those rescalings.
+struct LyapunovState {
+    AlignedArray<float> dx;
+    AlignedArray<float> dy;
+    AlignedArray<float> dvx;
+    AlignedArray<float> dvy;
+    AlignedArray<float> logGrowth;
+    // Sums of logGrowth per thread-pool chunk on a renormalizing step.
+    AlignedArray<DeviationSums> partial;
+    size_t chunks = 0;
+    // logGrowth over all particles at the last renormalization.
+    RunningMoments growth;
+    float shift = 0.0f;
+    size_t members = 0;
+    uint64_t seed = 0;
+    uint64_t lastStep = 0;
+    // Steps since the tangents were seeded, and at the last renormalization.
+    // Every step is dt frames under the same integrator; changing either
+    // reseeds the tangents.
+    uint64_t steps = 0;
+    uint64_t measuredSteps = 0;
+    float dt = 0.0f;
+    Integrator integrator = INTEGRATOR_SEMI_IMPLICIT_EULER;
+    bool renormalizing = false;
+    // The exponent after LYAPUNOV_RENORMALIZE_STEPS << k steps, to show how
+    // the estimate converges.
+    float history[LYAPUNOV_HISTORY] = {};
+    size_t historyCount = 0;
+};
+
+// The CHAOS principle's deterministic force: a sawtooth in each coordinate,
+// strength * (position - nearest multiple of the period). Its slope is the
+// same everywhere, so, like the sawtooth map, every step stretches nearby
+// trajectories apart and the motion is chaotic at any speed. The random kicks
+// are shared by a trajectory and its tangent, so they add no stretching.
+const float CHAOS_SAWTOOTH_PERIOD = 20.0f;
+const float CHAOS_SAWTOOTH_STRENGTH = 0.05f;
+
+// Steps between renormalizations of the tangent vectors. Each one costs a log
+// per particle; in between a vector grows by at most about e^(8 * 0.22).
+const uint64_t LYAPUNOV_RENORMALIZE_STEPS = 8;
+
+// floor() is a library call without SSE4.1; truncating and stepping down for
+// negative fractions is the same for any position the walls let through.
+inline float SawtoothForce(float position) {
+    const float cells = position * (1.0f / CHAOS_SAWTOOTH_PERIOD) + 0.5f;
+    float nearest = static_cast<float>(static_cast<int32_t>(cells));
+    if (nearest > cells) nearest -= 1.0f;
+    return CHAOS_SAWTOOTH_STRENGTH * (position - CHAOS_SAWTOOTH_PERIOD * nearest);
+}
+
+// The sawtooth as the force the CHAOS principle's integrator applies.
+struct SawtoothForceField {
+    static const bool active = true;
+    void operator()(float x, float y, float& ax, float& ay) const {
+        ax = SawtoothForce(x);
+        ay = SawtoothForce(y);
+    }
+};
+
+// The exponent of the sawtooth flow away from the walls, sqrt(K) per frame for
+// strength K. A step of dt frames measures a little less (acosh(1 + K dt^2 / 2)
+// / dt with semi-implicit Euler), and reflections off the walls shift it a
+// little more.
+double SawtoothLyapunovExponent();
+
+// Serial part of a step. Seeds every particle with a random unit tangent,
+// drawn at its id, on the first step, after any gap, or when the particles, the timestep or the
+// integrator change, and clears the per-chunk sums on a renormalizing step.
+void PrepareLyapunov(LyapunovState& state, const uint32_t* id, size_t particles, uint64_t seed, uint64_t step, float dt, Integrator integrator);
+
+// Advances the tangents of particles [first, first + count) by the linearized
+// step the particles (already at x, y) have just taken, with the same
+// integrator, and on a renormalizing step rescales them and adds the slice to
+// its chunk's sums. Only the CHAOS force and the walls are linearized; pair
+// forces, Lennard-Jones and collisions are not, and the exponent is not
+// reported while any of them is on.
+void AdvanceTangents(LyapunovState& state, const float* x, const float* y, size_t first, size_t count, float width, float height);
+
+// Merges the chunk sums in chunk order after a renormalizing step, so the
+// estimate is the same at any thread count.
+void FinishLyapunov(LyapunovState& state);
+
+// Largest Lyapunov exponent per frame: the mean growth over particles divided
+// by the time measured, and the standard error of that mean.
+double LyapunovExponent(const LyapunovState& state);
+double LyapunovStandardError(const LyapunovState& state);
+
+#endif
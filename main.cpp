@@ -1,34 +1,83 @@
 #include "raylib.h"
+#include "particle_system.h"
+#include "particle_renderer.h"
+#include "barnes_hut.h"
+#include "frame_profiler.h"
+#include "text_layer.h"
+#include "thread_pool.h"
+#include "rng.h"
+#include "simulation_clock.h"
+#include "lyapunov.h"
+#include "neighbor_list.h"
+#include "uncertainty.h"
 #include <vector>
-#include <cstdlib>
 #include <ctime>
 #include <string>
 #include <cmath>
 #include <algorithm>
 
-struct Particle {
-    Vector2 position;
-    Vector2 velocity;
-    Color color;
-    float radius;
+enum RenderMode {
+    RENDER_AUTO,
+    RENDER_CIRCLES,
+    RENDER_DENSITY,
+    RENDER_MODE_COUNT
 };
 
-void UpdateParticles(std::vector<Particle>& particles, int screenWidth, int screenHeight) {
-    for (auto& particle : particles) {
-        particle.position.x += particle.velocity.x;
-        particle.position.y += particle.velocity.y;
-        if (particle.position.x <= 0 || particle.position.x >= screenWidth) {
-            particle.velocity.x *= -1;
-        }
-        if (particle.position.y <= 0 || particle.position.y >= screenHeight) {
-            particle.velocity.y *= -1;
-        }
+const char* RENDER_MODE_NAMES[] = {"Auto", "Circles", "Density"};
+
+const char* WAVE_SOLVER_LABELS[] = {"Split-Step", "Crank-Nicolson"};
+const char* INTEGRATOR_LABELS[] = {"Euler", "Semi-Implicit Euler", "Velocity Verlet", "RK4"};
+
+// Physics step rates and speed-ups the settings cycle through. At the largest
+// of both a 60 fps frame runs SIMULATION_MAX_STEPS_PER_FRAME steps.
+const float STEP_RATES[] = {60.0f, 120.0f, 240.0f, 480.0f};
+const float SPEEDS[] = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f};
+
+// The setting after current in an ascending list, wrapping to the first.
+template <size_t N>
+float NextSetting(const float (&values)[N], float current) {
+    for (float value : values) {
+        if (value > current) return value;
     }
+    return values[0];
 }
 
-void DrawParticles(const std::vector<Particle>& particles) {
-    for (const auto& particle : particles) {
-        DrawCircleV(particle.position, particle.radius, particle.color);
+// Everything that puts particles on screen. Auto switches to the density image
+// once the particle count passes DENSITY_SPLAT_THRESHOLD.
+struct SceneRenderer {
+    ParticleRenderer circles;
+    LineBatch lines;
+    DensityRenderer density;
+    WaveRenderer wave;
+    RenderMode mode = RENDER_AUTO;
+
+    void Load(int screenWidth, int screenHeight) {
+        circles.Load();
+        lines.Load();
+        density.Load(screenWidth, screenHeight);
+    }
+    void Unload() {
+        wave.Unload();
+        density.Unload();
+        lines.Unload();
+        circles.Unload();
+    }
+    bool UsesDensity(size_t particleCount) const {
+        if (!density.IsReady()) return false;
+        return mode == RENDER_DENSITY || (mode == RENDER_AUTO && particleCount >= DENSITY_SPLAT_THRESHOLD);
+    }
+};
+
+void DrawParticles(SceneRenderer& scene, const ParticleSystem& particles, int screenWidth, int screenHeight) {
+    ScopedProfile profile(PROFILE_DRAW_PARTICLES);
+    if (scene.UsesDensity(particles.Size())) {
+        // Added rather than pasted: the same picture on the black background,
+        // and the wave backdrop still shows through.
+        BeginBlendMode(BLEND_ADDITIVE);
+        scene.density.Draw(particles, screenWidth, screenHeight);
+        EndBlendMode();
+    } else {
+        scene.circles.DrawCircles(particles, 0.0f, nullptr);
     }
 }
 
@@ -42,6 +91,10 @@ enum GameState {
     FORMULA_QUIZ
 };
 
+const char* GAME_STATE_NAMES[] = {"MENU", "SIMULATION", "SETTINGS", "ABOUT", "GAMES", "QUANTUM_DODGE", "FORMULA_QUIZ"};
+
+const char* TRACE_FILE = "quantum_trace.json";
+
 void DrawMenu(int screenWidth, int screenHeight, int menuSelection) {
     DrawText("Quantum Particle Simulation", screenWidth / 2 - 300, screenHeight / 2 - 200, 40, PURPLE);
     DrawText("Start Simulation", screenWidth / 2 - 150, screenHeight / 2 - 50, 30, menuSelection == 0 ? YELLOW : WHITE);
@@ -61,14 +114,6 @@ void DrawSettings(int screenWidth, int screenHeight) {
              screenWidth / 2 - 400, screenHeight / 2 + 100, 20, YELLOW);
 }
 
-enum QuantumPrinciple {
-    SUPERPOSITION,
-    UNCERTAINTY,
-    ENTANGLEMENT,
-    WAVE_PARTICLE_DUALITY,
-    CHAOS
-};
-
 struct Principle {
     std::string name;
     std::string description;
@@ -83,16 +128,84 @@ void DrawPrinciple(const Principle& principle, int screenWidth, int screenHeight
     DrawText("Press BACKSPACE to return to the menu", screenWidth / 2 - 300, screenHeight / 2 + 100, 20, WHITE);
 }
 
-void DrawInteractivePrinciple(const Principle& principle, const std::vector<Particle>& particles, int screenWidth, int screenHeight) {
-    DrawText(("Principle: " + principle.name).c_str(), 10, 10, 30, PURPLE);
-    DrawText(("Description: " + principle.description).c_str(), 10, 50, 20, WHITE);
-    DrawText("Equation:", 10, 90, 20, YELLOW);
-    DrawText(principle.equation.c_str(), 100, 90, 20, GREEN);
-    for (const auto& particle : particles) {
-        DrawCircleV(particle.position, particle.radius, particle.color);
-        DrawLine(particle.position.x, particle.position.y, screenWidth / 2, screenHeight / 2, Fade(WHITE, 0.2f));
+void DrawTetheredParticles(SceneRenderer& scene, const ParticleSystem& particles, int screenWidth, int screenHeight) {
+    if (!scene.UsesDensity(particles.Size())) {
+        ScopedProfile profile(PROFILE_DRAW_PARTICLES);
+        scene.lines.DrawTethers(particles, {static_cast<float>(screenWidth / 2), static_cast<float>(screenHeight / 2)}, Fade(WHITE, 0.2f), 1.0f);
+    }
+    DrawParticles(scene, particles, screenWidth, screenHeight);
+}
+
+void DrawBackToMenuHint(int screenWidth, int screenHeight) {
+    static TextLayer layer;
+    layer.Draw(0, {0, static_cast<float>(screenHeight - 30), static_cast<float>(screenWidth), 30}, [&] {
+        DrawText("Press BACKSPACE to return to the menu", 10, screenHeight - 30, 20, WHITE);
+    });
+}
+
+// Whatever a principle shows behind its particles: the |psi|^2 of the wave
+// field for wave-particle duality.
+void DrawPrincipleBackdrop(SceneRenderer& scene, QuantumPrinciple principle, int screenWidth, int screenHeight) {
+    if (principle != WAVE_PARTICLE_DUALITY) return;
+    ScopedProfile profile(PROFILE_DRAW_PARTICLES);
+    scene.wave.Draw(GetWaveField(), screenWidth, screenHeight);
+}
+
+// What a principle measures about its particles, after the equation it obeys.
+// UNCERTAINTY: dx * dp in units of hbar / 2 starts at 1 on every launch and
+// only grows. CHAOS: the largest Lyapunov exponent and its standard error,
+// which shrinks as the estimate converges, unless forces the tangents do not
+// model are on.
+void DrawPrincipleReadout(const Principle& principle, const ParticleSystem& particles, int screenWidth) {
+    std::string text;
+    uint64_t key = 0;
+    if (principle.type == UNCERTAINTY) {
+        const UncertaintyState& packet = particles.uncertainty;
+        const float dx = MomentsDeviation(packet.moments[UNCERTAINTY_X]);
+        const float dp = MomentsDeviation(packet.moments[UNCERTAINTY_VX]);
+        const float product = dx * dp / (0.5f * UNCERTAINTY_HBAR);
+        text = TextFormat("dx = %.1f   dp = %.3f   dx * dp = %.2f hbar/2", dx, dp, product);
+        key = TextLayerKey({principle.type, std::lround(dx * 10), std::lround(dp * 1000), std::lround(product * 100)});
+    } else if (principle.type == CHAOS && !LyapunovTracksParticles(particles)) {
+        text = "lambda: n/a with pair forces, Lennard-Jones or collisions on";
+        key = TextLayerKey({principle.type, -1});
+    } else if (principle.type == CHAOS) {
+        const double lambda = LyapunovExponent(particles.lyapunov);
+        const double error = LyapunovStandardError(particles.lyapunov);
+        text = TextFormat("lambda = %.4f +- %.1e /frame", lambda, error);
+        key = TextLayerKey({principle.type, std::llround(lambda * 10000), std::llround(error * 1e7)});
+    } else {
+        return;
+    }
+    const int left = 100 + MeasureText(principle.equation.c_str(), 20) + 30;
+    static TextLayer layer;
+    layer.Draw(key, {static_cast<float>(left), 90, static_cast<float>(screenWidth - left), 20}, [&] {
+        DrawText(text.c_str(), left, 90, 20, SKYBLUE);
+    });
+}
+
+void DrawInteractivePrinciple(SceneRenderer& scene, const Principle& principle, const ParticleSystem& particles, int screenWidth, int screenHeight) {
+    DrawPrincipleBackdrop(scene, principle.type, screenWidth, screenHeight);
+    DrawTetheredParticles(scene, particles, screenWidth, screenHeight);
+    ScopedProfile profile(PROFILE_DRAW_TEXT);
+    static TextLayer layer;
+    layer.Draw(TextLayerKey({principle.type}), {0, 0, static_cast<float>(screenWidth), 120}, [&] {
+        DrawText(("Principle: " + principle.name).c_str(), 10, 10, 30, PURPLE);
+        DrawText(("Description: " + principle.description).c_str(), 10, 50, 20, WHITE);
+        DrawText("Equation:", 10, 90, 20, YELLOW);
+        DrawText(principle.equation.c_str(), 100, 90, 20, GREEN);
+    });
+    DrawPrincipleReadout(principle, particles, screenWidth);
+    DrawBackToMenuHint(screenWidth, screenHeight);
+}
+
+// The "|" rain behind the menus, drawn as one-pixel strokes so it stays in
+// the shape batch instead of going through the font.
+void DrawMenuRain(int screenWidth, int screenHeight, int spacing, Color color) {
+    static CounterRandom random(static_cast<uint64_t>(std::time(nullptr)), RNG_STREAM_MENU_RAIN);
+    for (int i = 0; i < screenHeight; i += spacing) {
+        DrawRectangle(static_cast<int>(random.Below(screenWidth)), i, 1, 10, color);
     }
-    DrawText("Press BACKSPACE to return to the menu", 10, screenHeight - 30, 20, WHITE);
 }
 
 void DrawQuantumMenu(int screenWidth, int screenHeight, int menuSelection) {
@@ -100,47 +213,59 @@ void DrawQuantumMenu(int screenWidth, int screenHeight, int menuSelection) {
     DrawText(">> Start Simulation", screenWidth / 2 - 200, screenHeight / 2 - 100, 30, menuSelection == 0 ? YELLOW : GREEN);
     DrawText(">> Settings", screenWidth / 2 - 200, screenHeight / 2 - 50, 30, menuSelection == 1 ? YELLOW : GREEN);
     DrawText(">> Exit", screenWidth / 2 - 200, screenHeight / 2, 30, menuSelection == 2 ? YELLOW : GREEN);
-    for (int i = 0; i < screenHeight; i += 20) {
-        DrawText("|", std::rand() % screenWidth, i, 10, Fade(GREEN, 0.3f));
-    }
+    DrawMenuRain(screenWidth, screenHeight, 20, Fade(GREEN, 0.3f));
 }
 
-void DrawInteractivePrinciple(const Principle& principle, const std::vector<Particle>& particles, int screenWidth, int screenHeight, float time) {
-    DrawText(("Principle: " + principle.name).c_str(), 10, 10, 30, GREEN);
-    DrawText(("Description: " + principle.description).c_str(), 10, 50, 20, WHITE);
+void DrawInteractivePrinciple(SceneRenderer& scene, const Principle& principle, const ParticleSystem& particles, int screenWidth, int screenHeight, float time) {
+    DrawPrincipleBackdrop(scene, principle.type, screenWidth, screenHeight);
+    DrawTetheredParticles(scene, particles, screenWidth, screenHeight);
+    ScopedProfile profile(PROFILE_DRAW_TEXT);
     int equationLength = principle.equation.length();
     int visibleChars = static_cast<int>(time * 10) % (equationLength + 1);
-    std::string animatedEquation = principle.equation.substr(0, visibleChars);
-    DrawText("Equation:", 10, 90, 20, YELLOW);
-    DrawText(animatedEquation.c_str(), 100, 90, 20, GREEN);
-    for (const auto& particle : particles) {
-        DrawCircleV(particle.position, particle.radius, particle.color);
-        DrawLine(particle.position.x, particle.position.y, screenWidth / 2, screenHeight / 2, Fade(WHITE, 0.2f));
-    }
-    DrawText("Press BACKSPACE to return to the menu", 10, screenHeight - 30, 20, WHITE);
+    static TextLayer layer;
+    layer.Draw(TextLayerKey({principle.type, visibleChars}), {0, 0, static_cast<float>(screenWidth), 120}, [&] {
+        DrawText(("Principle: " + principle.name).c_str(), 10, 10, 30, GREEN);
+        DrawText(("Description: " + principle.description).c_str(), 10, 50, 20, WHITE);
+        std::string animatedEquation = principle.equation.substr(0, visibleChars);
+        DrawText("Equation:", 10, 90, 20, YELLOW);
+        DrawText(animatedEquation.c_str(), 100, 90, 20, GREEN);
+    });
+    DrawPrincipleReadout(principle, particles, screenWidth);
+    DrawBackToMenuHint(screenWidth, screenHeight);
 }
 
 void DrawEnhancedMenu(int screenWidth, int screenHeight, int menuSelection, float time) {
-    float scale = 1.0f + 0.1f * sin(time * 2.0f);
-    int titleFontSize = static_cast<int>(60 * scale);
-    DrawText("QUANTUM PARTICLE SIMULATION", screenWidth / 2 - MeasureText("QUANTUM PARTICLE SIMULATION", titleFontSize) / 2, screenHeight / 2 - 300, titleFontSize, PURPLE);
+    const float width = static_cast<float>(screenWidth);
+    // The title is rasterized once at its base size; the pulse scales the quad.
+    static TextLayer title;
+    const int titleY = screenHeight / 2 - 300;
+    const float scale = 1.0f + 0.1f * sin(time * 2.0f);
+    Rectangle titleBounds = {0, static_cast<float>(titleY), width, 60};
+    Rectangle titleDest = {width / 2 - width * scale / 2, static_cast<float>(titleY), width * scale, 60 * scale};
+    title.Draw(0, titleBounds, titleDest, [&] {
+        DrawText("QUANTUM PARTICLE SIMULATION", screenWidth / 2 - MeasureText("QUANTUM PARTICLE SIMULATION", 60) / 2, titleY, 60, PURPLE);
+    });
     const int menuStartY = screenHeight / 2 - 100;
     const int menuSpacing = 60;
-    const char* menuOptions[] = {
-        "Start Simulation",
-        "Settings",
-        "About",
-        "Games",
-        "Exit"
-    };
-    for (int i = 0; i < 5; i++) {
-        Color optionColor = menuSelection == i ? YELLOW : WHITE;
-        DrawText(menuOptions[i], screenWidth / 2 - MeasureText(menuOptions[i], 40) / 2, menuStartY + i * menuSpacing, 40, optionColor);
-    }
-    for (int i = 0; i < screenHeight; i += 30) {
-        DrawText("|", std::rand() % screenWidth, i, 10, Fade(PURPLE, 0.1f));
-    }
-    DrawText("Use UP/DOWN to navigate, ENTER to select", screenWidth / 2 - 200, screenHeight - 50, 20, GRAY);
+    static TextLayer options;
+    options.Draw(TextLayerKey({menuSelection}), {0, static_cast<float>(menuStartY), width, 5 * menuSpacing}, [&] {
+        const char* menuOptions[] = {
+            "Start Simulation",
+            "Settings",
+            "About",
+            "Games",
+            "Exit"
+        };
+        for (int i = 0; i < 5; i++) {
+            Color optionColor = menuSelection == i ? YELLOW : WHITE;
+            DrawText(menuOptions[i], screenWidth / 2 - MeasureText(menuOptions[i], 40) / 2, menuStartY + i * menuSpacing, 40, optionColor);
+        }
+    });
+    DrawMenuRain(screenWidth, screenHeight, 30, Fade(PURPLE, 0.1f));
+    static TextLayer footer;
+    footer.Draw(0, {0, static_cast<float>(screenHeight - 50), width, 20}, [&] {
+        DrawText("Use UP/DOWN to navigate, ENTER to select", screenWidth / 2 - 200, screenHeight - 50, 20, GRAY);
+    });
 }
 
 void DrawEnhancedSettings(int screenWidth, int screenHeight) {
@@ -153,104 +278,103 @@ void DrawEnhancedSettings(int screenWidth, int screenHeight) {
     DrawText("Press BACKSPACE to return to the menu.", screenWidth / 2 - 400, screenHeight / 2 + 200, 20, YELLOW);
 }
 
-void UpdateInteractiveParticles(std::vector<Particle>& particles, int screenWidth, int screenHeight) {
-    for (auto& particle : particles) {
-        particle.position.x += particle.velocity.x;
-        particle.position.y += particle.velocity.y;
-        if (particle.position.x <= 0 || particle.position.x >= screenWidth) {
-            particle.velocity.x *= -1;
-            particle.color = {static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), 255};
-        }
-        if (particle.position.y <= 0 || particle.position.y >= screenHeight) {
-            particle.velocity.y *= -1;
-            particle.color = {static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), 255};
-        }
-        Vector2 center = {static_cast<float>(screenWidth / 2), static_cast<float>(screenHeight / 2)};
-        Vector2 direction = {center.x - particle.position.x, center.y - particle.position.y};
-        float distance = sqrt(direction.x * direction.x + direction.y * direction.y);
-        if (distance > 0) {
-            direction.x /= distance;
-            direction.y /= distance;
-            particle.velocity.x += direction.x * 0.05f;
-            particle.velocity.y += direction.y * 0.05f;
-        }
-    }
-}
+const int PARTICLE_COUNT_OPTIONS[] = {100, 300, 1000, 3000, 10000, 30000, 100000, 300000, 1000000, 3000000, 10000000};
 
-void UpdateParticlesByPrinciple(std::vector<Particle>& particles, QuantumPrinciple principle, int screenWidth, int screenHeight) {
-    for (auto& particle : particles) {
-        switch (principle) {
-            case SUPERPOSITION:
-                if (std::rand() % 100 < 2) {
-                    particle.position = {static_cast<float>(std::rand() % screenWidth), static_cast<float>(std::rand() % screenHeight)};
-                }
-                break;
-            case UNCERTAINTY:
-                particle.velocity.x += static_cast<float>((std::rand() % 200 - 100) / 100.0f) * 0.1f;
-                particle.velocity.y += static_cast<float>((std::rand() % 200 - 100) / 100.0f) * 0.1f;
-                break;
-            case ENTANGLEMENT:
-                if (&particle != &particles[0]) {
-                    particle.position = particles[0].position;
-                }
-                break;
-            case WAVE_PARTICLE_DUALITY:
-                particle.position.y += sin(particle.position.x * 0.05f) * 2.0f;
-                break;
-            case CHAOS:
-                particle.velocity.x += static_cast<float>((std::rand() % 200 - 100) / 100.0f) * 0.5f;
-                particle.velocity.y += static_cast<float>((std::rand() % 200 - 100) / 100.0f) * 0.5f;
-                particle.color = {static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), 255};
-                break;
-        }
-        particle.position.x += particle.velocity.x;
-        particle.position.y += particle.velocity.y;
-        if (particle.position.x <= 0 || particle.position.x >= screenWidth) {
-            particle.velocity.x *= -1;
-        }
-        if (particle.position.y <= 0 || particle.position.y >= screenHeight) {
-            particle.velocity.y *= -1;
-        }
+int NextParticleCount(int particleCount) {
+    for (int option : PARTICLE_COUNT_OPTIONS) {
+        if (option > particleCount) return option;
     }
+    return PARTICLE_COUNT_OPTIONS[0];
 }
 
 enum SettingsOption {
     TOGGLE_FULLSCREEN,
     CHANGE_PARTICLE_COUNT,
-    BACK_TO_MENU
+    CHANGE_THREAD_COUNT,
+    CHANGE_RENDER_MODE,
+    CHANGE_WAVE_SOLVER,
+    CHANGE_STEP_RATE,
+    CHANGE_SPEED,
+    CHANGE_INTEGRATOR,
+    TOGGLE_COLLISIONS,
+    TOGGLE_LENNARD_JONES,
+    CHANGE_PAIR_FORCE,
+    TOGGLE_REORDER,
+    BACK_TO_MENU,
+    SETTINGS_OPTION_COUNT
 };
 
-void DrawSettingsMenu(int screenWidth, int screenHeight, int settingsSelection, bool isFullscreen, int particleCount) {
-    DrawText("Settings", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
-    DrawText("Toggle Fullscreen", screenWidth / 2 - 200, screenHeight / 2 - 100, 30, settingsSelection == TOGGLE_FULLSCREEN ? YELLOW : WHITE);
-    DrawText(isFullscreen ? "[ON]" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 - 100, 30, GREEN);
-    DrawText("Change Particle Count", screenWidth / 2 - 200, screenHeight / 2 - 50, 30, settingsSelection == CHANGE_PARTICLE_COUNT ? YELLOW : WHITE);
-    DrawText(std::to_string(particleCount).c_str(), screenWidth / 2 + 200, screenHeight / 2 - 50, 30, GREEN);
-    DrawText("Back to Menu", screenWidth / 2 - 200, screenHeight / 2, 30, settingsSelection == BACK_TO_MENU ? YELLOW : WHITE);
+void DrawSettingsMenu(int screenWidth, int screenHeight, int settingsSelection, bool isFullscreen, int particleCount, int threadCount, RenderMode renderMode, WaveSolver waveSolver,
+                      const SimulationClock& clock, Integrator integrator, bool collisions, bool lennardJones, float pairForce, bool reorder) {
+    static TextLayer layer;
+    const long long stepRate = std::lround(clock.stepRate);
+    const long long speed = std::lround(clock.speed * 100);
+    const int pairMode = pairForce > 0.0f ? 1 : pairForce < 0.0f ? -1 : 0;
+    layer.Draw(TextLayerKey({settingsSelection, isFullscreen, particleCount, threadCount, renderMode, waveSolver, stepRate, speed, integrator, collisions, lennardJones, pairMode,
+                             reorder}),
+               {0, static_cast<float>(screenHeight / 2 - 300), static_cast<float>(screenWidth), 830}, [&] {
+        DrawText("Settings", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
+        DrawText("Toggle Fullscreen", screenWidth / 2 - 200, screenHeight / 2 - 100, 30, settingsSelection == TOGGLE_FULLSCREEN ? YELLOW : WHITE);
+        DrawText(isFullscreen ? "[ON]" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 - 100, 30, GREEN);
+        DrawText("Change Particle Count", screenWidth / 2 - 200, screenHeight / 2 - 50, 30, settingsSelection == CHANGE_PARTICLE_COUNT ? YELLOW : WHITE);
+        DrawText(std::to_string(particleCount).c_str(), screenWidth / 2 + 200, screenHeight / 2 - 50, 30, GREEN);
+        DrawText("Change Thread Count", screenWidth / 2 - 200, screenHeight / 2, 30, settingsSelection == CHANGE_THREAD_COUNT ? YELLOW : WHITE);
+        DrawText(std::to_string(threadCount).c_str(), screenWidth / 2 + 200, screenHeight / 2, 30, GREEN);
+        DrawText("Render Mode", screenWidth / 2 - 200, screenHeight / 2 + 50, 30, settingsSelection == CHANGE_RENDER_MODE ? YELLOW : WHITE);
+        DrawText(RENDER_MODE_NAMES[renderMode], screenWidth / 2 + 200, screenHeight / 2 + 50, 30, GREEN);
+        DrawText("Wave Solver", screenWidth / 2 - 200, screenHeight / 2 + 100, 30, settingsSelection == CHANGE_WAVE_SOLVER ? YELLOW : WHITE);
+        DrawText(WAVE_SOLVER_LABELS[waveSolver], screenWidth / 2 + 200, screenHeight / 2 + 100, 30, GREEN);
+        DrawText("Physics Rate", screenWidth / 2 - 200, screenHeight / 2 + 150, 30, settingsSelection == CHANGE_STEP_RATE ? YELLOW : WHITE);
+        DrawText(TextFormat("%lld Hz", stepRate), screenWidth / 2 + 200, screenHeight / 2 + 150, 30, GREEN);
+        DrawText("Speed", screenWidth / 2 - 200, screenHeight / 2 + 200, 30, settingsSelection == CHANGE_SPEED ? YELLOW : WHITE);
+        DrawText(TextFormat("%gx", clock.speed), screenWidth / 2 + 200, screenHeight / 2 + 200, 30, GREEN);
+        DrawText("Integrator", screenWidth / 2 - 200, screenHeight / 2 + 250, 30, settingsSelection == CHANGE_INTEGRATOR ? YELLOW : WHITE);
+        DrawText(INTEGRATOR_LABELS[integrator], screenWidth / 2 + 200, screenHeight / 2 + 250, 30, GREEN);
+        DrawText("Collisions", screenWidth / 2 - 200, screenHeight / 2 + 300, 30, settingsSelection == TOGGLE_COLLISIONS ? YELLOW : WHITE);
+        DrawText(collisions ? "[ON]" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 + 300, 30, GREEN);
+        DrawText("Lennard-Jones", screenWidth / 2 - 200, screenHeight / 2 + 350, 30, settingsSelection == TOGGLE_LENNARD_JONES ? YELLOW : WHITE);
+        DrawText(lennardJones ? "[ON]" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 + 350, 30, GREEN);
+        DrawText("Pair Force", screenWidth / 2 - 200, screenHeight / 2 + 400, 30, settingsSelection == CHANGE_PAIR_FORCE ? YELLOW : WHITE);
+        DrawText(pairMode > 0 ? "Attract" : pairMode < 0 ? "Repel" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 + 400, 30, GREEN);
+        DrawText("Reorder Particles", screenWidth / 2 - 200, screenHeight / 2 + 450, 30, settingsSelection == TOGGLE_REORDER ? YELLOW : WHITE);
+        DrawText(reorder ? "[ON]" : "[OFF]", screenWidth / 2 + 200, screenHeight / 2 + 450, 30, GREEN);
+        DrawText("Back to Menu", screenWidth / 2 - 200, screenHeight / 2 + 500, 30, settingsSelection == BACK_TO_MENU ? YELLOW : WHITE);
+    });
 }
 
-void AddUniqueFeaturesToParticles(std::vector<Particle>& particles, int screenWidth, int screenHeight) {
-    for (auto& particle : particles) {
-        DrawCircleV(particle.position, particle.radius + 2, Fade(particle.color, 0.3f));
-        DrawCircleV(particle.position, particle.radius, particle.color);
-        DrawLine(particle.position.x, particle.position.y, particle.position.x - particle.velocity.x * 10, particle.position.y - particle.velocity.y * 10, Fade(WHITE, 0.2f));
+void AddUniqueFeaturesToParticles(SceneRenderer& scene, const ParticleSystem& particles, int screenWidth, int screenHeight) {
+    ScopedProfile profile(PROFILE_DRAW_PARTICLES);
+    if (scene.UsesDensity(particles.Size())) {
+        scene.density.Draw(particles, screenWidth, screenHeight);
+        return;
     }
+    static ParticleFeatures features;
+    PrepareParticleFeatures(particles, features);
+    scene.lines.DrawSegments(particles, features.trailX.Data(), features.trailY.Data(), Fade(WHITE, 0.2f), 1.0f);
+    scene.circles.DrawCircles(particles, 2.0f, features.glow.Data());
+    scene.circles.DrawCircles(particles, 0.0f, nullptr);
 }
 
 void DrawEnhancedAboutMenu(int screenWidth, int screenHeight) {
-    DrawText("About", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
-    DrawText("Quantum Particle Simulation", screenWidth / 2 - 300, screenHeight / 2 - 200, 30, WHITE);
-    DrawText("Created to demonstrate quantum mechanics principles.", screenWidth / 2 - 300, screenHeight / 2 - 150, 20, WHITE);
-    DrawText("Features include interactive particles and dynamic visuals.", screenWidth / 2 - 300, screenHeight / 2 - 120, 20, WHITE);
-    DrawText("Explore concepts like Superposition, Uncertainty, and more.", screenWidth / 2 - 300, screenHeight / 2 - 90, 20, WHITE);
-    DrawText("Press BACKSPACE to return to the menu.", screenWidth / 2 - 300, screenHeight / 2 + 200, 20, YELLOW);
+    static TextLayer layer;
+    layer.Draw(0, {0, static_cast<float>(screenHeight / 2 - 300), static_cast<float>(screenWidth), 520}, [&] {
+        DrawText("About", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
+        DrawText("Quantum Particle Simulation", screenWidth / 2 - 300, screenHeight / 2 - 200, 30, WHITE);
+        DrawText("Created to demonstrate quantum mechanics principles.", screenWidth / 2 - 300, screenHeight / 2 - 150, 20, WHITE);
+        DrawText("Features include interactive particles and dynamic visuals.", screenWidth / 2 - 300, screenHeight / 2 - 120, 20, WHITE);
+        DrawText("Explore concepts like Superposition, Uncertainty, and more.", screenWidth / 2 - 300, screenHeight / 2 - 90, 20, WHITE);
+        DrawText("Press BACKSPACE to return to the menu.", screenWidth / 2 - 300, screenHeight / 2 + 200, 20, YELLOW);
+    });
 }
 
 void DrawGamesMenu(int screenWidth, int screenHeight, int gamesSelection) {
-    DrawText("Games", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
-    DrawText("Quantum Dodge", screenWidth / 2 - 200, screenHeight / 2 - 100, 30, gamesSelection == 0 ? YELLOW : WHITE);
-    DrawText("Formula Quiz", screenWidth / 2 - 200, screenHeight / 2 - 50, 30, gamesSelection == 1 ? YELLOW : WHITE);
-    DrawText("Back to Menu", screenWidth / 2 - 200, screenHeight / 2, 30, gamesSelection == 2 ? YELLOW : WHITE);
+    static TextLayer layer;
+    layer.Draw(TextLayerKey({gamesSelection}), {0, static_cast<float>(screenHeight / 2 - 300), static_cast<float>(screenWidth), 330}, [&] {
+        DrawText("Games", screenWidth / 2 - 100, screenHeight / 2 - 300, 50, PURPLE);
+        DrawText("Quantum Dodge", screenWidth / 2 - 200, screenHeight / 2 - 100, 30, gamesSelection == 0 ? YELLOW : WHITE);
+        DrawText("Formula Quiz", screenWidth / 2 - 200, screenHeight / 2 - 50, 30, gamesSelection == 1 ? YELLOW : WHITE);
+        DrawText("Back to Menu", screenWidth / 2 - 200, screenHeight / 2, 30, gamesSelection == 2 ? YELLOW : WHITE);
+    });
 }
 
 void QuantumDodgeGame(int screenWidth, int screenHeight, bool& exitGame) {
@@ -258,14 +382,15 @@ void QuantumDodgeGame(int screenWidth, int screenHeight, bool& exitGame) {
     static std::vector<Particle> obstacles;
     static float spawnTimer = 0.0f;
     static int score = 0;
+    static CounterRandom random(static_cast<uint64_t>(std::time(nullptr)), RNG_STREAM_QUANTUM_DODGE);
     spawnTimer += GetFrameTime();
     if (spawnTimer > 1.0f) {
         spawnTimer = 0.0f;
         Particle obstacle = {
-            {static_cast<float>(std::rand() % screenWidth), 0},
-            {0, static_cast<float>(std::rand() % 100 + 100) / 100.0f},
-            {static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), 255},
-            static_cast<float>(std::rand() % 10 + 10)
+            {static_cast<float>(random.Below(screenWidth)), 0},
+            {0, random.Uniform(1.0f, 2.0f)},
+            {static_cast<unsigned char>(random.Below(256)), static_cast<unsigned char>(random.Below(256)), static_cast<unsigned char>(random.Below(256)), 255},
+            static_cast<float>(random.Below(10) + 10)
         };
         obstacles.push_back(obstacle);
     }
@@ -275,8 +400,8 @@ void QuantumDodgeGame(int screenWidth, int screenHeight, bool& exitGame) {
     DrawCircleV(player, 15, GREEN);
     for (auto& obstacle : obstacles) {
         obstacle.position.y += obstacle.velocity.y;
-        if (std::rand() % 100 < 5) {
-            obstacle.position.x += static_cast<float>((std::rand() % 200 - 100) / 100.0f);
+        if (random.Uniform() < 0.05f) {
+            obstacle.position.x += random.Uniform(-1.0f, 1.0f);
         }
     }
     for (const auto& obstacle : obstacles) {
@@ -291,9 +416,15 @@ void QuantumDodgeGame(int screenWidth, int screenHeight, bool& exitGame) {
     for (const auto& obstacle : obstacles) {
         DrawCircleV(obstacle.position, obstacle.radius, obstacle.color);
     }
-    DrawText("Quantum Dodge", screenWidth / 2 - 150, 10, 30, PURPLE);
-    DrawText(("Score: " + std::to_string(score)).c_str(), 10, 10, 20, WHITE);
-    DrawText("Use LEFT/RIGHT to move. Avoid obstacles!", 10, screenHeight - 30, 20, WHITE);
+    static TextLayer header;
+    header.Draw(TextLayerKey({score}), {0, 0, static_cast<float>(screenWidth), 40}, [&] {
+        DrawText("Quantum Dodge", screenWidth / 2 - 150, 10, 30, PURPLE);
+        DrawText(("Score: " + std::to_string(score)).c_str(), 10, 10, 20, WHITE);
+    });
+    static TextLayer footer;
+    footer.Draw(0, {0, static_cast<float>(screenHeight - 30), static_cast<float>(screenWidth), 30}, [&] {
+        DrawText("Use LEFT/RIGHT to move. Avoid obstacles!", 10, screenHeight - 30, 20, WHITE);
+    });
 }
 
 void FormulaQuizGame(int screenWidth, int screenHeight, bool& exitGame) {
@@ -316,15 +447,79 @@ void FormulaQuizGame(int screenWidth, int screenHeight, bool& exitGame) {
         exitGame = true;
     }
     ClearBackground(BLACK);
-    DrawText("Formula Quiz", screenWidth / 2 - 150, 10, 30, PURPLE);
-    DrawText(("Question: " + questions[currentQuestion].first).c_str(), 10, 100, 20, WHITE);
-    if (showAnswer) {
-        DrawText(("Answer: " + questions[currentQuestion].second).c_str(), 10, 150, 20, GREEN);
-    } else {
-        DrawText("Press ENTER to show the answer", 10, 150, 20, YELLOW);
+    static TextLayer card;
+    card.Draw(TextLayerKey({currentQuestion, showAnswer}), {0, 0, static_cast<float>(screenWidth), 180}, [&] {
+        DrawText("Formula Quiz", screenWidth / 2 - 150, 10, 30, PURPLE);
+        DrawText(("Question: " + questions[currentQuestion].first).c_str(), 10, 100, 20, WHITE);
+        if (showAnswer) {
+            DrawText(("Answer: " + questions[currentQuestion].second).c_str(), 10, 150, 20, GREEN);
+        } else {
+            DrawText("Press ENTER to show the answer", 10, 150, 20, YELLOW);
+        }
+    });
+    static TextLayer footer;
+    footer.Draw(0, {0, static_cast<float>(screenHeight - 50), static_cast<float>(screenWidth), 50}, [&] {
+        DrawText("Use LEFT/RIGHT to navigate questions", 10, screenHeight - 50, 20, WHITE);
+        DrawText("Press BACKSPACE to return to the menu", 10, screenHeight - 30, 20, WHITE);
+    });
+}
+
+// Per-stage frame timings in the top-right corner, toggled with F3.
+void DrawProfilerOverlay(int screenWidth, int steps, const ParticleSystem& particles) {
+    const FrameProfiler& profiler = GetFrameProfiler();
+    const int width = 480;
+    const int x = screenWidth - width - 10;
+    int y = 10;
+    DrawRectangle(x, y, width, 60 + PROFILE_STAGE_COUNT * 20 + 120, Fade(BLACK, 0.75f));
+    DrawText(TextFormat("profiler  %d fps  %d steps/frame", GetFPS(), steps), x + 10, y + 8, 20, YELLOW);
+    y += 36;
+    const char* columns[] = {"cur ms", "avg ms", "p99 ms"};
+    DrawText("stage", x + 10, y, 10, GRAY);
+    for (int c = 0; c < 3; c++) DrawText(columns[c], x + 260 + c * 70, y, 10, GRAY);
+    y += 16;
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++) {
+        ProfileStats stats = profiler.Stats(static_cast<ProfileStage>(stage));
+        if (stats.samples == 0) continue;
+        DrawText(ProfileStageName(static_cast<ProfileStage>(stage)), x + 10, y, 20, WHITE);
+        float values[] = {stats.current, stats.average, stats.p99};
+        for (int c = 0; c < 3; c++) DrawText(TextFormat("%.2f", values[c]), x + 260 + c * 70, y, 20, GREEN);
+        y += 20;
+    }
+    // Rebuilds per step and pairs per second of short-range force time, over
+    // the frames in the rings.
+    const ProfileStats neighborSteps = profiler.CounterStats(PROFILE_COUNT_NEIGHBOR_STEPS);
+    if (neighborSteps.samples > 0) {
+        const ProfileStats builds = profiler.CounterStats(PROFILE_COUNT_NEIGHBOR_BUILDS);
+        const ProfileStats pairs = profiler.CounterStats(PROFILE_COUNT_NEIGHBOR_PAIRS);
+        const ProfileStats force = profiler.Stats(PROFILE_SHORT_RANGE);
+        const double seconds = static_cast<double>(force.average) * force.samples * 1e-3;
+        DrawText(TextFormat("neighbor lists: %.0f%% of steps rebuild, %.3g pairs/s", 100.0 * builds.average / neighborSteps.average,
+                            seconds > 0.0 ? static_cast<double>(pairs.average) * pairs.samples / seconds : 0.0),
+                 x + 10, y, 20, WHITE);
+        y += 20;
+    }
+    // How scattered the particles are in memory, now and after the last sort.
+    const ParticleOrder& order = particles.order;
+    if (particles.reorder && order.sorts > 0) {
+        DrawText(TextFormat("reorder: %.0f%% scattered, %.0f%% sorted, checks every %llu", 100.0f * order.scatter, 100.0f * order.sortedScatter,
+                            static_cast<unsigned long long>(order.interval)),
+                 x + 10, y, 20, WHITE);
+        y += 20;
+    }
+    const int binCount = 50;
+    const float binMilliseconds = 1.0f;
+    unsigned bins[binCount];
+    size_t frames = profiler.FrameHistogram(bins, binCount, binMilliseconds);
+    unsigned tallest = 1;
+    for (unsigned bin : bins) tallest = std::max(tallest, bin);
+    const int histogramHeight = 60;
+    const int barWidth = (width - 20) / binCount;
+    y += 10;
+    for (int i = 0; i < binCount; i++) {
+        int barHeight = static_cast<int>(bins[i] * histogramHeight / tallest);
+        DrawRectangle(x + 10 + i * barWidth, y + histogramHeight - barHeight, barWidth - 1, barHeight, i < 17 ? GREEN : RED);
     }
-    DrawText("Use LEFT/RIGHT to navigate questions", 10, screenHeight - 50, 20, WHITE);
-    DrawText("Press BACKSPACE to return to the menu", 10, screenHeight - 30, 20, WHITE);
+    DrawText(TextFormat("frame time, %zu frames, 1 ms bins, red from 17 ms", frames), x + 10, y + histogramHeight + 4, 10, GRAY);
 }
 
 int main() {
@@ -332,28 +527,22 @@ int main() {
     const int screenHeight = 1080;
     InitWindow(screenWidth, screenHeight, "Quantum Particle Simulation");
     ToggleFullscreen();
-    std::srand(std::time(nullptr));
+    SceneRenderer scene;
+    scene.Load(screenWidth, screenHeight);
     int particleCount = 100;
-    std::vector<Particle> particles;
-    for (int i = 0; i < particleCount; i++) {
-        Particle particle = {
-            {static_cast<float>(std::rand() % screenWidth), static_cast<float>(std::rand() % screenHeight)},
-            {static_cast<float>((std::rand() % 200 - 100) / 100.0f), static_cast<float>((std::rand() % 200 - 100) / 100.0f)},
-            {static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), static_cast<unsigned char>(std::rand() % 256), 255},
-            static_cast<float>(std::rand() % 5 + 5)
-        };
-        particles.push_back(particle);
-    }
+    ParticleSystem particles;
+    particles.seed = static_cast<uint64_t>(std::time(nullptr));
+    particles.Reserve(MAX_PARTICLE_COUNT);
+    particles.reorder = true;
+    ResizeParticles(particles, particleCount, screenWidth, screenHeight);
     SetTargetFPS(60);
+    SimulationClock clock;
     GameState gameState = MENU;
     int menuSelection = 0;
-    std::vector<Principle> principles = {
-        {"Superposition", "A particle can exist in multiple states simultaneously.", "‎ psi = sum c_n |n>", SUPERPOSITION},
-        {"Uncertainty Principle", "You cannot simultaneously know the exact position and momentum of a particle.", "‎ dx * dp >= h / (4*pi)", UNCERTAINTY},
-        {"Entanglement", "Particles can be correlated regardless of distance.", "No specific equation", ENTANGLEMENT},
-        {"Wave-Particle Duality", "Particles exhibit both wave and particle properties.", "‎ lambda = h / p", WAVE_PARTICLE_DUALITY},
-        {"Chaos", "Particles move chaotically with random velocity and color changes.", "No specific equation", CHAOS}
-    };
+    std::vector<Principle> principles;
+    for (const PrincipleInfo& info : PRINCIPLE_TABLE) {
+        principles.push_back({info.name, info.description, info.equation, info.type});
+    }
     QuantumPrinciple currentPrinciple = SUPERPOSITION;
     bool showPrinciple = false;
     float time = 0.0f;
@@ -363,7 +552,12 @@ int main() {
     bool exitQuantumDodge = false;
     bool exitFormulaQuiz = false;
     while (!WindowShouldClose()) {
+        GetFrameProfiler().BeginFrame();
         time += GetFrameTime();
+        if (IsKeyPressed(KEY_F3)) GetFrameProfiler().SetEnabled(!FrameProfiler::Enabled());
+        if (IsKeyPressed(KEY_F4)) GetTraceRecorder().SetEnabled(!TraceRecorder::Enabled());
+        if (IsKeyPressed(KEY_F5) && !GetTraceRecorder().Flush(TRACE_FILE)) TraceLog(LOG_WARNING, "could not write %s", TRACE_FILE);
+        TraceScope stateScope(GAME_STATE_NAMES[gameState], "state");
         if (gameState == MENU) {
             if (IsKeyPressed(KEY_DOWN)) menuSelection = (menuSelection + 1) % 5;
             if (IsKeyPressed(KEY_UP)) menuSelection = (menuSelection - 1 + 5) % 5;
@@ -377,21 +571,48 @@ int main() {
                 } else if (menuSelection == 3) {
                     gameState = GAMES;
                 } else if (menuSelection == 4) {
+                    if (GetTraceRecorder().HasEvents()) GetTraceRecorder().Flush(TRACE_FILE);
+                    UnloadTextLayers();
+                    scene.Unload();
                     CloseWindow();
                     return 0;
                 }
             }
         } else if (gameState == SETTINGS) {
-            if (IsKeyPressed(KEY_DOWN)) settingsSelection = (settingsSelection + 1) % 3;
-            if (IsKeyPressed(KEY_UP)) settingsSelection = (settingsSelection - 1 + 3) % 3;
+            if (IsKeyPressed(KEY_DOWN)) settingsSelection = (settingsSelection + 1) % SETTINGS_OPTION_COUNT;
+            if (IsKeyPressed(KEY_UP)) settingsSelection = (settingsSelection - 1 + SETTINGS_OPTION_COUNT) % SETTINGS_OPTION_COUNT;
             if (IsKeyPressed(KEY_ENTER)) {
                 if (settingsSelection == TOGGLE_FULLSCREEN) {
                     isFullscreen = !isFullscreen;
                     ToggleFullscreen();
                 } else if (settingsSelection == CHANGE_PARTICLE_COUNT) {
-                    particleCount += 50;
-                    if (particleCount > 500) particleCount = 50;
-                    particles.resize(particleCount);
+                    particleCount = NextParticleCount(particleCount);
+                    ResizeParticles(particles, particleCount, screenWidth, screenHeight);
+                } else if (settingsSelection == CHANGE_THREAD_COUNT) {
+                    int threadCount = GetThreadPool().ThreadCount();
+                    int maxThreads = HardwareThreadCount();
+                    threadCount = threadCount >= maxThreads ? 1 : std::min(threadCount * 2, maxThreads);
+                    GetThreadPool().SetThreadCount(threadCount);
+                } else if (settingsSelection == CHANGE_RENDER_MODE) {
+                    scene.mode = static_cast<RenderMode>((scene.mode + 1) % RENDER_MODE_COUNT);
+                } else if (settingsSelection == CHANGE_WAVE_SOLVER) {
+                    GetWaveField().SetSolver(static_cast<WaveSolver>((GetWaveField().Solver() + 1) % WAVE_SOLVER_COUNT));
+                } else if (settingsSelection == CHANGE_STEP_RATE) {
+                    clock.stepRate = NextSetting(STEP_RATES, clock.stepRate);
+                    ResetSimulationClock(clock);
+                } else if (settingsSelection == CHANGE_SPEED) {
+                    clock.speed = NextSetting(SPEEDS, clock.speed);
+                } else if (settingsSelection == CHANGE_INTEGRATOR) {
+                    particles.integrator = static_cast<Integrator>((particles.integrator + 1) % INTEGRATOR_COUNT);
+                } else if (settingsSelection == TOGGLE_COLLISIONS) {
+                    particles.collisions = !particles.collisions;
+                } else if (settingsSelection == TOGGLE_LENNARD_JONES) {
+                    particles.lennardJones = particles.lennardJones != 0.0f ? 0.0f : LENNARD_JONES_DEPTH;
+                } else if (settingsSelection == CHANGE_PAIR_FORCE) {
+                    // Off, then attracting, then repelling.
+                    particles.pairForce = particles.pairForce == 0.0f ? PAIR_FORCE_GRAVITY : particles.pairForce > 0.0f ? -PAIR_FORCE_GRAVITY : 0.0f;
+                } else if (settingsSelection == TOGGLE_REORDER) {
+                    particles.reorder = !particles.reorder;
                 } else if (settingsSelection == BACK_TO_MENU) {
                     gameState = MENU;
                 }
@@ -404,23 +625,20 @@ int main() {
             if (IsKeyPressed(KEY_BACKSPACE)) {
                 gameState = MENU;
             }
-            if (IsKeyPressed(KEY_ONE)) {
-                currentPrinciple = SUPERPOSITION;
-                showPrinciple = true;
-            } else if (IsKeyPressed(KEY_TWO)) {
-                currentPrinciple = UNCERTAINTY;
-                showPrinciple = true;
-            } else if (IsKeyPressed(KEY_THREE)) {
-                currentPrinciple = ENTANGLEMENT;
-                showPrinciple = true;
-            } else if (IsKeyPressed(KEY_FOUR)) {
-                currentPrinciple = WAVE_PARTICLE_DUALITY;
-                showPrinciple = true;
-            } else if (IsKeyPressed(KEY_FIVE)) {
-                currentPrinciple = CHAOS;
-                showPrinciple = true;
+            for (int i = 0; i < QUANTUM_PRINCIPLE_COUNT && KEY_ONE + i <= KEY_NINE; i++) {
+                if (IsKeyPressed(KEY_ONE + i)) {
+                    currentPrinciple = static_cast<QuantumPrinciple>(i);
+                    showPrinciple = true;
+                }
+            }
+            // Whole fixed steps for the time this frame took, however long
+            // it was; rendering below shows the state after the last one.
+            ScopedProfile profile(PROFILE_UPDATE);
+            const int steps = AdvanceSimulationClock(clock, GetFrameTime());
+            particles.dt = SimulationStepFrames(clock);
+            for (int i = 0; i < steps; i++) {
+                UpdateParticlesByPrinciple(particles, currentPrinciple, screenWidth, screenHeight);
             }
-            UpdateParticlesByPrinciple(particles, currentPrinciple, screenWidth, screenHeight);
         } else if (gameState == GAMES) {
             if (IsKeyPressed(KEY_DOWN)) gamesSelection = (gamesSelection + 1) % 3;
             if (IsKeyPressed(KEY_UP)) gamesSelection = (gamesSelection - 1 + 3) % 3;
@@ -433,7 +651,12 @@ int main() {
                     gameState = MENU;
                 }
             }
-        } else if (gameState == QUANTUM_DODGE) {
+        }
+        BeginDrawing();
+        ClearBackground(BLACK);
+        // The mini-games update and draw in one pass, so they run inside the
+        // frame where their text layers can be composited.
+        if (gameState == QUANTUM_DODGE) {
             QuantumDodgeGame(screenWidth, screenHeight, exitQuantumDodge);
             if (exitQuantumDodge || IsKeyPressed(KEY_BACKSPACE)) {
                 gameState = GAMES;
@@ -445,27 +668,41 @@ int main() {
                 gameState = GAMES;
                 exitFormulaQuiz = false;
             }
-        }
-        BeginDrawing();
-        ClearBackground(BLACK);
-        if (gameState == MENU) {
-            DrawEnhancedMenu(screenWidth, screenHeight, menuSelection, time);
-        } else if (gameState == SETTINGS) {
-            DrawSettingsMenu(screenWidth, screenHeight, settingsSelection, isFullscreen, particleCount);
-        } else if (gameState == ABOUT) {
-            DrawEnhancedAboutMenu(screenWidth, screenHeight);
         } else if (gameState == SIMULATION) {
             if (showPrinciple) {
-                DrawInteractivePrinciple(principles[currentPrinciple], particles, screenWidth, screenHeight);
+                DrawInteractivePrinciple(scene, principles[currentPrinciple], particles, screenWidth, screenHeight);
             } else {
-                DrawText("Press 1-5 to explore quantum principles", 10, 10, 20, WHITE);
-                AddUniqueFeaturesToParticles(particles, screenWidth, screenHeight);
+                AddUniqueFeaturesToParticles(scene, particles, screenWidth, screenHeight);
+                ScopedProfile profile(PROFILE_DRAW_TEXT);
+                static TextLayer hint;
+                hint.Draw(0, {0, 0, static_cast<float>(screenWidth), 40}, [] {
+                    DrawText("Press 1-5 to explore quantum principles", 10, 10, 20, WHITE);
+                });
             }
-        } else if (gameState == GAMES) {
-            DrawGamesMenu(screenWidth, screenHeight, gamesSelection);
+        } else {
+            ScopedProfile profile(PROFILE_DRAW_TEXT);
+            if (gameState == MENU) {
+                DrawEnhancedMenu(screenWidth, screenHeight, menuSelection, time);
+            } else if (gameState == SETTINGS) {
+                DrawSettingsMenu(screenWidth, screenHeight, settingsSelection, isFullscreen, particleCount, GetThreadPool().ThreadCount(), scene.mode, GetWaveField().Solver(),
+                                 clock, particles.integrator, particles.collisions, particles.lennardJones != 0.0f, particles.pairForce, particles.reorder);
+            } else if (gameState == ABOUT) {
+                DrawEnhancedAboutMenu(screenWidth, screenHeight);
+            } else if (gameState == GAMES) {
+                DrawGamesMenu(screenWidth, screenHeight, gamesSelection);
+            }
+        }
+        if (FrameProfiler::Enabled()) DrawProfilerOverlay(screenWidth, clock.lastSteps, particles);
+        if (TraceRecorder::Enabled()) DrawText("TRACE  F5 to save", screenWidth - 200, screenHeight - 30, 20, RED);
+        {
+            ScopedProfile profile(PROFILE_END_DRAWING);
+            EndDrawing();
         }
-        EndDrawing();
+        GetFrameProfiler().EndFrame();
     }
+    if (GetTraceRecorder().HasEvents()) GetTraceRecorder().Flush(TRACE_FILE);
+    UnloadTextLayers();
+    scene.Unload();
     CloseWindow();
     return 0;
 }
\ No newline at end of file
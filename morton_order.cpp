@@ -0,0 +1,60 @@
+#include "morton_order.h"
+#include "thread_pool.h"
+#include <cstring>
+
+static const size_t RADIX_DIGITS = 256;
+
+void RadixSortPairs(uint32_t* keys, uint32_t* values, size_t count, unsigned bits, RadixSortScratch& scratch) {
+    if (count < 2) return;
+    if (scratch.keys.Capacity() < count) {
+        scratch.keys.Reallocate(count, 0);
+        scratch.values.Reallocate(count, 0);
+    }
+    // The sort is stable whatever the split, so it gets one task per thread.
+    const size_t threads = static_cast<size_t>(GetThreadPool().ThreadCount());
+    const size_t tasks = count < threads ? count : threads;
+    if (scratch.counts.Capacity() < tasks * RADIX_DIGITS) scratch.counts.Reallocate(tasks * RADIX_DIGITS, 0);
+    uint32_t* counts = scratch.counts.Data();
+
+    uint32_t* fromKeys = keys;
+    uint32_t* fromValues = values;
+    uint32_t* toKeys = scratch.keys.Data();
+    uint32_t* toValues = scratch.values.Data();
+    for (unsigned shift = 0; shift < bits; shift += 8) {
+        ParallelFor(tasks, 1, [&](size_t task, size_t) {
+            uint32_t* digits = counts + task * RADIX_DIGITS;
+            std::memset(digits, 0, RADIX_DIGITS * sizeof(uint32_t));
+            const size_t end = count * (task + 1) / tasks;
+            for (size_t i = count * task / tasks; i < end; i++) digits[(fromKeys[i] >> shift) & 0xFF]++;
+        });
+        // Each task's count becomes where its first key with that digit goes.
+        bool sorted = false;
+        uint32_t running = 0;
+        for (size_t digit = 0; digit < RADIX_DIGITS; digit++) {
+            const uint32_t first = running;
+            for (size_t task = 0; task < tasks; task++) {
+                const uint32_t n = counts[task * RADIX_DIGITS + digit];
+                counts[task * RADIX_DIGITS + digit] = running;
+                running += n;
+            }
+            if (running - first == count) sorted = true;
+        }
+        if (sorted) continue;
+        ParallelFor(tasks, 1, [&](size_t task, size_t) {
+            uint32_t* offsets = counts + task * RADIX_DIGITS;
+            const size_t end = count * (task + 1) / tasks;
+            for (size_t i = count * task / tasks; i < end; i++) {
+                const uint32_t slot = offsets[(fromKeys[i] >> shift) & 0xFF]++;
+                toKeys[slot] = fromKeys[i];
+                toValues[slot] = fromValues[i];
+            }
+        });
+        std::swap(fromKeys, toKeys);
+        std::swap(fromValues, toValues);
+    }
+    if (fromKeys == keys) return;
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        std::memcpy(keys + begin, fromKeys + begin, (end - begin) * sizeof(uint32_t));
+        std::memcpy(values + begin, fromValues + begin, (end - begin) * sizeof(uint32_t));
+    });
+}
@@ -0,0 +1,40 @@
+#ifndef MORTON_ORDER_H
+#define MORTON_ORDER_H
+
+#include "aligned_array.h"
+#include <cstddef>
+#include <cstdint>
+
+// Scratch space for RadixSortPairs: a second copy of the keys and values to
+// sort between, and a 256-bin digit count per task.
+struct RadixSortScratch {
+    AlignedArray<uint32_t> keys;
+    AlignedArray<uint32_t> values;
+    AlignedArray<uint32_t> counts;
+};
+
+// Spreads the low 16 bits of v over the even bits of the result.
+inline uint32_t SpreadMortonBits(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Z-order key of a cell of a 65536 x 65536 grid: the column in the even bits
+// and the row in the odd ones, so sorting by key keeps every aligned
+// power-of-two square of cells in one run.
+inline uint32_t MortonKey(uint32_t column, uint32_t row) {
+    return SpreadMortonBits(column) | (SpreadMortonBits(row) << 1);
+}
+
+// Sorts keys[0, count) ascending and moves values with them, 8 bits a pass
+// over the low bits of the keys. Each pass counts digits per task, turns the
+// counts into per-task offsets and scatters; the sort is stable, so the result
+// is the same at any thread count. Passes whose digit is the same for every
+// key are skipped.
+void RadixSortPairs(uint32_t* keys, uint32_t* values, size_t count, unsigned bits, RadixSortScratch& scratch);
+
+#endif
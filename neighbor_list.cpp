@@ -0,0 +1,345 @@
+#include "neighbor_list.h"
+#include "frame_profiler.h"
+#include "particle_system.h"
+#include "simd_kernels.h"
+#include "spatial_grid.h"
+#include "thread_pool.h"
+#include <cstring>
+
+// Neighbours a particle collects before copying them to its row.
+static const size_t NEIGHBOR_BUILD_BATCH = 64;
+
+static const float LENNARD_JONES_SIGMA_SQUARED = LENNARD_JONES_SIGMA * LENNARD_JONES_SIGMA;
+static const float LENNARD_JONES_CUTOFF_SQUARED = LENNARD_JONES_CUTOFF * LENNARD_JONES_CUTOFF;
+static const float LENNARD_JONES_CORE_SQUARED = LENNARD_JONES_CORE * LENNARD_JONES_CORE;
+
+bool NeighborListCurrent(NeighborList& list, const ParticleSystem& particles, float skin) {
+    const size_t count = particles.Size();
+    if (list.members != count || list.skin != skin) return false;
+    const size_t chunks = (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (list.chunkMoved.Capacity() < chunks) list.chunkMoved.Reallocate(chunks, 0);
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    const float* buildX = list.buildX.Data();
+    const float* buildY = list.buildY.Data();
+    float* chunkMoved = list.chunkMoved.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float largest = 0.0f;
+        for (size_t i = begin; i < end; i++) {
+            const float dx = x[i] - buildX[i];
+            const float dy = y[i] - buildY[i];
+            const float moved = dx * dx + dy * dy;
+            largest = moved > largest ? moved : largest;
+        }
+        chunkMoved[begin / PARALLEL_CHUNK_SIZE] = largest;
+    });
+    const float limit = 0.25f * skin * skin;
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        if (!(chunkMoved[chunk] <= limit)) return false;
+    }
+    return true;
+}
+
+void BuildNeighborList(NeighborList& list, const ParticleSystem& particles, float skin, float width, float height) {
+    const size_t count = particles.Size();
+    list.members = 0;
+    list.pairs = 0;
+    list.skin = skin;
+    list.builds++;
+    if (list.start.Capacity() < count + 1) {
+        const size_t capacity = GrownCapacity(list.start.Capacity(), count + 1);
+        list.start.Reallocate(capacity, 0);
+        list.buildX.Reallocate(capacity, 0);
+        list.buildY.Reallocate(capacity, 0);
+    }
+    const size_t chunks = (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (list.chunkPairs.Capacity() < chunks) list.chunkPairs.Reallocate(chunks, 0);
+
+    // The longest cutoff is reached between two of the largest circles.
+    BuildSpatialGrid(list.grid, particles, width, height, LENNARD_JONES_CUTOFF * LENNARD_JONES_SIGMA, skin);
+    const SpatialGrid& grid = list.grid;
+    const uint32_t* cellStart = grid.cellStart.Data();
+    const uint32_t* member = grid.particle.Data();
+    const float* sortedX = grid.x.Data();
+    const float* sortedY = grid.y.Data();
+    const float* sortedRadius = grid.radius.Data();
+    const size_t columns = grid.columns;
+    // Calls visit(particle, search) for every particle in a row of cells, in
+    // slot order, where search(fn) calls fn(slot, within) for every slot
+    // around it, within if it holds another particle inside the cutoff plus
+    // the skin. Going by slot, neighbouring particles search the same runs of
+    // slots while they are still in cache; passing within rather than
+    // branching on it keeps the mostly unpredictable test out of the branch
+    // predictor.
+    auto forEachParticleInRow = [&](size_t row, auto&& visit) {
+        for (size_t column = 0; column < columns; column++) {
+            const uint32_t cellEnd = cellStart[row * columns + column + 1];
+            for (uint32_t self = cellStart[row * columns + column]; self < cellEnd; self++) {
+                const float xi = sortedX[self], yi = sortedY[self], ri = sortedRadius[self];
+                visit(member[self], [&](auto&& fn) {
+                    ForEachNeighborSlot(grid, column, row, [&](uint32_t slot) {
+                        const float dx = sortedX[slot] - xi;
+                        const float dy = sortedY[slot] - yi;
+                        const float reach = LENNARD_JONES_CUTOFF * LENNARD_JONES_SIGMA * (ri + sortedRadius[slot]) + skin;
+                        fn(slot, (dx * dx + dy * dy < reach * reach) & (slot != self));
+                    });
+                });
+            }
+        }
+    };
+
+    uint32_t* start = list.start.Data();
+    ParallelFor(grid.rows, 1, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++) {
+            forEachParticleInRow(row, [&](uint32_t particle, auto&& search) {
+                uint32_t n = 0;
+                search([&](uint32_t, bool within) { n += within; });
+                start[particle] = n;
+            });
+        }
+    });
+
+    // The counts become row offsets in particle order.
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    uint64_t* chunkPairs = list.chunkPairs.Data();
+    float* buildX = list.buildX.Data();
+    float* buildY = list.buildY.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        uint64_t total = 0;
+        for (size_t i = begin; i < end; i++) {
+            total += start[i];
+            buildX[i] = x[i];
+            buildY[i] = y[i];
+        }
+        chunkPairs[begin / PARALLEL_CHUNK_SIZE] = total;
+    });
+    uint64_t total = 0;
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        const uint64_t n = chunkPairs[chunk];
+        chunkPairs[chunk] = total;
+        total += n;
+    }
+    list.pairs = static_cast<size_t>(total);
+    if (total > NEIGHBOR_LIST_MAX_PAIRS) return;
+    // Some slack, so a list that grows a little does not reallocate on every
+    // build.
+    if (list.neighbor.Capacity() < total) list.neighbor.Reallocate(total + total / 4 + PARTICLE_LANE_PADDING, 0);
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        uint32_t offset = static_cast<uint32_t>(chunkPairs[begin / PARALLEL_CHUNK_SIZE]);
+        for (size_t i = begin; i < end; i++) {
+            const uint32_t n = start[i];
+            start[i] = offset;
+            offset += n;
+        }
+    });
+    start[count] = static_cast<uint32_t>(total);
+
+    uint32_t* neighbor = list.neighbor.Data();
+    ParallelFor(grid.rows, 1, [&](size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++) {
+            forEachParticleInRow(row, [&](uint32_t particle, auto&& search) {
+                // Every candidate is written to the batch and kept only if
+                // within; full batches are copied to the particle's row.
+                uint32_t batch[NEIGHBOR_BUILD_BATCH];
+                uint32_t* out = neighbor + start[particle];
+                size_t n = 0;
+                search([&](uint32_t slot, bool within) {
+                    batch[n] = member[slot];
+                    n += within;
+                    if (n == NEIGHBOR_BUILD_BATCH) {
+                        std::memcpy(out, batch, n * sizeof(uint32_t));
+                        out += n;
+                        n = 0;
+                    }
+                });
+                std::memcpy(out, batch, n * sizeof(uint32_t));
+            });
+        }
+    });
+    list.members = count;
+}
+
+struct LennardJonesStep {
+    const uint32_t* start;
+    const uint32_t* neighbor;
+    const float* x;
+    const float* y;
+    const float* radius;
+    float* vx;
+    float* vy;
+    // 24 times the well depth, and the step length in frames.
+    float scale;
+    float dt;
+};
+
+static void LennardJonesScalar(const LennardJonesStep& step, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        const float xi = step.x[i], yi = step.y[i], ri = step.radius[i];
+        float sumX = 0.0f, sumY = 0.0f;
+        for (uint32_t k = step.start[i]; k < step.start[i + 1]; k++) {
+            const uint32_t j = step.neighbor[k];
+            const float dx = xi - step.x[j];
+            const float dy = yi - step.y[j];
+            const float r2 = dx * dx + dy * dy;
+            const float contact = ri + step.radius[j];
+            const float sigma2 = contact * contact * LENNARD_JONES_SIGMA_SQUARED;
+            if (!(r2 < sigma2 * LENNARD_JONES_CUTOFF_SQUARED)) continue;
+            const float core = sigma2 * LENNARD_JONES_CORE_SQUARED;
+            const float clamped = r2 < core ? core : r2;
+            const float inverse = sigma2 / clamped;
+            const float s6 = inverse * inverse * inverse;
+            // |F| / r, positive pushing the pair apart.
+            const float strength = step.scale * s6 * (2.0f * s6 - 1.0f) / clamped;
+            sumX += strength * dx;
+            sumY += strength * dy;
+        }
+        const float kick = step.dt / (ri * ri);
+        step.vx[i] += sumX * kick;
+        step.vy[i] += sumY * kick;
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+// Eight particles at once, each lane gathering the next neighbour in its own
+// row until the longest row of the eight runs out; returns where it stopped.
+__attribute__((target("avx2"))) static size_t LennardJonesAvx2(const LennardJonesStep& step, size_t begin, size_t end) {
+    const __m256 scale = _mm256_set1_ps(step.scale);
+    const __m256 sigmaSquared = _mm256_set1_ps(LENNARD_JONES_SIGMA_SQUARED);
+    const __m256 cutoffSquared = _mm256_set1_ps(LENNARD_JONES_CUTOFF_SQUARED);
+    const __m256 coreSquared = _mm256_set1_ps(LENNARD_JONES_CORE_SQUARED);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const int* neighbor = reinterpret_cast<const int*>(step.neighbor);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(step.start + i));
+        const __m256i counts = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(step.start + i + 1)), first);
+        uint32_t longest = 0;
+        for (size_t lane = 0; lane < 8; lane++) {
+            const uint32_t n = step.start[i + lane + 1] - step.start[i + lane];
+            longest = n > longest ? n : longest;
+        }
+        // Lanes past the end of their row gather their own particle.
+        const __m256i self = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), lanes);
+        const __m256 xi = _mm256_loadu_ps(step.x + i);
+        const __m256 yi = _mm256_loadu_ps(step.y + i);
+        const __m256 ri = _mm256_loadu_ps(step.radius + i);
+        __m256 sumX = _mm256_setzero_ps(), sumY = _mm256_setzero_ps();
+        for (uint32_t k = 0; k < longest; k++) {
+            const __m256i next = _mm256_set1_epi32(static_cast<int>(k));
+            const __m256i active = _mm256_cmpgt_epi32(counts, next);
+            const __m256i j = _mm256_mask_i32gather_epi32(self, neighbor, _mm256_add_epi32(first, next), active, 4);
+            const __m256 dx = _mm256_sub_ps(xi, _mm256_i32gather_ps(step.x, j, 4));
+            const __m256 dy = _mm256_sub_ps(yi, _mm256_i32gather_ps(step.y, j, 4));
+            const __m256 r2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            const __m256 contact = _mm256_add_ps(ri, _mm256_i32gather_ps(step.radius, j, 4));
+            const __m256 sigma2 = _mm256_mul_ps(_mm256_mul_ps(contact, contact), sigmaSquared);
+            const __m256 within = _mm256_and_ps(_mm256_cmp_ps(r2, _mm256_mul_ps(sigma2, cutoffSquared), _CMP_LT_OQ), _mm256_castsi256_ps(active));
+            if (_mm256_movemask_ps(within) == 0) continue;
+            const __m256 clamped = _mm256_max_ps(r2, _mm256_mul_ps(sigma2, coreSquared));
+            const __m256 inverse = _mm256_div_ps(sigma2, clamped);
+            const __m256 s6 = _mm256_mul_ps(_mm256_mul_ps(inverse, inverse), inverse);
+            const __m256 strength = _mm256_div_ps(_mm256_mul_ps(_mm256_mul_ps(scale, s6), _mm256_sub_ps(_mm256_mul_ps(two, s6), one)), clamped);
+            sumX = _mm256_blendv_ps(sumX, _mm256_add_ps(sumX, _mm256_mul_ps(strength, dx)), within);
+            sumY = _mm256_blendv_ps(sumY, _mm256_add_ps(sumY, _mm256_mul_ps(strength, dy)), within);
+        }
+        const __m256 kick = _mm256_div_ps(_mm256_set1_ps(step.dt), _mm256_mul_ps(ri, ri));
+        _mm256_storeu_ps(step.vx + i, _mm256_add_ps(_mm256_loadu_ps(step.vx + i), _mm256_mul_ps(sumX, kick)));
+        _mm256_storeu_ps(step.vy + i, _mm256_add_ps(_mm256_loadu_ps(step.vy + i), _mm256_mul_ps(sumY, kick)));
+    }
+    return i;
+}
+
+// The AVX2 kernel sixteen particles wide.
+QPS_AVX512_TARGET static size_t LennardJonesAvx512(const LennardJonesStep& step, size_t begin, size_t end) {
+    const __m512 scale = _mm512_set1_ps(step.scale);
+    const __m512 sigmaSquared = _mm512_set1_ps(LENNARD_JONES_SIGMA_SQUARED);
+    const __m512 cutoffSquared = _mm512_set1_ps(LENNARD_JONES_CUTOFF_SQUARED);
+    const __m512 coreSquared = _mm512_set1_ps(LENNARD_JONES_CORE_SQUARED);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 two = _mm512_set1_ps(2.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        const __m512i first = _mm512_loadu_si512(step.start + i);
+        const __m512i counts = _mm512_sub_epi32(_mm512_loadu_si512(step.start + i + 1), first);
+        uint32_t longest = 0;
+        for (size_t lane = 0; lane < 16; lane++) {
+            const uint32_t n = step.start[i + lane + 1] - step.start[i + lane];
+            longest = n > longest ? n : longest;
+        }
+        const __m512i self = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lanes);
+        const __m512 xi = _mm512_loadu_ps(step.x + i);
+        const __m512 yi = _mm512_loadu_ps(step.y + i);
+        const __m512 ri = _mm512_loadu_ps(step.radius + i);
+        __m512 sumX = zero, sumY = zero;
+        for (uint32_t k = 0; k < longest; k++) {
+            const __m512i next = _mm512_set1_epi32(static_cast<int>(k));
+            const __mmask16 active = _mm512_cmpgt_epi32_mask(counts, next);
+            const __m512i j = _mm512_mask_i32gather_epi32(self, active, _mm512_add_epi32(first, next), step.neighbor, 4);
+            const __m512 dx = _mm512_sub_ps(xi, _mm512_mask_i32gather_ps(zero, active, j, step.x, 4));
+            const __m512 dy = _mm512_sub_ps(yi, _mm512_mask_i32gather_ps(zero, active, j, step.y, 4));
+            const __m512 r2 = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+            const __m512 contact = _mm512_add_ps(ri, _mm512_mask_i32gather_ps(zero, active, j, step.radius, 4));
+            const __m512 sigma2 = _mm512_mul_ps(_mm512_mul_ps(contact, contact), sigmaSquared);
+            const __mmask16 within = _mm512_mask_cmp_ps_mask(active, r2, _mm512_mul_ps(sigma2, cutoffSquared), _CMP_LT_OQ);
+            if (within == 0) continue;
+            const __m512 clamped = _mm512_maskz_max_ps(0xFFFF, r2, _mm512_mul_ps(sigma2, coreSquared));
+            const __m512 inverse = _mm512_div_ps(sigma2, clamped);
+            const __m512 s6 = _mm512_mul_ps(_mm512_mul_ps(inverse, inverse), inverse);
+            const __m512 strength = _mm512_div_ps(_mm512_mul_ps(_mm512_mul_ps(scale, s6), _mm512_sub_ps(_mm512_mul_ps(two, s6), one)), clamped);
+            sumX = _mm512_mask_add_ps(sumX, within, sumX, _mm512_mul_ps(strength, dx));
+            sumY = _mm512_mask_add_ps(sumY, within, sumY, _mm512_mul_ps(strength, dy));
+        }
+        const __m512 kick = _mm512_div_ps(_mm512_set1_ps(step.dt), _mm512_mul_ps(ri, ri));
+        _mm512_storeu_ps(step.vx + i, _mm512_add_ps(_mm512_loadu_ps(step.vx + i), _mm512_mul_ps(sumX, kick)));
+        _mm512_storeu_ps(step.vy + i, _mm512_add_ps(_mm512_loadu_ps(step.vy + i), _mm512_mul_ps(sumY, kick)));
+    }
+    return i;
+}
+
+#endif
+
+void ApplyLennardJones(const NeighborList& list, ParticleSystem& particles, float depth) {
+    const SimdLevel level = ActiveSimdLevel();
+    if (list.members == 0 || list.members != particles.Size()) return;
+    const LennardJonesStep step = {list.start.Data(), list.neighbor.Data(), particles.x.Data(), particles.y.Data(), particles.radius.Data(),
+                                   particles.vx.Data(), particles.vy.Data(), 24.0f * depth, particles.dt};
+    ParallelFor(list.members, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        size_t done = begin;
+#ifdef QPS_X86_SIMD
+        if (level == SIMD_AVX512) {
+            done = LennardJonesAvx512(step, begin, end);
+        } else if (level == SIMD_AVX2) {
+            done = LennardJonesAvx2(step, begin, end);
+        }
+#else
+        (void)level;
+#endif
+        LennardJonesScalar(step, done, end);
+    });
+}
+
+void UpdateShortRangeForces(ParticleSystem& particles, float width, float height) {
+    NeighborList& list = particles.neighbors;
+    bool rebuilt = false;
+    {
+        ScopedProfile profile(PROFILE_NEIGHBOR_LIST);
+        if (!NeighborListCurrent(list, particles, particles.skin)) {
+            BuildNeighborList(list, particles, particles.skin, width, height);
+            rebuilt = true;
+        }
+    }
+    list.steps++;
+    FrameProfiler& profiler = GetFrameProfiler();
+    profiler.Count(PROFILE_COUNT_NEIGHBOR_STEPS, 1);
+    profiler.Count(PROFILE_COUNT_NEIGHBOR_BUILDS, rebuilt ? 1 : 0);
+    if (list.members != particles.Size()) return;
+    profiler.Count(PROFILE_COUNT_NEIGHBOR_PAIRS, list.pairs);
+    ScopedProfile profile(PROFILE_SHORT_RANGE);
+    ApplyLennardJones(list, particles, particles.lennardJones);
+}
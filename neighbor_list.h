@@ -0,0 +1,77 @@
+#ifndef NEIGHBOR_LIST_H
+#define NEIGHBOR_LIST_H
+
+#include "aligned_array.h"
+#include "spatial_grid.h"
+#include <cstddef>
+#include <cstdint>
+
+class ParticleSystem;
+
+// Verlet neighbour lists for the short-range Lennard-Jones force: every pair
+// that was within its cutoff plus a skin at the last build, in compressed
+// sparse rows. The lists hold every pair the force needs until some particle
+// has moved half the skin from where it was built.
+struct NeighborList {
+    // members + 1 offsets: particle i's neighbours are
+    // neighbor[start[i], start[i + 1]), in the grid's slot order.
+    AlignedArray<uint32_t> start;
+    AlignedArray<uint32_t> neighbor;
+    // Per particle: its position at the last build.
+    AlignedArray<float> buildX;
+    AlignedArray<float> buildY;
+    // Per chunk: its neighbour count and then its first offset, and the
+    // largest squared distance a particle has moved since the build.
+    AlignedArray<uint64_t> chunkPairs;
+    AlignedArray<float> chunkMoved;
+    SpatialGrid grid;
+    // Particles and list entries, two per pair, at the last build; 0
+    // members if it was abandoned for exceeding NEIGHBOR_LIST_MAX_PAIRS.
+    size_t members = 0;
+    size_t pairs = 0;
+    float skin = 0.0f;
+    // Steps that used the lists, and how many of them rebuilt them first.
+    uint64_t steps = 0;
+    uint64_t builds = 0;
+};
+
+// Lennard-Jones sigma per px of contact distance, 2^(-1/6): the well's
+// minimum, 2^(1/6) sigma, sits where two circles touch.
+const float LENNARD_JONES_SIGMA = 0.8908987f;
+// Pairs interact out to this many sigma.
+const float LENNARD_JONES_CUTOFF = 2.5f;
+// Closer pairs are pushed apart as if they were this many sigma apart, which
+// bounds the force between heavily overlapping circles.
+const float LENNARD_JONES_CORE = 0.8f;
+// The well depth the Settings toggle and headless --lennard-jones 1 use.
+const float LENNARD_JONES_DEPTH = 2.0f;
+
+// Neighbour list entries a build may hold, two per pair; 1 GiB of indices.
+const size_t NEIGHBOR_LIST_MAX_PAIRS = static_cast<size_t>(1) << 28;
+
+// Whether list still holds every pair within its cutoff: it was built over
+// the same particles with the same skin, and none of them has moved half the
+// skin since, so no two can have closed the skin between them.
+bool NeighborListCurrent(NeighborList& list, const ParticleSystem& particles, float skin);
+
+// Rebuilds list from a spatial grid whose cells span the longest cutoff plus
+// the skin. Each particle counts its neighbours within its cutoff plus the
+// skin, the counts are scanned into row offsets, and a second pass writes
+// the rows in slot order, so the lists are the same at any thread count. A
+// build that would exceed NEIGHBOR_LIST_MAX_PAIRS is abandoned with 0
+// members.
+void BuildNeighborList(NeighborList& list, const ParticleSystem& particles, float skin, float width, float height);
+
+// Kicks every particle's velocity by dt times its Lennard-Jones acceleration
+// from the neighbours in list, with the given well depth and masses of
+// radius squared. The vector kernels put consecutive particles in the lanes
+// and gather a neighbour per lane, so each particle still sums its row in
+// order and matches the scalar kernel bit for bit.
+void ApplyLennardJones(const NeighborList& list, ParticleSystem& particles, float depth);
+
+// Rebuilds particles.neighbors if they are stale and applies the force,
+// profiled as separate stages and counted into the profiler's neighbour
+// counters.
+void UpdateShortRangeForces(ParticleSystem& particles, float width, float height);
+
+#endif
@@ -0,0 +1,171 @@
+#include "particle_order.h"
+#include "frame_profiler.h"
+#include "morton_order.h"
+#include "particle_system.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+// Bits of each axis in the sort keys: a 1024 x 1024 grid, finer than the
+// particle spacing below about a million particles, and three radix passes.
+static const unsigned REORDER_AXIS_BITS = 10;
+
+template <typename T>
+static void GatherSlots(T* to, const T* from, const uint32_t* order, size_t count) {
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) to[i] = from[order[i]];
+    });
+}
+
+// Particle arrays are gathered into scratch and swapped with it, so they all
+// keep the capacity ParticleSystem::Reserve gave them.
+template <typename T>
+static void PermuteArray(AlignedArray<T>& array, AlignedArray<T>& scratch, const uint32_t* order, size_t count) {
+    if (scratch.Capacity() != array.Capacity()) scratch.Reallocate(array.Capacity(), 0);
+    GatherSlots(scratch.Data(), array.Data(), order, count);
+    std::swap(array, scratch);
+}
+
+// Principle state is gathered into scratch and copied back, since it may
+// live inside a larger pool.
+template <typename T>
+static void PermuteInPlace(T* data, AlignedArray<T>& scratch, const uint32_t* order, size_t count) {
+    if (scratch.Capacity() < count) scratch.Reallocate(count, 0);
+    GatherSlots(scratch.Data(), data, order, count);
+    const T* sorted = scratch.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        std::memcpy(data + begin, sorted + begin, (end - begin) * sizeof(T));
+    });
+}
+
+float MeasureParticleScatter(ParticleSystem& particles) {
+    ParticleOrder& order = particles.order;
+    const size_t count = particles.Size();
+    if (count < 2) return 0.0f;
+    const size_t pairs = count - 1;
+    const size_t chunks = (pairs + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (order.chunkFar.Capacity() < chunks) {
+        order.chunkFar.Reallocate(chunks, 0);
+        order.chunkBounds.Reallocate(4 * chunks, 0);
+    }
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    uint32_t* chunkFar = order.chunkFar.Data();
+    float* chunkBounds = order.chunkBounds.Data();
+    // Chunks start on multiples of the stride, so the samples are the same at
+    // any thread count.
+    ParallelFor(pairs, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float bounds[4] = {x[begin], x[begin], y[begin], y[begin]};
+        for (size_t i = begin; i < end; i += REORDER_SAMPLE_STRIDE) {
+            bounds[0] = std::min(bounds[0], x[i]);
+            bounds[1] = std::max(bounds[1], x[i]);
+            bounds[2] = std::min(bounds[2], y[i]);
+            bounds[3] = std::max(bounds[3], y[i]);
+        }
+        std::memcpy(chunkBounds + 4 * (begin / PARALLEL_CHUNK_SIZE), bounds, sizeof(bounds));
+    });
+    float bounds[4] = {chunkBounds[0], chunkBounds[1], chunkBounds[2], chunkBounds[3]};
+    for (size_t chunk = 1; chunk < chunks; chunk++) {
+        bounds[0] = std::min(bounds[0], chunkBounds[4 * chunk]);
+        bounds[1] = std::max(bounds[1], chunkBounds[4 * chunk + 1]);
+        bounds[2] = std::min(bounds[2], chunkBounds[4 * chunk + 2]);
+        bounds[3] = std::max(bounds[3], chunkBounds[4 * chunk + 3]);
+    }
+    const double area = std::max(1.0, static_cast<double>(bounds[1] - bounds[0]) * (bounds[3] - bounds[2]));
+    const float near = static_cast<float>(REORDER_NEAR_SPACINGS * std::sqrt(area / count));
+    const float nearSquared = near * near;
+    ParallelFor(pairs, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        uint32_t far = 0;
+        for (size_t i = begin; i < end; i += REORDER_SAMPLE_STRIDE) {
+            const float dx = x[i + 1] - x[i];
+            const float dy = y[i + 1] - y[i];
+            far += dx * dx + dy * dy > nearSquared;
+        }
+        chunkFar[begin / PARALLEL_CHUNK_SIZE] = far;
+    });
+    size_t far = 0;
+    for (size_t chunk = 0; chunk < chunks; chunk++) far += chunkFar[chunk];
+    const size_t samples = (pairs - 1) / REORDER_SAMPLE_STRIDE + 1;
+    return static_cast<float>(far) / static_cast<float>(samples);
+}
+
+void ReorderParticles(ParticleSystem& particles, float width, float height) {
+    ParticleOrder& order = particles.order;
+    const size_t count = particles.Size();
+    if (order.keys.Capacity() < count) {
+        const size_t capacity = GrownCapacity(order.keys.Capacity(), count);
+        order.keys.Reallocate(capacity, 0);
+        order.order.Reallocate(capacity, 0);
+    }
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    uint32_t* keys = order.keys.Data();
+    uint32_t* slots = order.order.Data();
+    const float cells = static_cast<float>(1u << REORDER_AXIS_BITS);
+    const float scale = cells / std::max(std::max(width, height), 1.0f);
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float column = std::fmin(std::fmax(x[i] * scale, 0.0f), cells - 1.0f);
+            const float row = std::fmin(std::fmax(y[i] * scale, 0.0f), cells - 1.0f);
+            keys[i] = MortonKey(static_cast<uint32_t>(column), static_cast<uint32_t>(row));
+            slots[i] = static_cast<uint32_t>(i);
+        }
+    });
+    RadixSortPairs(keys, slots, count, 2 * REORDER_AXIS_BITS, order.sort);
+
+    PermuteArray(particles.x, order.floats, slots, count);
+    PermuteArray(particles.y, order.floats, slots, count);
+    PermuteArray(particles.vx, order.floats, slots, count);
+    PermuteArray(particles.vy, order.floats, slots, count);
+    PermuteArray(particles.radius, order.floats, slots, count);
+    PermuteArray(particles.color, order.colors, slots, count);
+    PermuteArray(particles.id, order.words, slots, count);
+
+    EntanglementGroups& groups = particles.entanglement;
+    if (groups.members == count) {
+        PermuteInPlace(groups.group.Data(), order.words, slots, count);
+        PermuteInPlace(groups.offsetX.Data(), order.floats, slots, count);
+        PermuteInPlace(groups.offsetY.Data(), order.floats, slots, count);
+    }
+    SuperpositionState& superposition = particles.superposition;
+    if (superposition.members == count) {
+        for (size_t plane = 0; plane < 2 * superposition.basis; plane++) {
+            PermuteInPlace(superposition.amplitudes.Data() + plane * superposition.stride, order.floats, slots, count);
+        }
+    }
+    LyapunovState& lyapunov = particles.lyapunov;
+    if (lyapunov.members == count) {
+        AlignedArray<float>* const tangents[] = {&lyapunov.dx, &lyapunov.dy, &lyapunov.dvx, &lyapunov.dvy, &lyapunov.logGrowth};
+        for (AlignedArray<float>* array : tangents) PermuteInPlace(array->Data(), order.floats, slots, count);
+    }
+    particles.neighbors.members = 0;
+
+    order.members = count;
+    order.sortedStep = particles.step;
+    order.scatter = MeasureParticleScatter(particles);
+    order.sortedScatter = order.scatter;
+    order.sorts++;
+}
+
+void UpdateParticleOrder(ParticleSystem& particles, float width, float height) {
+    ParticleOrder& order = particles.order;
+    const size_t count = particles.Size();
+    if (count < 2 || (order.members == count && particles.step < order.nextCheck)) return;
+    ScopedProfile profile(PROFILE_REORDER);
+    if (order.members == count) {
+        order.checks++;
+        order.scatter = MeasureParticleScatter(particles);
+        if (order.scatter <= order.sortedScatter + REORDER_SCATTER_GROWTH) {
+            order.interval = std::min(2 * order.interval, REORDER_MAX_INTERVAL);
+            order.nextCheck = particles.step + order.interval;
+            return;
+        }
+        order.interval = std::min(std::max((particles.step - order.sortedStep) / 2, REORDER_MIN_INTERVAL), REORDER_MAX_INTERVAL);
+    } else {
+        order.interval = REORDER_MIN_INTERVAL;
+    }
+    ReorderParticles(particles, width, height);
+    order.nextCheck = particles.step + order.interval;
+}
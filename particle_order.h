@@ -0,0 +1,76 @@
+#ifndef PARTICLE_ORDER_H
+#define PARTICLE_ORDER_H
+
+#include "raylib.h"
+#include "aligned_array.h"
+#include "morton_order.h"
+#include <cstddef>
+#include <cstdint>
+
+class ParticleSystem;
+
+// Morton-order re-sorting of the particle arrays, so particles near each
+// other on screen stay near each other in memory. Scatter is the share of
+// sampled neighbours in memory that are several mean particle spacings apart.
+struct ParticleOrder {
+    // Per slot: its Morton key, then the slot it is gathered from.
+    AlignedArray<uint32_t> keys;
+    AlignedArray<uint32_t> order;
+    RadixSortScratch sort;
+    // Gather targets, swapped with the particle arrays they reorder or
+    // copied back into the principle state.
+    AlignedArray<float> floats;
+    AlignedArray<uint32_t> words;
+    AlignedArray<Color> colors;
+    // Per chunk: the smallest and largest sampled x and y, and its scattered
+    // samples.
+    AlignedArray<float> chunkBounds;
+    AlignedArray<uint32_t> chunkFar;
+    // Particles at the last sort, 0 before the first.
+    size_t members = 0;
+    // Scatter at the last check, and right after the last sort.
+    float scatter = 0.0f;
+    float sortedScatter = 0.0f;
+    // Step of the last sort, the step of the next check and the steps
+    // between checks.
+    uint64_t sortedStep = 0;
+    uint64_t nextCheck = 0;
+    uint64_t interval = 0;
+    uint64_t checks = 0;
+    uint64_t sorts = 0;
+};
+
+// Bounds on the steps between locality checks.
+const uint64_t REORDER_MIN_INTERVAL = 16;
+const uint64_t REORDER_MAX_INTERVAL = 1024;
+// Neighbours in memory further apart than this many mean particle spacings
+// count as scattered.
+const double REORDER_NEAR_SPACINGS = 4.0;
+// A check re-sorts once this much more of the sampled pairs are scattered
+// than right after the last sort.
+const float REORDER_SCATTER_GROWTH = 0.25f;
+// Scatter is measured on one memory neighbour pair in this many, a quarter
+// of the cache lines of x and y.
+const size_t REORDER_SAMPLE_STRIDE = 64;
+
+// The share of sampled pairs of particles i and i + 1 that are scattered,
+// against the mean spacing sqrt(area / count) over the sampled bounding box:
+// a few percent after a sort and nearly all in random order. Depends only on
+// the particles, not on the thread count.
+float MeasureParticleScatter(ParticleSystem& particles);
+
+// Sorts the particles by the Morton key of their position on a 1024 x 1024
+// grid of square cells over the domain: RadixSortPairs orders the slots by
+// key, then every per-particle array, ids included, is gathered into that
+// order, along with the entanglement offsets, superposition amplitudes and
+// Lyapunov tangents if they are built for these particles. The neighbour
+// lists are dropped, to be rebuilt over the new slots.
+void ReorderParticles(ParticleSystem& particles, float width, float height);
+
+// Re-sorts the particles if they changed count since the last sort, or if a
+// check is due and finds the scatter has grown by REORDER_SCATTER_GROWTH.
+// Checks that find the order still holding double the interval to the
+// next; a re-sort sets it to half the steps the last order lasted.
+void UpdateParticleOrder(ParticleSystem& particles, float width, float height);
+
+#endif
@@ -0,0 +1,275 @@
+#include "particle_renderer.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// GLSL 330 to match raylib's desktop OpenGL 3.3 context. The per-instance
+// matrix is only a carrier: column 0 holds (x, y, radius) and column 1 the
+// normalized colour.
+static const char* circleVertexShader = R"(#version 330
+in vec3 vertexPosition;
+in mat4 instanceTransform;
+uniform mat4 mvp;
+out vec2 fragCorner;
+out vec4 fragColor;
+void main() {
+    vec4 body = instanceTransform[0];
+    fragCorner = vertexPosition.xy;
+    fragColor = instanceTransform[1];
+    gl_Position = mvp * vec4(body.xy + vertexPosition.xy * body.z, 0.0, 1.0);
+}
+)";
+
+static const char* circleFragmentShader = R"(#version 330
+in vec2 fragCorner;
+in vec4 fragColor;
+out vec4 finalColor;
+void main() {
+    float distance = length(fragCorner);
+    float edge = fwidth(distance);
+    float coverage = 1.0 - smoothstep(1.0 - edge, 1.0, distance);
+    if (coverage <= 0.0) discard;
+    finalColor = vec4(fragColor.rgb, fragColor.a * coverage);
+}
+)";
+
+static const char* lineVertexShader = R"(#version 330
+in vec3 vertexPosition;
+in mat4 instanceTransform;
+uniform mat4 mvp;
+uniform float halfWidth;
+void main() {
+    vec4 segment = instanceTransform[0];
+    vec2 direction = segment.zw - segment.xy;
+    float len = length(direction);
+    vec2 normal = len > 0.0 ? vec2(-direction.y, direction.x) / len : vec2(0.0, 1.0);
+    vec2 position = mix(segment.xy, segment.zw, vertexPosition.x) + normal * vertexPosition.y * halfWidth;
+    gl_Position = mvp * vec4(position, 0.0, 1.0);
+}
+)";
+
+static const char* lineFragmentShader = R"(#version 330
+uniform vec4 colDiffuse;
+out vec4 finalColor;
+void main() {
+    finalColor = colDiffuse;
+}
+)";
+
+// Both batches draw a four-corner quad mesh; the corner order keeps the two
+// triangles front-facing under raylib's y-down 2D projection.
+static Mesh LoadQuadMesh(const float corners[12]) {
+    static const unsigned short indices[] = {0, 1, 2, 0, 2, 3};
+    Mesh quad = Mesh{};
+    quad.vertexCount = 4;
+    quad.triangleCount = 2;
+    quad.vertices = static_cast<float*>(MemAlloc(12 * sizeof(float)));
+    quad.indices = static_cast<unsigned short*>(MemAlloc(sizeof(indices)));
+    std::memcpy(quad.vertices, corners, 12 * sizeof(float));
+    std::memcpy(quad.indices, indices, sizeof(indices));
+    UploadMesh(&quad, false);
+    return quad;
+}
+
+// A failed compile hands back raylib's default shader, which has no
+// instanceTransform attribute; its shared locs must not be touched.
+static bool LoadInstancedMaterial(const char* vertexShader, const char* fragmentShader, Material& material) {
+    Shader shader = LoadShaderFromMemory(vertexShader, fragmentShader);
+    int instanceLocation = GetShaderLocationAttrib(shader, "instanceTransform");
+    if (!IsShaderValid(shader) || instanceLocation == -1) {
+        UnloadShader(shader);
+        return false;
+    }
+    shader.locs[SHADER_LOC_MATRIX_MODEL] = instanceLocation;
+    material = LoadMaterialDefault();
+    material.shader = shader;
+    return true;
+}
+
+ParticleRenderer::ParticleRenderer() : quad_(), material_(), loaded_(false) {}
+
+void ParticleRenderer::Load() {
+    if (loaded_) return;
+    static const float corners[] = {-1, -1, 0, -1, 1, 0, 1, 1, 0, 1, -1, 0};
+    quad_ = LoadQuadMesh(corners);
+    loaded_ = LoadInstancedMaterial(circleVertexShader, circleFragmentShader, material_);
+    if (!loaded_) {
+        UnloadMesh(quad_);
+        TraceLog(LOG_WARNING, "ParticleRenderer: circle shader unavailable, using immediate-mode circles");
+    }
+}
+
+void ParticleRenderer::Unload() {
+    if (!loaded_) return;
+    UnloadMaterial(material_);
+    UnloadMesh(quad_);
+    std::vector<Matrix>().swap(instances_);
+    loaded_ = false;
+}
+
+void ParticleRenderer::DrawCircles(const ParticleSystem& particles, float radiusOffset, const Color* colors) {
+    const size_t count = particles.Size();
+    if (colors == nullptr) colors = particles.color.Data();
+    if (!loaded_) {
+        for (size_t i = 0; i < count; i++) {
+            DrawCircleV({particles.x[i], particles.y[i]}, particles.radius[i] + radiusOffset, colors[i]);
+        }
+        return;
+    }
+    if (count == 0) return;
+    if (instances_.size() < count) instances_.resize(count);
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    const float* radius = particles.radius.Data();
+    Matrix* instances = instances_.data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Matrix& m = instances[i];
+            m.m0 = x[i];
+            m.m1 = y[i];
+            m.m2 = radius[i] + radiusOffset;
+            m.m3 = 0.0f;
+            m.m4 = colors[i].r / 255.0f;
+            m.m5 = colors[i].g / 255.0f;
+            m.m6 = colors[i].b / 255.0f;
+            m.m7 = colors[i].a / 255.0f;
+        }
+    });
+    DrawMeshInstanced(quad_, material_, instances, static_cast<int>(count));
+}
+
+LineBatch::LineBatch() : segment_(), material_(), halfWidthLocation_(-1), loaded_(false) {}
+
+void LineBatch::Load() {
+    if (loaded_) return;
+    static const float corners[] = {0, -1, 0, 0, 1, 0, 1, 1, 0, 1, -1, 0};
+    segment_ = LoadQuadMesh(corners);
+    loaded_ = LoadInstancedMaterial(lineVertexShader, lineFragmentShader, material_);
+    if (!loaded_) {
+        UnloadMesh(segment_);
+        TraceLog(LOG_WARNING, "LineBatch: line shader unavailable, using immediate-mode lines");
+        return;
+    }
+    halfWidthLocation_ = GetShaderLocation(material_.shader, "halfWidth");
+}
+
+void LineBatch::Unload() {
+    if (!loaded_) return;
+    UnloadMaterial(material_);
+    UnloadMesh(segment_);
+    std::vector<Matrix>().swap(instances_);
+    loaded_ = false;
+}
+
+void LineBatch::DrawTethers(const ParticleSystem& particles, Vector2 target, Color color, float width) {
+    Submit(particles, nullptr, nullptr, target, color, width);
+}
+
+void LineBatch::DrawSegments(const ParticleSystem& particles, const float* endX, const float* endY, Color color, float width) {
+    Submit(particles, endX, endY, {0, 0}, color, width);
+}
+
+void LineBatch::Submit(const ParticleSystem& particles, const float* endX, const float* endY, Vector2 target, Color color, float width) {
+    const size_t count = particles.Size();
+    if (!loaded_) {
+        for (size_t i = 0; i < count; i++) {
+            Vector2 end = endX ? Vector2{endX[i], endY[i]} : target;
+            DrawLineV({particles.x[i], particles.y[i]}, end, color);
+        }
+        return;
+    }
+    if (count == 0) return;
+    if (instances_.size() < count) instances_.resize(count);
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    Matrix* instances = instances_.data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            Matrix& m = instances[i];
+            m.m0 = x[i];
+            m.m1 = y[i];
+            m.m2 = endX ? endX[i] : target.x;
+            m.m3 = endY ? endY[i] : target.y;
+        }
+    });
+    float halfWidth = width * 0.5f;
+    SetShaderValue(material_.shader, halfWidthLocation_, &halfWidth, SHADER_UNIFORM_FLOAT);
+    material_.maps[MATERIAL_MAP_DIFFUSE].color = color;
+    DrawMeshInstanced(segment_, material_, instances, static_cast<int>(count));
+}
+
+DensityRenderer::DensityRenderer() : texture_(), loaded_(false) {}
+
+void DensityRenderer::Load(int imageWidth, int imageHeight) {
+    if (loaded_) return;
+    splat_.Resize(imageWidth, imageHeight);
+    Image blank = GenImageColor(imageWidth, imageHeight, BLACK);
+    texture_ = LoadTextureFromImage(blank);
+    UnloadImage(blank);
+    loaded_ = IsTextureValid(texture_);
+    if (!loaded_) TraceLog(LOG_WARNING, "DensityRenderer: could not create the density texture");
+}
+
+void DensityRenderer::Unload() {
+    if (!loaded_) return;
+    UnloadTexture(texture_);
+    loaded_ = false;
+}
+
+void DensityRenderer::Draw(const ParticleSystem& particles, int domainWidth, int domainHeight) {
+    if (!loaded_) return;
+    splat_.Render(particles, static_cast<float>(domainWidth), static_cast<float>(domainHeight));
+    UpdateTexture(texture_, splat_.Pixels());
+    Rectangle source = {0, 0, static_cast<float>(texture_.width), static_cast<float>(texture_.height)};
+    Rectangle dest = {0, 0, static_cast<float>(domainWidth), static_cast<float>(domainHeight)};
+    DrawTexturePro(texture_, source, dest, {0, 0}, 0.0f, WHITE);
+}
+
+WaveRenderer::WaveRenderer() : texture_(), size_(0) {
+    // Dark blue through cyan to white; the square root in Draw lifts the faint
+    // fringes so the interference pattern reads at a glance.
+    for (int k = 0; k < 256; k++) {
+        float v = k / 255.0f;
+        palette_[k] = {static_cast<unsigned char>(255.0f * v * v), static_cast<unsigned char>(230.0f * v),
+                       static_cast<unsigned char>(40.0f + 215.0f * std::sqrt(v)), 255};
+    }
+}
+
+void WaveRenderer::Unload() {
+    if (size_ == 0) return;
+    UnloadTexture(texture_);
+    size_ = 0;
+}
+
+void WaveRenderer::Draw(const WaveField& field, int domainWidth, int domainHeight) {
+    const size_t n = field.Size();
+    if (n == 0) return;
+    if (n != size_) {
+        Unload();
+        Image blank = GenImageColor(static_cast<int>(n), static_cast<int>(n), BLACK);
+        texture_ = LoadTextureFromImage(blank);
+        UnloadImage(blank);
+        if (!IsTextureValid(texture_)) {
+            TraceLog(LOG_WARNING, "WaveRenderer: could not create the wave texture");
+            return;
+        }
+        pixels_.Reallocate(n * n, 0);
+        size_ = n;
+    }
+    const float* density = field.Density();
+    const float* mask = field.Mask();
+    const float scale = field.DensityPeak() > 0.0f ? 1.0f / field.DensityPeak() : 0.0f;
+    const Color wall = {90, 90, 90, 255};
+    Color* pixels = pixels_.Data();
+    ParallelFor(n * n, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float level = std::sqrt(std::min(density[i] * scale, 1.0f));
+            pixels[i] = mask[i] == 0.0f ? wall : palette_[static_cast<int>(level * 255.0f)];
+        }
+    });
+    UpdateTexture(texture_, pixels);
+    Rectangle source = {0, 0, static_cast<float>(n), static_cast<float>(n)};
+    Rectangle dest = {0, 0, static_cast<float>(domainWidth), static_cast<float>(domainHeight)};
+    DrawTexturePro(texture_, source, dest, {0, 0}, 0.0f, WHITE);
+}
@@ -0,0 +1,92 @@
+#ifndef PARTICLE_RENDERER_H
+#define PARTICLE_RENDERER_H
+
+#include "raylib.h"
+#include "particle_system.h"
+#include "density_splat.h"
+#include "wave_field.h"
+#include <vector>
+
+// Draws every particle as one instanced quad whose circle is cut out in the
+// fragment shader, so the CPU cost per particle is filling one instance record
+// instead of tessellating a circle through the immediate-mode batch.
+class ParticleRenderer {
+public:
+    ParticleRenderer();
+
+    // Needs a live GL context: call after InitWindow and before CloseWindow.
+    void Load();
+    void Unload();
+    bool IsReady() const { return loaded_; }
+
+    // colors may be null to use the particles' own colours.
+    void DrawCircles(const ParticleSystem& particles, float radiusOffset, const Color* colors);
+
+private:
+    Mesh quad_;
+    Material material_;
+    std::vector<Matrix> instances_;
+    bool loaded_;
+};
+
+// One instanced draw for a line per particle, either to a shared point (the
+// centre tethers) or to a per-particle endpoint (the velocity trails).
+class LineBatch {
+public:
+    LineBatch();
+
+    void Load();
+    void Unload();
+    bool IsReady() const { return loaded_; }
+
+    void DrawTethers(const ParticleSystem& particles, Vector2 target, Color color, float width);
+    void DrawSegments(const ParticleSystem& particles, const float* endX, const float* endY, Color color, float width);
+
+private:
+    void Submit(const ParticleSystem& particles, const float* endX, const float* endY, Vector2 target, Color color, float width);
+
+    Mesh segment_;
+    Material material_;
+    int halfWidthLocation_;
+    std::vector<Matrix> instances_;
+    bool loaded_;
+};
+
+// Uploads a DensitySplat image into one texture per frame and stretches it
+// over the domain.
+class DensityRenderer {
+public:
+    DensityRenderer();
+
+    // imageWidth/imageHeight set the splat resolution; the texture is drawn
+    // scaled to the domain size passed to Draw.
+    void Load(int imageWidth, int imageHeight);
+    void Unload();
+    bool IsReady() const { return loaded_; }
+
+    void Draw(const ParticleSystem& particles, int domainWidth, int domainHeight);
+
+private:
+    DensitySplat splat_;
+    Texture2D texture_;
+    bool loaded_;
+};
+
+// Shows a WaveField's |psi|^2 as one texture stretched over the domain, with
+// the slit barrier in grey. The texture follows the grid size and is created
+// on first draw.
+class WaveRenderer {
+public:
+    WaveRenderer();
+
+    void Unload();
+    void Draw(const WaveField& field, int domainWidth, int domainHeight);
+
+private:
+    Texture2D texture_;
+    AlignedArray<Color> pixels_;
+    Color palette_[256];
+    size_t size_;
+};
+
+#endif
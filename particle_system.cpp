@@ -0,0 +1,249 @@
+#include "particle_system.h"
+#include "barnes_hut.h"
+#include "frame_profiler.h"
+#include "neighbor_list.h"
+#include "particle_order.h"
+#include "principle_kernels.h"
+#include "simd_kernels.h"
+#include "spatial_grid.h"
+#include "thread_pool.h"
+#include "rng.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+void ParticleSystem::Reserve(size_t capacity) {
+    capacity = PaddedCapacity(capacity);
+    if (capacity <= Capacity()) return;
+    x.Reallocate(capacity, count_);
+    y.Reallocate(capacity, count_);
+    vx.Reallocate(capacity, count_);
+    vy.Reallocate(capacity, count_);
+    radius.Reallocate(capacity, count_);
+    color.Reallocate(capacity, count_);
+    id.Reallocate(capacity, count_);
+}
+
+void ParticleSystem::Resize(size_t count) {
+    Reserve(count);
+    count_ = count;
+}
+
+void ParticleSystem::PushBack(const Particle& particle) {
+    if (count_ == Capacity()) Reserve(count_ < PARTICLE_LANE_PADDING ? PARTICLE_LANE_PADDING : count_ * 2);
+    Set(count_, particle);
+    id[count_] = nextId++;
+    count_++;
+}
+
+void GenerateParticles(ParticleSystem& particles, size_t first, size_t count, int screenWidth, int screenHeight) {
+    float* x = particles.x.Data();
+    float* y = particles.y.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    float* radius = particles.radius.Data();
+    Color* color = particles.color.Data();
+    uint32_t* id = particles.id.Data();
+    if (first == 0) particles.nextId = 0;
+    const uint32_t firstId = particles.nextId - static_cast<uint32_t>(first);
+    const RandomStream motion = MakeRandomStream(particles.seed, RNG_STREAM_SPAWN_MOTION, 0);
+    const RandomStream look = MakeRandomStream(particles.seed, RNG_STREAM_SPAWN_LOOK, 0);
+    const float width = static_cast<float>(screenWidth);
+    const float height = static_cast<float>(screenHeight);
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float u[4][RNG_BATCH_SIZE];
+        uint32_t bits[4][RNG_BATCH_SIZE];
+        for (size_t batch = first + begin; batch < first + end; batch += RNG_BATCH_SIZE) {
+            size_t n = first + end - batch < RNG_BATCH_SIZE ? first + end - batch : RNG_BATCH_SIZE;
+            FillUniform(motion, batch, n, u[0], u[1], u[2], u[3]);
+            FillRandomBits(look, batch, n, bits[0], bits[1], bits[2], bits[3]);
+            for (size_t j = 0; j < n; j++) {
+                x[batch + j] = std::floor(u[0][j] * width);
+                y[batch + j] = std::floor(u[1][j] * height);
+                vx[batch + j] = u[2][j] * 2.0f - 1.0f;
+                vy[batch + j] = u[3][j] * 2.0f - 1.0f;
+                color[batch + j] = BitsToColor(bits[0][j]);
+                radius[batch + j] = static_cast<float>(BitsBelow(bits[1][j], 5) + 5);
+                id[batch + j] = firstId + static_cast<uint32_t>(batch + j);
+            }
+        }
+    });
+    particles.nextId += static_cast<uint32_t>(count);
+}
+
+void ResizeParticles(ParticleSystem& particles, size_t count, int screenWidth, int screenHeight) {
+    const size_t previous = particles.Size();
+    if (count < previous) {
+        // The ids are 0 to previous - 1 in some order. Keeping the particles
+        // with ids below count, in slot order, keeps the ones a shrink
+        // without re-sorting would, wherever the sort has put them.
+        uint32_t* id = particles.id.Data();
+        size_t kept = 0;
+        for (size_t i = 0; i < previous; i++) {
+            if (id[i] >= count) continue;
+            if (kept != i) {
+                particles.Set(kept, particles.Get(i));
+                id[kept] = id[i];
+            }
+            kept++;
+        }
+        particles.nextId = static_cast<uint32_t>(count);
+    }
+    particles.Resize(count);
+    if (count > previous) {
+        GenerateParticles(particles, previous, count - previous, screenWidth, screenHeight);
+    }
+}
+
+void PrepareParticleFeatures(const ParticleSystem& particles, ParticleFeatures& features) {
+    const size_t count = particles.Size();
+    if (features.trailX.Capacity() < particles.Capacity()) {
+        features.trailX.Reallocate(particles.Capacity(), 0);
+        features.trailY.Reallocate(particles.Capacity(), 0);
+        features.glow.Reallocate(particles.Capacity(), 0);
+    }
+    features.count = count;
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    const float* vx = particles.vx.Data();
+    const float* vy = particles.vy.Data();
+    const Color* color = particles.color.Data();
+    float* trailX = features.trailX.Data();
+    float* trailY = features.trailY.Data();
+    Color* glow = features.glow.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            trailX[i] = x[i] - vx[i] * 10;
+            trailY[i] = y[i] - vy[i] * 10;
+            glow[i] = {color[i].r, color[i].g, color[i].b, static_cast<unsigned char>(255.0f * 0.3f)};
+        }
+    });
+}
+
+void UpdateParticles(ParticleSystem& particles, int screenWidth, int screenHeight) {
+    float* x = particles.x.Data();
+    float* y = particles.y.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    const float dt = particles.dt;
+    const float width = static_cast<float>(screenWidth);
+    const float height = static_cast<float>(screenHeight);
+    ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        IntegrateAndReflect(x + begin, y + begin, vx + begin, vy + begin, end - begin, dt, width, height);
+    });
+}
+
+// A constant pull of 0.05 px/frame^2 towards the centre of the screen.
+struct CentreAttraction {
+    static const bool active = true;
+    float centerX;
+    float centerY;
+    void operator()(float x, float y, float& ax, float& ay) const {
+        const float dx = centerX - x;
+        const float dy = centerY - y;
+        const float distance = std::sqrt(dx * dx + dy * dy);
+        ax = distance > 0 ? dx / distance * 0.05f : 0.0f;
+        ay = distance > 0 ? dy / distance * 0.05f : 0.0f;
+    }
+};
+
+// The centre attraction plus the pull of the other particles, which is
+// computed once per step at the particle's starting position and held fixed
+// while the integrator samples the attraction.
+struct CentreAndPairForce {
+    static const bool active = true;
+    CentreAttraction centre;
+    float pairX;
+    float pairY;
+    void operator()(float x, float y, float& ax, float& ay) const {
+        centre(x, y, ax, ay);
+        ax += pairX;
+        ay += pairY;
+    }
+};
+
+template <Integrator I>
+static void UpdateInteractiveRange(ParticleSystem& particles, const CentreAttraction& attraction, const float* pairX, const float* pairY,
+                                   const RandomStream& stream, size_t begin, size_t end, int screenWidth, int screenHeight) {
+    float* x = particles.x.Data();
+    float* y = particles.y.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    Color* color = particles.color.Data();
+    const uint32_t* id = particles.id.Data();
+    const float dt = particles.dt;
+    for (size_t i = begin; i < end; i++) {
+        if (pairX) {
+            const CentreAndPairForce force = {attraction, pairX[i], pairY[i]};
+            IntegratorStep<I>::Apply(x[i], y[i], vx[i], vy[i], dt, force);
+        } else {
+            IntegratorStep<I>::Apply(x[i], y[i], vx[i], vy[i], dt, attraction);
+        }
+        bool hitX = x[i] <= 0 || x[i] >= screenWidth;
+        bool hitY = y[i] <= 0 || y[i] >= screenHeight;
+        if (hitX) {
+            vx[i] *= -1;
+        }
+        if (hitY) {
+            vy[i] *= -1;
+        }
+        if (hitX || hitY) {
+            uint32_t words[4];
+            RandomWords(stream, id[i], words);
+            color[i] = BitsToColor(words[hitY ? 1 : 0]);
+        }
+    }
+}
+
+void UpdateInteractiveParticles(ParticleSystem& particles, int screenWidth, int screenHeight) {
+    if (particles.reorder) UpdateParticleOrder(particles, static_cast<float>(screenWidth), static_cast<float>(screenHeight));
+    const CentreAttraction attraction = {static_cast<float>(screenWidth / 2), static_cast<float>(screenHeight / 2)};
+    const RandomStream stream = MakeRandomStream(particles.seed, RNG_STREAM_INTERACTIVE, particles.step++);
+    const Integrator integrator = particles.integrator;
+    const float* pairX = nullptr;
+    const float* pairY = nullptr;
+    if (particles.pairForce != 0.0f) {
+        ScopedProfile profile(PROFILE_PAIR_FORCES);
+        BuildQuadTree(particles.tree, particles);
+        ComputePairAcceleration(particles.tree, particles.pairForce, particles.theta);
+        pairX = particles.tree.ax.Data();
+        pairY = particles.tree.ay.Data();
+    }
+    ParallelFor(particles.Size(), PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        switch (integrator) {
+            case INTEGRATOR_EULER: UpdateInteractiveRange<INTEGRATOR_EULER>(particles, attraction, pairX, pairY, stream, begin, end, screenWidth, screenHeight); break;
+            case INTEGRATOR_VELOCITY_VERLET: UpdateInteractiveRange<INTEGRATOR_VELOCITY_VERLET>(particles, attraction, pairX, pairY, stream, begin, end, screenWidth, screenHeight); break;
+            case INTEGRATOR_RK4: UpdateInteractiveRange<INTEGRATOR_RK4>(particles, attraction, pairX, pairY, stream, begin, end, screenWidth, screenHeight); break;
+            default: UpdateInteractiveRange<INTEGRATOR_SEMI_IMPLICIT_EULER>(particles, attraction, pairX, pairY, stream, begin, end, screenWidth, screenHeight); break;
+        }
+    });
+}
+
+void UpdateParticlesByPrinciple(ParticleSystem& particles, QuantumPrinciple principle, int screenWidth, int screenHeight) {
+    if (particles.reorder) UpdateParticleOrder(particles, static_cast<float>(screenWidth), static_cast<float>(screenHeight));
+    PrincipleStep step;
+    step.x = particles.x.Data();
+    step.y = particles.y.Data();
+    step.vx = particles.vx.Data();
+    step.vy = particles.vy.Data();
+    step.color = particles.color.Data();
+    step.id = particles.id.Data();
+    step.count = particles.Size();
+    step.width = static_cast<float>(screenWidth);
+    step.height = static_cast<float>(screenHeight);
+    step.stream = MakeRandomStream(particles.seed, RNG_STREAM_PRINCIPLE, particles.step++);
+    step.groups = &particles.entanglement;
+    step.superposition = &particles.superposition;
+    step.uncertainty = &particles.uncertainty;
+    step.lyapunov = &particles.lyapunov;
+    step.seed = particles.seed;
+    step.dt = particles.dt;
+    step.integrator = particles.integrator;
+    {
+        ScopedProfile profile(ProfileKernelStage(principle));
+        PRINCIPLE_KERNELS[principle](step);
+    }
+    if (particles.pairForce != 0.0f) UpdatePairForces(particles);
+    if (particles.lennardJones != 0.0f) UpdateShortRangeForces(particles, step.width, step.height);
+    if (particles.collisions) CollideParticles(particles, step.width, step.height);
+}
@@ -0,0 +1,130 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include "raylib.h"
+#include "aligned_array.h"
+#include "barnes_hut.h"
+#include "entanglement.h"
+#include "integrators.h"
+#include "lyapunov.h"
+#include "neighbor_list.h"
+#include "particle_order.h"
+#include "principles.h"
+#include "spatial_grid.h"
+#include "superposition.h"
+#include "uncertainty.h"
+#include <cstddef>
+#include <cstdint>
+
+struct Particle {
+    Vector2 position;
+    Vector2 velocity;
+    Color color;
+    float radius;
+};
+
+const size_t MAX_PARTICLE_COUNT = 10000000;
+
+// Structure-of-arrays particle store. Position and velocity live in their own
+// arrays so the update kernels only stream the 16 bytes per particle they touch.
+class ParticleSystem {
+public:
+    ParticleSystem() : seed(0), step(0), dt(1.0f), integrator(INTEGRATOR_SEMI_IMPLICIT_EULER), collisions(false), pairForce(0.0f),
+                       theta(0.5f), lennardJones(0.0f), skin(6.0f), reorder(false), nextId(0), count_(0) {}
+
+    size_t Size() const { return count_; }
+    size_t Capacity() const { return x.Capacity(); }
+    bool Empty() const { return count_ == 0; }
+
+    void Reserve(size_t capacity);
+    // Grows or shrinks the live range without touching the new slots. Use
+    // ResizeParticles to fill them; growing within Capacity() never reallocates.
+    void Resize(size_t count);
+    void Clear() { count_ = 0; }
+    void PushBack(const Particle& particle);
+
+    Particle Get(size_t i) const {
+        return {{x[i], y[i]}, {vx[i], vy[i]}, color[i], radius[i]};
+    }
+    void Set(size_t i, const Particle& particle) {
+        x[i] = particle.position.x;
+        y[i] = particle.position.y;
+        vx[i] = particle.velocity.x;
+        vy[i] = particle.velocity.y;
+        color[i] = particle.color;
+        radius[i] = particle.radius;
+    }
+    Particle operator[](size_t i) const { return Get(i); }
+
+    AlignedArray<float> x;
+    AlignedArray<float> y;
+    AlignedArray<float> vx;
+    AlignedArray<float> vy;
+    AlignedArray<float> radius;
+    AlignedArray<Color> color;
+    // Each particle's identity, which stays with it when the arrays are
+    // re-sorted. Anything that follows a particle across steps, or derives
+    // a fixed property of it from the seed, keys on the id, not the slot.
+    AlignedArray<uint32_t> id;
+
+    EntanglementGroups entanglement;
+    SuperpositionState superposition;
+    UncertaintyState uncertainty;
+    LyapunovState lyapunov;
+    SpatialGrid grid;
+    QuadTree tree;
+    NeighborList neighbors;
+    ParticleOrder order;
+
+    uint64_t seed;
+    uint64_t step;
+    // Frames of simulated time each update advances, and how it integrates.
+    float dt;
+    Integrator integrator;
+    // Whether updates end with elastic collisions between the circles.
+    bool collisions;
+    // Strength of the pull every particle exerts on every other in the
+    // interactive update, negative to repel and 0 for none, and the
+    // Barnes-Hut opening angle that approximates it.
+    float pairForce;
+    float theta;
+    // Depth of the Lennard-Jones well between every two circles, 0 for no
+    // short-range force, and the skin in px its neighbour lists are built
+    // with.
+    float lennardJones;
+    float skin;
+    // Whether updates first re-sort the particles by Morton key whenever
+    // their locality has decayed.
+    bool reorder;
+    // The id the next generated particle gets; generating from slot 0
+    // starts again at 0, so the ids are always 0 to Size() - 1.
+    uint32_t nextId;
+
+private:
+    size_t count_;
+};
+
+// Whether the Lyapunov tangents follow the motion: they linearize the CHAOS
+// force and the walls only, so with pair forces, Lennard-Jones or collisions
+// on, the exponent they give is not that of the particles.
+inline bool LyapunovTracksParticles(const ParticleSystem& particles) {
+    return particles.pairForce == 0.0f && particles.lennardJones == 0.0f && !particles.collisions;
+}
+
+// Per-frame draw data derived from the particle state: the faded glow colour and
+// the far end of the velocity trail.
+struct ParticleFeatures {
+    AlignedArray<float> trailX;
+    AlignedArray<float> trailY;
+    AlignedArray<Color> glow;
+    size_t count = 0;
+};
+
+void PrepareParticleFeatures(const ParticleSystem& particles, ParticleFeatures& features);
+void GenerateParticles(ParticleSystem& particles, size_t first, size_t count, int screenWidth, int screenHeight);
+void ResizeParticles(ParticleSystem& particles, size_t count, int screenWidth, int screenHeight);
+void UpdateParticles(ParticleSystem& particles, int screenWidth, int screenHeight);
+void UpdateInteractiveParticles(ParticleSystem& particles, int screenWidth, int screenHeight);
+void UpdateParticlesByPrinciple(ParticleSystem& particles, QuantumPrinciple principle, int screenWidth, int screenHeight);
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef PRINCIPLE_KERNELS_H
+#define PRINCIPLE_KERNELS_H
+
+#include "entanglement.h"
+#include "integrators.h"
+#include "lyapunov.h"
+#include "particle_system.h"
+#include "rng.h"
+#include "superposition.h"
+#include "uncertainty.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include "wave_field.h"
+#include <cmath>
+
+struct PrincipleStep {
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    Color* color;
+    const uint32_t* id;
+    size_t count;
+    float width;
+    float height;
+    RandomStream stream;
+    EntanglementGroups* groups;
+    SuperpositionState* superposition;
+    UncertaintyState* uncertainty;
+    LyapunovState* lyapunov;
+    uint64_t seed;
+    // Frames of simulated time this step advances.
+    float dt;
+    Integrator integrator;
+};
+
+inline Color BitsToColor(uint32_t bits) {
+    return {static_cast<unsigned char>(bits), static_cast<unsigned char>(bits >> 8), static_cast<unsigned char>(bits >> 16), 255};
+}
+
+// One specialization per QuantumPrinciple. Each provides
+//   integrate      whether the sweep integrates and reflects after Apply
+//   Force          the acceleration the integrator applies (NoForce: drift)
+//   Prepare(step)  serial work done once before the parallel sweep
+//   Apply(step, first, n)  the principle's effect on one RNG_BATCH_SIZE slice
+//   Measure(step, first, n)  reads a slice back after it has moved
+//   Finish(step)   serial work done once after the sweep
+// The sweep integrates, reflects and measures each slice while it is still
+// in L1. Apply's velocity changes are impulses, so rates and kicks scale with
+// step.dt; smooth forces belong in Force, where the integrator sees them.
+template <QuantumPrinciple P>
+struct PrincipleKernel;
+
+template <>
+struct PrincipleKernel<SUPERPOSITION> {
+    static const bool integrate = true;
+    typedef NoForce Force;
+    static void Prepare(const PrincipleStep& step) {
+        SuperpositionState& state = *step.superposition;
+        if (state.members != step.count || state.seed != step.seed) BuildSuperposition(state, step.id, step.count, step.seed);
+        if (state.dt != step.dt) SetSuperpositionTimestep(state, step.dt);
+    }
+    // Evolves every amplitude, then measures a few particles: each collapses
+    // onto one of its basis positions with probability |c_k|^2, and its state
+    // onto that basis state, to spread out again as it evolves.
+    static void Apply(const PrincipleStep& step, size_t first, size_t n) {
+        SuperpositionState& state = *step.superposition;
+        EvolveSuperposition(state, first, n);
+        const float rate = SUPERPOSITION_MEASURE_RATE * step.dt;
+        float u[4][RNG_BATCH_SIZE];
+        FillUniformById(step.stream, step.id + first, n, u[0], u[1], u[2], u[3]);
+        float* x = step.x + first;
+        float* y = step.y + first;
+        for (size_t j = 0; j < n; j++) {
+            if (u[0][j] >= rate) continue;
+            const size_t k = SampleSuperpositionBasis(state, first + j, u[1][j]);
+            CollapseSuperposition(state, first + j, k);
+            const Vector2 position = SuperpositionBasisPosition(state, step.id[first + j], k, step.width, step.height);
+            x[j] = position.x;
+            y[j] = position.y;
+        }
+    }
+    static void Measure(const PrincipleStep&, size_t, size_t) {}
+    static void Finish(const PrincipleStep&) {}
+};
+
+template <>
+struct PrincipleKernel<UNCERTAINTY> {
+    static const bool integrate = true;
+    typedef NoForce Force;
+    static void Prepare(const PrincipleStep& step) {
+        PrepareUncertainty(*step.uncertainty, step.count, step.seed, step.stream.step, step.dt, step.width, step.height);
+    }
+    // A launch replaces every particle with a sample of the new packet; in
+    // between they fly free and the packet spreads.
+    static void Apply(const PrincipleStep& step, size_t first, size_t n) {
+        if (step.uncertainty->launching) LaunchWavePackets(*step.uncertainty, step.id, step.x, step.y, step.vx, step.vy, first, n);
+    }
+    static void Measure(const PrincipleStep& step, size_t first, size_t n) {
+        MeasureUncertainty(*step.uncertainty, step.x, step.y, step.vx, step.vy, first, n);
+    }
+    static void Finish(const PrincipleStep& step) {
+        FinishUncertainty(*step.uncertainty);
+    }
+};
+
+template <>
+struct PrincipleKernel<ENTANGLEMENT> {
+    static const bool integrate = false;
+    typedef NoForce Force;
+    // Shared state is advanced once per group; members only gather it.
+    static void Prepare(const PrincipleStep& step) {
+        EntanglementGroups& groups = *step.groups;
+        if (groups.members != step.count) BuildEntanglementGroups(groups, step.id, step.count, step.seed, step.width, step.height);
+        AdvanceEntanglementGroups(groups, step.dt, step.width, step.height);
+    }
+    static void Apply(const PrincipleStep& step, size_t first, size_t n) {
+        ScatterEntanglementGroups(*step.groups, step.x, step.y, step.vx, step.vy, first, n);
+    }
+    static void Measure(const PrincipleStep&, size_t, size_t) {}
+    static void Finish(const PrincipleStep&) {}
+};
+
+template <>
+struct PrincipleKernel<WAVE_PARTICLE_DUALITY> {
+    static const bool integrate = true;
+    typedef NoForce Force;
+    static void Prepare(const PrincipleStep& step) {
+        WaveField& field = GetWaveField();
+        if (field.Size() == 0) field.Resize(WAVE_GRID_DEFAULT);
+        if (field.Advance(step.dt)) field.UpdateDensity();
+    }
+    // Detected particles land where |psi|^2 puts them and stay there, so the
+    // detections build up the interference pattern.
+    static void Apply(const PrincipleStep& step, size_t first, size_t n) {
+        const WaveField& field = GetWaveField();
+        const float scaleX = step.width / static_cast<float>(field.Size());
+        const float scaleY = step.height / static_cast<float>(field.Size());
+        const float rate = WAVE_DETECT_RATE * step.dt;
+        float u[4][RNG_BATCH_SIZE];
+        FillUniformById(step.stream, step.id + first, n, u[0], u[1], u[2], u[3]);
+        float* x = step.x + first;
+        float* y = step.y + first;
+        float* vx = step.vx + first;
+        float* vy = step.vy + first;
+        for (size_t j = 0; j < n; j++) {
+            if (u[0][j] >= rate) continue;
+            const Vector2 cell = field.Sample(u[1][j], u[2][j]);
+            x[j] = cell.x * scaleX;
+            y[j] = cell.y * scaleY;
+            vx[j] = 0.0f;
+            vy[j] = 0.0f;
+        }
+    }
+    static void Measure(const PrincipleStep&, size_t, size_t) {}
+    static void Finish(const PrincipleStep&) {}
+};
+
+template <>
+struct PrincipleKernel<CHAOS> {
+    static const bool integrate = true;
+    typedef SawtoothForceField Force;
+    static void Prepare(const PrincipleStep& step) {
+        PrepareLyapunov(*step.lyapunov, step.id, step.count, step.seed, step.stream.step, step.dt, step.integrator);
+    }
+    // Random kicks on top of the sawtooth force. They make a random walk in
+    // velocity, so they scale with sqrt(dt) to diffuse at the same rate
+    // whatever the step.
+    static void Apply(const PrincipleStep& step, size_t first, size_t n) {
+        const float kick = 0.5f * std::sqrt(step.dt);
+        uint32_t bits[4][RNG_BATCH_SIZE];
+        FillRandomBitsById(step.stream, step.id + first, n, bits[0], bits[1], bits[2], bits[3]);
+        float* vx = step.vx + first;
+        float* vy = step.vy + first;
+        Color* color = step.color + first;
+        for (size_t j = 0; j < n; j++) {
+            vx[j] += (BitsToUniform(bits[0][j]) * 2.0f - 1.0f) * kick;
+            vy[j] += (BitsToUniform(bits[1][j]) * 2.0f - 1.0f) * kick;
+            color[j] = BitsToColor(bits[2][j]);
+        }
+    }
+    // Each particle carries a tangent vector along with it; its growth rate is
+    // the largest Lyapunov exponent.
+    static void Measure(const PrincipleStep& step, size_t first, size_t n) {
+        AdvanceTangents(*step.lyapunov, step.x, step.y, first, n, step.width, step.height);
+    }
+    static void Finish(const PrincipleStep& step) {
+        FinishLyapunov(*step.lyapunov);
+    }
+};
+
+template <QuantumPrinciple P>
+void UpdatePrincipleRange(const PrincipleStep& step, size_t begin, size_t end) {
+    for (size_t first = begin; first < end; first += RNG_BATCH_SIZE) {
+        const size_t n = end - first < RNG_BATCH_SIZE ? end - first : RNG_BATCH_SIZE;
+        PrincipleKernel<P>::Apply(step, first, n);
+        if (PrincipleKernel<P>::integrate) {
+            StepAndReflect(step.integrator, step.x + first, step.y + first, step.vx + first, step.vy + first, n, step.dt, step.width,
+                           step.height, typename PrincipleKernel<P>::Force());
+        }
+        PrincipleKernel<P>::Measure(step, first, n);
+    }
+}
+
+template <QuantumPrinciple P>
+void RunPrincipleKernel(const PrincipleStep& step) {
+    if (step.count == 0) return;
+    PrincipleKernel<P>::Prepare(step);
+    ParallelFor(step.count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        UpdatePrincipleRange<P>(step, begin, end);
+    });
+    PrincipleKernel<P>::Finish(step);
+}
+
+typedef void (*PrincipleKernelFn)(const PrincipleStep& step);
+
+static const PrincipleKernelFn PRINCIPLE_KERNELS[] = {
+#define QUANTUM_PRINCIPLE_KERNEL(id, key, name, description, equation) &RunPrincipleKernel<id>,
+    QUANTUM_PRINCIPLE_LIST(QUANTUM_PRINCIPLE_KERNEL)
+#undef QUANTUM_PRINCIPLE_KERNEL
+};
+
+#endif
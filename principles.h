@@ -0,0 +1,38 @@
+#ifndef PRINCIPLES_H
+#define PRINCIPLES_H
+
+// Every quantum principle is registered here once. The list drives the enum,
+// the per-principle kernel dispatch table, the command-line names and the
+// principle panels shown in the simulation view. Adding a principle means
+// adding a row here and a PrincipleKernel specialization in principle_kernels.h.
+//
+//  X(enumerator, command-line key, display name, description, equation)
+#define QUANTUM_PRINCIPLE_LIST(X) \
+    X(SUPERPOSITION, "superposition", "Superposition", "A particle can exist in multiple states simultaneously.", "‎ psi = sum c_n |n>") \
+    X(UNCERTAINTY, "uncertainty", "Uncertainty Principle", "You cannot simultaneously know the exact position and momentum of a particle.", "‎ dx * dp >= h / (4*pi)") \
+    X(ENTANGLEMENT, "entanglement", "Entanglement", "Particles can be correlated regardless of distance.", "No specific equation") \
+    X(WAVE_PARTICLE_DUALITY, "wave", "Wave-Particle Duality", "Particles exhibit both wave and particle properties.", "‎ lambda = h / p") \
+    X(CHAOS, "chaos", "Chaos", "Particles move chaotically with random velocity and color changes.", "‎ |d(t)| = |d(0)| e^(lambda t)")
+
+enum QuantumPrinciple {
+#define QUANTUM_PRINCIPLE_ENUM(id, key, name, description, equation) id,
+    QUANTUM_PRINCIPLE_LIST(QUANTUM_PRINCIPLE_ENUM)
+#undef QUANTUM_PRINCIPLE_ENUM
+    QUANTUM_PRINCIPLE_COUNT
+};
+
+struct PrincipleInfo {
+    QuantumPrinciple type;
+    const char* key;
+    const char* name;
+    const char* description;
+    const char* equation;
+};
+
+static const PrincipleInfo PRINCIPLE_TABLE[] = {
+#define QUANTUM_PRINCIPLE_INFO(id, key, name, description, equation) {id, key, name, description, equation},
+    QUANTUM_PRINCIPLE_LIST(QUANTUM_PRINCIPLE_INFO)
+#undef QUANTUM_PRINCIPLE_INFO
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "rng.h"
+#include "fast_log.h"
+#include "simd_kernels.h"
+#include <cmath>
+
+static const uint32_t PHILOX_M0 = 0xD2511F53u;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57u;
+static const uint32_t PHILOX_W0 = 0x9E3779B9u;
+static const uint32_t PHILOX_W1 = 0xBB67AE85u;
+
+// Box-Muller constants. The sine/cosine, like the log, are short polynomials
+// rather than libm calls so the vector paths can evaluate them too; every path
+// does the same operations in the same order and gives bit-identical numbers.
+static const float SIN_C3 = -1.0f / 6.0f;
+static const float SIN_C5 = 1.0f / 120.0f;
+static const float SIN_C7 = -1.0f / 5040.0f;
+static const float SIN_C9 = 1.0f / 362880.0f;
+static const float COS_C2 = -0.5f;
+static const float COS_C4 = 1.0f / 24.0f;
+static const float COS_C6 = -1.0f / 720.0f;
+static const float COS_C8 = 1.0f / 40320.0f;
+// A quarter turn per 2^22 steps of the 24-bit angle.
+static const float ANGLE_SCALE = 1.57079632679f / 4194304.0f;
+
+// The fills below count from firstIndex, or, given ids, use id[i] as the
+// counter of slot i.
+static void FillRandomBitsScalar(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1,
+                                 uint32_t* out2, uint32_t* out3) {
+    const uint32_t stepLo = static_cast<uint32_t>(stream.step);
+    const uint32_t stepHi = static_cast<uint32_t>(stream.step >> 32);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t index = id ? id[i] : firstIndex + i;
+        uint32_t words[4] = {static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32), stepLo, stepHi};
+        Philox4x32(words, stream.key);
+        out0[i] = words[0];
+        out1[i] = words[1];
+        out2[i] = words[2];
+        out3[i] = words[3];
+    }
+}
+
+// Two standard normals from two words: the radius from the top 24 bits of
+// one, the angle from the top 24 bits of the other, reduced to the nearest
+// quarter turn so the polynomials only see [-pi/4, pi/4).
+static void GaussianPair(uint32_t radiusBits, uint32_t angleBits, float& cosine, float& sine) {
+    const float u = static_cast<float>(16777216 - static_cast<int32_t>(radiusBits >> 8)) * (1.0f / 16777216.0f);
+    const float radius = std::sqrt(-2.0f * LogPositive(u));
+    const int32_t angle = static_cast<int32_t>(angleBits >> 8);
+    const int32_t quadrant = (angle + 0x200000) >> 22;
+    const float r = static_cast<float>(angle - (quadrant << 22)) * ANGLE_SCALE;
+    const float z = r * r;
+    const float s = r + r * (z * (SIN_C3 + z * (SIN_C5 + z * (SIN_C7 + z * SIN_C9))));
+    const float c = 1.0f + z * (COS_C2 + z * (COS_C4 + z * (COS_C6 + z * COS_C8)));
+    float sinValue = quadrant & 1 ? c : s;
+    float cosValue = quadrant & 1 ? s : c;
+    if (quadrant & 2) sinValue = -sinValue;
+    if ((quadrant + 1) & 2) cosValue = -cosValue;
+    cosine = radius * cosValue;
+    sine = radius * sinValue;
+}
+
+static void GaussianFromBitsScalar(const uint32_t* radiusBits, const uint32_t* angleBits, float* cosine, float* sine, size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) GaussianPair(radiusBits[i], angleBits[i], cosine[i], sine[i]);
+}
+
+#ifdef QPS_X86_SIMD
+
+// Philox's 32 x 32 -> 64 bit products, high and low halves, for every lane.
+// The multiply only reads even lanes, so odd lanes take a second multiply.
+__attribute__((target("avx2")))
+static inline void MulHiLoAvx2(__m256i a, __m256i m, __m256i& hi, __m256i& lo) {
+    const __m256i even = _mm256_mul_epu32(a, m);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+static size_t FillRandomBitsAvx2(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1,
+                                 uint32_t* out2, uint32_t* out3) {
+    const __m256i m0 = _mm256_set1_epi32(static_cast<int>(PHILOX_M0));
+    const __m256i m1 = _mm256_set1_epi32(static_cast<int>(PHILOX_M1));
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i stepLo = _mm256_set1_epi32(static_cast<int>(stream.step));
+    const __m256i stepHi = _mm256_set1_epi32(static_cast<int>(stream.step >> 32));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i c0, c1;
+        if (id) {
+            c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(id + i));
+            c1 = _mm256_setzero_si256();
+        } else {
+            const uint64_t index = firstIndex + i;
+            // The high word must be the same for all eight counters.
+            if ((index >> 32) != ((index + 7) >> 32)) break;
+            c0 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(index)), lanes);
+            c1 = _mm256_set1_epi32(static_cast<int>(index >> 32));
+        }
+        __m256i c2 = stepLo;
+        __m256i c3 = stepHi;
+        uint32_t k0 = stream.key[0];
+        uint32_t k1 = stream.key[1];
+        for (int round = 0; round < 10; round++) {
+            __m256i hi0, lo0, hi1, lo1;
+            MulHiLoAvx2(c0, m0, hi0, lo0);
+            MulHiLoAvx2(c2, m1, hi1, lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(static_cast<int>(k0)));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(static_cast<int>(k1)));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out0 + i), c0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out1 + i), c1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out2 + i), c2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out3 + i), c3);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t GaussianFromBitsAvx2(const uint32_t* radiusBits, const uint32_t* angleBits, float* cosine, float* sine, size_t count) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i signBit = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i rBits = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(radiusBits + i)), 8);
+        const __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_set1_epi32(16777216), rBits)), _mm256_set1_ps(1.0f / 16777216.0f));
+        const __m256 radius = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(-2.0f), LogPositiveAvx2(u)));
+
+        const __m256i angle = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(angleBits + i)), 8);
+        const __m256i quadrant = _mm256_srai_epi32(_mm256_add_epi32(angle, _mm256_set1_epi32(0x200000)), 22);
+        const __m256 r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(angle, _mm256_slli_epi32(quadrant, 22))), _mm256_set1_ps(ANGLE_SCALE));
+        const __m256 rz = _mm256_mul_ps(r, r);
+        __m256 sinPoly = _mm256_add_ps(_mm256_set1_ps(SIN_C7), _mm256_mul_ps(rz, _mm256_set1_ps(SIN_C9)));
+        sinPoly = _mm256_add_ps(_mm256_set1_ps(SIN_C5), _mm256_mul_ps(rz, sinPoly));
+        sinPoly = _mm256_add_ps(_mm256_set1_ps(SIN_C3), _mm256_mul_ps(rz, sinPoly));
+        const __m256 sn = _mm256_add_ps(r, _mm256_mul_ps(r, _mm256_mul_ps(rz, sinPoly)));
+        __m256 cosPoly = _mm256_add_ps(_mm256_set1_ps(COS_C6), _mm256_mul_ps(rz, _mm256_set1_ps(COS_C8)));
+        cosPoly = _mm256_add_ps(_mm256_set1_ps(COS_C4), _mm256_mul_ps(rz, cosPoly));
+        cosPoly = _mm256_add_ps(_mm256_set1_ps(COS_C2), _mm256_mul_ps(rz, cosPoly));
+        const __m256 cs = _mm256_add_ps(one, _mm256_mul_ps(rz, cosPoly));
+        const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+        const __m256 sinSign = _mm256_castsi256_ps(_mm256_and_si256(_mm256_slli_epi32(quadrant, 30), signBit));
+        const __m256 cosSign = _mm256_castsi256_ps(_mm256_and_si256(_mm256_slli_epi32(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), 30), signBit));
+        const __m256 sinValue = _mm256_xor_ps(_mm256_blendv_ps(sn, cs, swap), sinSign);
+        const __m256 cosValue = _mm256_xor_ps(_mm256_blendv_ps(cs, sn, swap), cosSign);
+        _mm256_storeu_ps(cosine + i, _mm256_mul_ps(radius, cosValue));
+        _mm256_storeu_ps(sine + i, _mm256_mul_ps(radius, sinValue));
+    }
+    return i;
+}
+
+// GCC 12's AVX-512 shift and convert intrinsics start from a self-initialized
+// "undefined" vector and warn about it once inlined; the value is never read.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline void MulHiLoAvx512(__m512i a, __m512i m, __m512i& hi, __m512i& lo) {
+    const __m512i even = _mm512_mul_epu32(a, m);
+    const __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), m);
+    lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_slli_epi64(odd, 32));
+    hi = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, 32), odd);
+}
+
+__attribute__((target("avx512f")))
+static size_t FillRandomBitsAvx512(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1,
+                                   uint32_t* out2, uint32_t* out3) {
+    const __m512i m0 = _mm512_set1_epi32(static_cast<int>(PHILOX_M0));
+    const __m512i m1 = _mm512_set1_epi32(static_cast<int>(PHILOX_M1));
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i stepLo = _mm512_set1_epi32(static_cast<int>(stream.step));
+    const __m512i stepHi = _mm512_set1_epi32(static_cast<int>(stream.step >> 32));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i c0, c1;
+        if (id) {
+            c0 = _mm512_loadu_si512(id + i);
+            c1 = _mm512_setzero_si512();
+        } else {
+            const uint64_t index = firstIndex + i;
+            if ((index >> 32) != ((index + 15) >> 32)) break;
+            c0 = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(index)), lanes);
+            c1 = _mm512_set1_epi32(static_cast<int>(index >> 32));
+        }
+        __m512i c2 = stepLo;
+        __m512i c3 = stepHi;
+        uint32_t k0 = stream.key[0];
+        uint32_t k1 = stream.key[1];
+        for (int round = 0; round < 10; round++) {
+            __m512i hi0, lo0, hi1, lo1;
+            MulHiLoAvx512(c0, m0, hi0, lo0);
+            MulHiLoAvx512(c2, m1, hi1, lo1);
+            c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), _mm512_set1_epi32(static_cast<int>(k0)));
+            c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), _mm512_set1_epi32(static_cast<int>(k1)));
+            c1 = lo1;
+            c3 = lo0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm512_storeu_si512(out0 + i, c0);
+        _mm512_storeu_si512(out1 + i, c1);
+        _mm512_storeu_si512(out2 + i, c2);
+        _mm512_storeu_si512(out3 + i, c3);
+    }
+    return i;
+}
+
+QPS_AVX512_TARGET
+static size_t GaussianFromBitsAvx512(const uint32_t* radiusBits, const uint32_t* angleBits, float* cosine, float* sine, size_t count) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512i signBit = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i rBits = _mm512_srli_epi32(_mm512_loadu_si512(radiusBits + i), 8);
+        const __m512 u = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_set1_epi32(16777216), rBits)), _mm512_set1_ps(1.0f / 16777216.0f));
+        const __m512 radius = _mm512_sqrt_ps(_mm512_mul_ps(_mm512_set1_ps(-2.0f), LogPositiveAvx512(u)));
+
+        const __m512i angle = _mm512_srli_epi32(_mm512_loadu_si512(angleBits + i), 8);
+        const __m512i quadrant = _mm512_srai_epi32(_mm512_add_epi32(angle, _mm512_set1_epi32(0x200000)), 22);
+        const __m512 r = _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(angle, _mm512_slli_epi32(quadrant, 22))), _mm512_set1_ps(ANGLE_SCALE));
+        const __m512 rz = _mm512_mul_ps(r, r);
+        __m512 sinPoly = _mm512_add_ps(_mm512_set1_ps(SIN_C7), _mm512_mul_ps(rz, _mm512_set1_ps(SIN_C9)));
+        sinPoly = _mm512_add_ps(_mm512_set1_ps(SIN_C5), _mm512_mul_ps(rz, sinPoly));
+        sinPoly = _mm512_add_ps(_mm512_set1_ps(SIN_C3), _mm512_mul_ps(rz, sinPoly));
+        const __m512 sn = _mm512_add_ps(r, _mm512_mul_ps(r, _mm512_mul_ps(rz, sinPoly)));
+        __m512 cosPoly = _mm512_add_ps(_mm512_set1_ps(COS_C6), _mm512_mul_ps(rz, _mm512_set1_ps(COS_C8)));
+        cosPoly = _mm512_add_ps(_mm512_set1_ps(COS_C4), _mm512_mul_ps(rz, cosPoly));
+        cosPoly = _mm512_add_ps(_mm512_set1_ps(COS_C2), _mm512_mul_ps(rz, cosPoly));
+        const __m512 cs = _mm512_add_ps(one, _mm512_mul_ps(rz, cosPoly));
+        const __mmask16 swap = _mm512_test_epi32_mask(quadrant, _mm512_set1_epi32(1));
+        const __m512i sinSign = _mm512_and_si512(_mm512_slli_epi32(quadrant, 30), signBit);
+        const __m512i cosSign = _mm512_and_si512(_mm512_slli_epi32(_mm512_add_epi32(quadrant, _mm512_set1_epi32(1)), 30), signBit);
+        const __m512 sinValue = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, sn, cs)), sinSign));
+        const __m512 cosValue = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(_mm512_mask_blend_ps(swap, cs, sn)), cosSign));
+        _mm512_storeu_ps(cosine + i, _mm512_mul_ps(radius, cosValue));
+        _mm512_storeu_ps(sine + i, _mm512_mul_ps(radius, sinValue));
+    }
+    return i;
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+static void FillRandomBits(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1,
+                           uint32_t* out2, uint32_t* out3) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = FillRandomBitsAvx512(stream, firstIndex, id, count, out0, out1, out2, out3);
+    } else if (level == SIMD_AVX2) {
+        done = FillRandomBitsAvx2(stream, firstIndex, id, count, out0, out1, out2, out3);
+    }
+#else
+    (void)level;
+#endif
+    FillRandomBitsScalar(stream, firstIndex + done, id ? id + done : nullptr, count - done, out0 + done, out1 + done, out2 + done, out3 + done);
+}
+
+static void FillUniform(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, float* out0, float* out1, float* out2,
+                        float* out3) {
+    uint32_t bits[4][RNG_BATCH_SIZE];
+    for (size_t done = 0; done < count; done += RNG_BATCH_SIZE) {
+        size_t n = count - done < RNG_BATCH_SIZE ? count - done : RNG_BATCH_SIZE;
+        FillRandomBits(stream, firstIndex + done, id ? id + done : nullptr, n, bits[0], bits[1], bits[2], bits[3]);
+        for (size_t i = 0; i < n; i++) {
+            out0[done + i] = BitsToUniform(bits[0][i]);
+            out1[done + i] = BitsToUniform(bits[1][i]);
+            out2[done + i] = BitsToUniform(bits[2][i]);
+            out3[done + i] = BitsToUniform(bits[3][i]);
+        }
+    }
+}
+
+static void GaussianFromBits(const uint32_t* radiusBits, const uint32_t* angleBits, float* cosine, float* sine, size_t count) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = GaussianFromBitsAvx512(radiusBits, angleBits, cosine, sine, count);
+    } else if (level == SIMD_AVX2) {
+        done = GaussianFromBitsAvx2(radiusBits, angleBits, cosine, sine, count);
+    }
+#else
+    (void)level;
+#endif
+    GaussianFromBitsScalar(radiusBits, angleBits, cosine, sine, done, count - done);
+}
+
+static void FillGaussian(const RandomStream& stream, size_t firstIndex, const uint32_t* id, size_t count, float* out0, float* out1, float* out2,
+                         float* out3) {
+    uint32_t bits[4][RNG_BATCH_SIZE];
+    for (size_t done = 0; done < count; done += RNG_BATCH_SIZE) {
+        size_t n = count - done < RNG_BATCH_SIZE ? count - done : RNG_BATCH_SIZE;
+        FillRandomBits(stream, firstIndex + done, id ? id + done : nullptr, n, bits[0], bits[1], bits[2], bits[3]);
+        GaussianFromBits(bits[0], bits[1], out0 + done, out1 + done, n);
+        GaussianFromBits(bits[2], bits[3], out2 + done, out3 + done, n);
+    }
+}
+
+void FillRandomBits(const RandomStream& stream, size_t firstIndex, size_t count, uint32_t* out0, uint32_t* out1, uint32_t* out2, uint32_t* out3) {
+    FillRandomBits(stream, firstIndex, nullptr, count, out0, out1, out2, out3);
+}
+
+void FillUniform(const RandomStream& stream, size_t firstIndex, size_t count, float* out0, float* out1, float* out2, float* out3) {
+    FillUniform(stream, firstIndex, nullptr, count, out0, out1, out2, out3);
+}
+
+void FillGaussian(const RandomStream& stream, size_t firstIndex, size_t count, float* out0, float* out1, float* out2, float* out3) {
+    FillGaussian(stream, firstIndex, nullptr, count, out0, out1, out2, out3);
+}
+
+void FillRandomBitsById(const RandomStream& stream, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1, uint32_t* out2, uint32_t* out3) {
+    FillRandomBits(stream, 0, id, count, out0, out1, out2, out3);
+}
+
+void FillUniformById(const RandomStream& stream, const uint32_t* id, size_t count, float* out0, float* out1, float* out2, float* out3) {
+    FillUniform(stream, 0, id, count, out0, out1, out2, out3);
+}
+
+void FillGaussianById(const RandomStream& stream, const uint32_t* id, size_t count, float* out0, float* out1, float* out2, float* out3) {
+    FillGaussian(stream, 0, id, count, out0, out1, out2, out3);
+}
@@ -0,0 +1,114 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Independent random streams. Each subsystem draws from its own id so adding
+// draws to one kernel never shifts the numbers another kernel sees.
+enum RandomStreamId {
+    RNG_STREAM_SPAWN_MOTION = 1,
+    RNG_STREAM_SPAWN_LOOK,
+    RNG_STREAM_PRINCIPLE,
+    RNG_STREAM_INTERACTIVE,
+    RNG_STREAM_QUANTUM_DODGE,
+    RNG_STREAM_MENU_RAIN,
+    RNG_STREAM_ENTANGLEMENT,
+    RNG_STREAM_SUPERPOSITION,
+    RNG_STREAM_SUPERPOSITION_BASIS,
+    RNG_STREAM_UNCERTAINTY,
+    RNG_STREAM_LYAPUNOV
+};
+
+// Philox4x32-10 counter-based generator. The counter is (particle index, step)
+// and the key is (seed, stream), so any particle's numbers for any step can be
+// produced independently and in any order.
+struct RandomStream {
+    uint32_t key[2];
+    uint64_t step;
+};
+
+const size_t RNG_BATCH_SIZE = 1024;
+
+inline RandomStream MakeRandomStream(uint64_t seed, uint32_t streamId, uint64_t step) {
+    RandomStream stream;
+    stream.key[0] = static_cast<uint32_t>(seed);
+    stream.key[1] = static_cast<uint32_t>(seed >> 32) ^ (streamId * 0x9E3779B9u);
+    stream.step = step;
+    return stream;
+}
+
+inline void Philox4x32(uint32_t counter[4], const uint32_t key[2]) {
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+        uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+        uint32_t c0 = static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ k0;
+        uint32_t c2 = static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ k1;
+        counter[0] = c0;
+        counter[1] = static_cast<uint32_t>(p1);
+        counter[2] = c2;
+        counter[3] = static_cast<uint32_t>(p0);
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+}
+
+// The four 32-bit words belonging to one particle index in one step.
+inline void RandomWords(const RandomStream& stream, uint64_t index, uint32_t out[4]) {
+    out[0] = static_cast<uint32_t>(index);
+    out[1] = static_cast<uint32_t>(index >> 32);
+    out[2] = static_cast<uint32_t>(stream.step);
+    out[3] = static_cast<uint32_t>(stream.step >> 32);
+    Philox4x32(out, stream.key);
+}
+
+// [0, 1) with 24 bits of precision.
+inline float BitsToUniform(uint32_t bits) {
+    return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// [0, n) without a division.
+inline uint32_t BitsBelow(uint32_t bits, uint32_t n) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(bits) * n) >> 32);
+}
+
+// Batch fills for particles [firstIndex, firstIndex + count). Output arrays are
+// one value per particle, laid out so the consuming loop vectorizes.
+void FillRandomBits(const RandomStream& stream, size_t firstIndex, size_t count, uint32_t* out0, uint32_t* out1, uint32_t* out2, uint32_t* out3);
+void FillUniform(const RandomStream& stream, size_t firstIndex, size_t count, float* out0, float* out1, float* out2, float* out3);
+void FillGaussian(const RandomStream& stream, size_t firstIndex, size_t count, float* out0, float* out1, float* out2, float* out3);
+
+// The same fills for the particles with ids id[0, count): each draws from the
+// counter of its id rather than of its slot, so its numbers do not change when
+// the arrays are re-sorted.
+void FillRandomBitsById(const RandomStream& stream, const uint32_t* id, size_t count, uint32_t* out0, uint32_t* out1, uint32_t* out2, uint32_t* out3);
+void FillUniformById(const RandomStream& stream, const uint32_t* id, size_t count, float* out0, float* out1, float* out2, float* out3);
+void FillGaussianById(const RandomStream& stream, const uint32_t* id, size_t count, float* out0, float* out1, float* out2, float* out3);
+
+// Sequential generator for scalar consumers such as the games. Still
+// counter-based, so a given seed replays the same sequence.
+class CounterRandom {
+public:
+    CounterRandom(uint64_t seed, uint32_t streamId) : stream_(MakeRandomStream(seed, streamId, 0)), index_(0), used_(4) {}
+
+    uint32_t Next() {
+        if (used_ == 4) {
+            RandomWords(stream_, index_++, words_);
+            used_ = 0;
+        }
+        return words_[used_++];
+    }
+    uint32_t Below(uint32_t n) { return BitsBelow(Next(), n); }
+    float Uniform() { return BitsToUniform(Next()); }
+    float Uniform(float lo, float hi) { return lo + (hi - lo) * Uniform(); }
+
+private:
+    RandomStream stream_;
+    uint64_t index_;
+    uint32_t words_[4];
+    int used_;
+};
+
+#endif
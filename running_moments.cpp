@@ -0,0 +1,24 @@
+#include "running_moments.h"
+#include <cmath>
+
+void MergeMoments(RunningMoments& into, const RunningMoments& other) {
+    if (other.count == 0) return;
+    const double count = into.count + other.count;
+    const double delta = other.mean - into.mean;
+    into.mean += delta * other.count / count;
+    into.m2 += other.m2 + delta * delta * into.count * other.count / count;
+    into.count = count;
+}
+
+RunningMoments SumsToMoments(const DeviationSums& sums, float shift) {
+    RunningMoments moments;
+    if (sums.count == 0) return moments;
+    moments.count = sums.count;
+    moments.mean = shift + sums.sum / sums.count;
+    moments.m2 = std::fmax(0.0, sums.squares - sums.sum * sums.sum / sums.count);
+    return moments;
+}
+
+float MomentsDeviation(const RunningMoments& moments) {
+    return moments.count > 0 ? static_cast<float>(std::sqrt(moments.m2 / moments.count)) : 0.0f;
+}
@@ -0,0 +1,27 @@
+#ifndef RUNNING_MOMENTS_H
+#define RUNNING_MOMENTS_H
+
+// Count, mean and summed squared deviation of one measured quantity. Moments of
+// any split of a sample merge into those of the whole (Welford's update in
+// the pairwise form of Chan et al.).
+struct RunningMoments {
+    double count = 0;
+    double mean = 0;
+    double m2 = 0;
+};
+
+// Sums of deviations from a fixed shift, the cheap per-slice form of moments.
+struct DeviationSums {
+    double count = 0;
+    double sum = 0;
+    double squares = 0;
+};
+
+// Folds other into into; either may be empty.
+void MergeMoments(RunningMoments& into, const RunningMoments& other);
+// Moments of values that were summed as deviations from shift.
+RunningMoments SumsToMoments(const DeviationSums& sums, float shift);
+// Standard deviation of a measured quantity, 0 before anything is measured.
+float MomentsDeviation(const RunningMoments& moments);
+
+#endif
@@ -0,0 +1,436 @@
+#include "simd_kernels.h"
+#include <atomic>
+
+void IntegrateAndReflectScalar(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height) {
+    for (size_t i = 0; i < count; i++) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        if (x[i] <= 0 || x[i] >= width) {
+            vx[i] *= -1;
+        }
+        if (y[i] <= 0 || y[i] >= height) {
+            vy[i] *= -1;
+        }
+    }
+}
+
+void RotatePhaseScalar(float* re, float* im, size_t count, float c, float s) {
+    for (size_t i = 0; i < count; i++) {
+        const float r = re[i];
+        const float m = im[i];
+        re[i] = r * c - m * s;
+        im[i] = r * s + m * c;
+    }
+}
+
+void MixAmplitudesScalar(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s) {
+    for (size_t i = 0; i < count; i++) {
+        const float ra = reA[i];
+        const float ma = imA[i];
+        const float rb = reB[i];
+        const float mb = imB[i];
+        reA[i] = ra * c + mb * s;
+        imA[i] = ma * c - rb * s;
+        reB[i] = rb * c + ma * s;
+        imB[i] = mb * c - ra * s;
+    }
+}
+
+static const size_t SUM_LANES = 32;
+
+// Sums whole blocks of SUM_LANES values, one running sum per lane, then folds
+// the lanes pairwise (lane l += lane l + width, width halving). Every path
+// keeps the same lanes and folds them in the same order, so all of them give
+// the same bits; the vector paths fold in registers.
+static void SumDeviationsLanes(const float* v, size_t count, float shift, float& sum, float& sumSquares) {
+    float sums[SUM_LANES] = {};
+    float squares[SUM_LANES] = {};
+    for (size_t i = 0; i < count; i++) {
+        const float d = v[i] - shift;
+        sums[i % SUM_LANES] += d;
+        squares[i % SUM_LANES] += d * d;
+    }
+    for (size_t width = SUM_LANES / 2; width > 0; width /= 2) {
+        for (size_t l = 0; l < width; l++) {
+            sums[l] += sums[l + width];
+            squares[l] += squares[l + width];
+        }
+    }
+    sum = sums[0];
+    sumSquares = squares[0];
+}
+
+#ifdef QPS_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t IntegrateAndReflectSse2(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height) {
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 w = _mm_set1_ps(width);
+    const __m128 h = _mm_set1_ps(height);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(_mm_loadu_ps(vx + i), step));
+        __m128 py = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(vy + i), step));
+        __m128 hitX = _mm_or_ps(_mm_cmple_ps(px, zero), _mm_cmpge_ps(px, w));
+        __m128 hitY = _mm_or_ps(_mm_cmple_ps(py, zero), _mm_cmpge_ps(py, h));
+        _mm_storeu_ps(x + i, px);
+        _mm_storeu_ps(y + i, py);
+        _mm_storeu_ps(vx + i, _mm_xor_ps(_mm_loadu_ps(vx + i), _mm_and_ps(hitX, signBit)));
+        _mm_storeu_ps(vy + i, _mm_xor_ps(_mm_loadu_ps(vy + i), _mm_and_ps(hitY, signBit)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t IntegrateAndReflectAvx2(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height) {
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 w = _mm256_set1_ps(width);
+    const __m256 h = _mm256_set1_ps(height);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 velX = _mm256_loadu_ps(vx + i);
+        __m256 velY = _mm256_loadu_ps(vy + i);
+        __m256 px = _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(velX, step));
+        __m256 py = _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(velY, step));
+        __m256 hitX = _mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LE_OQ), _mm256_cmp_ps(px, w, _CMP_GE_OQ));
+        __m256 hitY = _mm256_or_ps(_mm256_cmp_ps(py, zero, _CMP_LE_OQ), _mm256_cmp_ps(py, h, _CMP_GE_OQ));
+        _mm256_storeu_ps(x + i, px);
+        _mm256_storeu_ps(y + i, py);
+        _mm256_storeu_ps(vx + i, _mm256_xor_ps(velX, _mm256_and_ps(hitX, signBit)));
+        _mm256_storeu_ps(vy + i, _mm256_xor_ps(velY, _mm256_and_ps(hitY, signBit)));
+    }
+    return i;
+}
+
+QPS_AVX512_TARGET
+static size_t IntegrateAndReflectAvx512(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height) {
+    const __m512 step = _mm512_set1_ps(dt);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i signBit = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+    const __m512 w = _mm512_set1_ps(width);
+    const __m512 h = _mm512_set1_ps(height);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 velX = _mm512_loadu_ps(vx + i);
+        __m512 velY = _mm512_loadu_ps(vy + i);
+        __m512 px = _mm512_add_ps(_mm512_loadu_ps(x + i), _mm512_mul_ps(velX, step));
+        __m512 py = _mm512_add_ps(_mm512_loadu_ps(y + i), _mm512_mul_ps(velY, step));
+        __mmask16 hitX = _mm512_cmp_ps_mask(px, zero, _CMP_LE_OQ) | _mm512_cmp_ps_mask(px, w, _CMP_GE_OQ);
+        __mmask16 hitY = _mm512_cmp_ps_mask(py, zero, _CMP_LE_OQ) | _mm512_cmp_ps_mask(py, h, _CMP_GE_OQ);
+        __m512i flippedX = _mm512_mask_xor_epi32(_mm512_castps_si512(velX), hitX, _mm512_castps_si512(velX), signBit);
+        __m512i flippedY = _mm512_mask_xor_epi32(_mm512_castps_si512(velY), hitY, _mm512_castps_si512(velY), signBit);
+        _mm512_storeu_ps(x + i, px);
+        _mm512_storeu_ps(y + i, py);
+        _mm512_storeu_ps(vx + i, _mm512_castsi512_ps(flippedX));
+        _mm512_storeu_ps(vy + i, _mm512_castsi512_ps(flippedY));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t RotatePhaseSse2(float* re, float* im, size_t count, float c, float s) {
+    const __m128 vc = _mm_set1_ps(c);
+    const __m128 vs = _mm_set1_ps(s);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 r = _mm_loadu_ps(re + i);
+        const __m128 m = _mm_loadu_ps(im + i);
+        _mm_storeu_ps(re + i, _mm_sub_ps(_mm_mul_ps(r, vc), _mm_mul_ps(m, vs)));
+        _mm_storeu_ps(im + i, _mm_add_ps(_mm_mul_ps(r, vs), _mm_mul_ps(m, vc)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t RotatePhaseAvx2(float* re, float* im, size_t count, float c, float s) {
+    const __m256 vc = _mm256_set1_ps(c);
+    const __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 r = _mm256_loadu_ps(re + i);
+        const __m256 m = _mm256_loadu_ps(im + i);
+        _mm256_storeu_ps(re + i, _mm256_sub_ps(_mm256_mul_ps(r, vc), _mm256_mul_ps(m, vs)));
+        _mm256_storeu_ps(im + i, _mm256_add_ps(_mm256_mul_ps(r, vs), _mm256_mul_ps(m, vc)));
+    }
+    return i;
+}
+
+QPS_AVX512_TARGET
+static size_t RotatePhaseAvx512(float* re, float* im, size_t count, float c, float s) {
+    const __m512 vc = _mm512_set1_ps(c);
+    const __m512 vs = _mm512_set1_ps(s);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512 r = _mm512_loadu_ps(re + i);
+        const __m512 m = _mm512_loadu_ps(im + i);
+        _mm512_storeu_ps(re + i, _mm512_sub_ps(_mm512_mul_ps(r, vc), _mm512_mul_ps(m, vs)));
+        _mm512_storeu_ps(im + i, _mm512_add_ps(_mm512_mul_ps(r, vs), _mm512_mul_ps(m, vc)));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t MixAmplitudesSse2(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s) {
+    const __m128 vc = _mm_set1_ps(c);
+    const __m128 vs = _mm_set1_ps(s);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 ra = _mm_loadu_ps(reA + i);
+        const __m128 ma = _mm_loadu_ps(imA + i);
+        const __m128 rb = _mm_loadu_ps(reB + i);
+        const __m128 mb = _mm_loadu_ps(imB + i);
+        _mm_storeu_ps(reA + i, _mm_add_ps(_mm_mul_ps(ra, vc), _mm_mul_ps(mb, vs)));
+        _mm_storeu_ps(imA + i, _mm_sub_ps(_mm_mul_ps(ma, vc), _mm_mul_ps(rb, vs)));
+        _mm_storeu_ps(reB + i, _mm_add_ps(_mm_mul_ps(rb, vc), _mm_mul_ps(ma, vs)));
+        _mm_storeu_ps(imB + i, _mm_sub_ps(_mm_mul_ps(mb, vc), _mm_mul_ps(ra, vs)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t MixAmplitudesAvx2(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s) {
+    const __m256 vc = _mm256_set1_ps(c);
+    const __m256 vs = _mm256_set1_ps(s);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 ra = _mm256_loadu_ps(reA + i);
+        const __m256 ma = _mm256_loadu_ps(imA + i);
+        const __m256 rb = _mm256_loadu_ps(reB + i);
+        const __m256 mb = _mm256_loadu_ps(imB + i);
+        _mm256_storeu_ps(reA + i, _mm256_add_ps(_mm256_mul_ps(ra, vc), _mm256_mul_ps(mb, vs)));
+        _mm256_storeu_ps(imA + i, _mm256_sub_ps(_mm256_mul_ps(ma, vc), _mm256_mul_ps(rb, vs)));
+        _mm256_storeu_ps(reB + i, _mm256_add_ps(_mm256_mul_ps(rb, vc), _mm256_mul_ps(ma, vs)));
+        _mm256_storeu_ps(imB + i, _mm256_sub_ps(_mm256_mul_ps(mb, vc), _mm256_mul_ps(ra, vs)));
+    }
+    return i;
+}
+
+QPS_AVX512_TARGET
+static size_t MixAmplitudesAvx512(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s) {
+    const __m512 vc = _mm512_set1_ps(c);
+    const __m512 vs = _mm512_set1_ps(s);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512 ra = _mm512_loadu_ps(reA + i);
+        const __m512 ma = _mm512_loadu_ps(imA + i);
+        const __m512 rb = _mm512_loadu_ps(reB + i);
+        const __m512 mb = _mm512_loadu_ps(imB + i);
+        _mm512_storeu_ps(reA + i, _mm512_add_ps(_mm512_mul_ps(ra, vc), _mm512_mul_ps(mb, vs)));
+        _mm512_storeu_ps(imA + i, _mm512_sub_ps(_mm512_mul_ps(ma, vc), _mm512_mul_ps(rb, vs)));
+        _mm512_storeu_ps(reB + i, _mm512_add_ps(_mm512_mul_ps(rb, vc), _mm512_mul_ps(ma, vs)));
+        _mm512_storeu_ps(imB + i, _mm512_sub_ps(_mm512_mul_ps(mb, vc), _mm512_mul_ps(ra, vs)));
+    }
+    return i;
+}
+
+// The last two fold steps of SumDeviationsLanes on four lanes.
+__attribute__((target("sse2")))
+static inline float FoldLanesSse2(__m128 t) {
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+}
+
+__attribute__((target("sse2")))
+static void SumDeviationsSse2(const float* v, size_t count, float shift, float& sum, float& sumSquares) {
+    const size_t lanes = SUM_LANES / 4;
+    const __m128 k = _mm_set1_ps(shift);
+    __m128 s[lanes];
+    __m128 q[lanes];
+    for (size_t l = 0; l < lanes; l++) {
+        s[l] = _mm_setzero_ps();
+        q[l] = _mm_setzero_ps();
+    }
+    for (size_t i = 0; i < count; i += SUM_LANES) {
+        for (size_t l = 0; l < lanes; l++) {
+            const __m128 d = _mm_sub_ps(_mm_loadu_ps(v + i + 4 * l), k);
+            s[l] = _mm_add_ps(s[l], d);
+            q[l] = _mm_add_ps(q[l], _mm_mul_ps(d, d));
+        }
+    }
+    for (size_t width = lanes / 2; width > 0; width /= 2) {
+        for (size_t l = 0; l < width; l++) {
+            s[l] = _mm_add_ps(s[l], s[l + width]);
+            q[l] = _mm_add_ps(q[l], q[l + width]);
+        }
+    }
+    sum = FoldLanesSse2(s[0]);
+    sumSquares = FoldLanesSse2(q[0]);
+}
+
+__attribute__((target("avx2")))
+static void SumDeviationsAvx2(const float* v, size_t count, float shift, float& sum, float& sumSquares) {
+    const size_t lanes = SUM_LANES / 8;
+    const __m256 k = _mm256_set1_ps(shift);
+    __m256 s[lanes];
+    __m256 q[lanes];
+    for (size_t l = 0; l < lanes; l++) {
+        s[l] = _mm256_setzero_ps();
+        q[l] = _mm256_setzero_ps();
+    }
+    for (size_t i = 0; i < count; i += SUM_LANES) {
+        for (size_t l = 0; l < lanes; l++) {
+            const __m256 d = _mm256_sub_ps(_mm256_loadu_ps(v + i + 8 * l), k);
+            s[l] = _mm256_add_ps(s[l], d);
+            q[l] = _mm256_add_ps(q[l], _mm256_mul_ps(d, d));
+        }
+    }
+    for (size_t width = lanes / 2; width > 0; width /= 2) {
+        for (size_t l = 0; l < width; l++) {
+            s[l] = _mm256_add_ps(s[l], s[l + width]);
+            q[l] = _mm256_add_ps(q[l], q[l + width]);
+        }
+    }
+    sum = FoldLanesSse2(_mm_add_ps(_mm256_castps256_ps128(s[0]), _mm256_extractf128_ps(s[0], 1)));
+    sumSquares = FoldLanesSse2(_mm_add_ps(_mm256_castps256_ps128(q[0]), _mm256_extractf128_ps(q[0], 1)));
+}
+
+QPS_AVX512_TARGET
+static void SumDeviationsAvx512(const float* v, size_t count, float shift, float& sum, float& sumSquares) {
+    const size_t lanes = SUM_LANES / 16;
+    const __m512 k = _mm512_set1_ps(shift);
+    __m512 s[lanes];
+    __m512 q[lanes];
+    for (size_t l = 0; l < lanes; l++) {
+        s[l] = _mm512_setzero_ps();
+        q[l] = _mm512_setzero_ps();
+    }
+    for (size_t i = 0; i < count; i += SUM_LANES) {
+        for (size_t l = 0; l < lanes; l++) {
+            const __m512 d = _mm512_sub_ps(_mm512_loadu_ps(v + i + 16 * l), k);
+            s[l] = _mm512_add_ps(s[l], d);
+            q[l] = _mm512_add_ps(q[l], _mm512_mul_ps(d, d));
+        }
+    }
+    for (size_t width = lanes / 2; width > 0; width /= 2) {
+        for (size_t l = 0; l < width; l++) {
+            s[l] = _mm512_add_ps(s[l], s[l + width]);
+            q[l] = _mm512_add_ps(q[l], q[l + width]);
+        }
+    }
+    // Zero-masking extracts: GCC 12 warns about the undefined pass-through
+    // operand of the plain extract and of the 512 to 256 bit cast.
+    const __m256 s8 = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(s[0]), 0)),
+                                    _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(s[0]), 1)));
+    const __m256 q8 = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(q[0]), 0)),
+                                    _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, _mm512_castps_pd(q[0]), 1)));
+    sum = FoldLanesSse2(_mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1)));
+    sumSquares = FoldLanesSse2(_mm_add_ps(_mm256_castps256_ps128(q8), _mm256_extractf128_ps(q8, 1)));
+}
+
+#endif
+
+SimdLevel DetectSimdLevel() {
+#ifdef QPS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+static std::atomic<int>& ActiveLevel() {
+    static std::atomic<int> level(DetectSimdLevel());
+    return level;
+}
+
+SimdLevel ActiveSimdLevel() {
+    return static_cast<SimdLevel>(ActiveLevel().load(std::memory_order_relaxed));
+}
+
+void LimitSimdLevel(SimdLevel level) {
+    ActiveLevel().store(level < DetectSimdLevel() ? level : DetectSimdLevel(), std::memory_order_relaxed);
+}
+
+const char* SimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+void IntegrateAndReflect(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height, SimdLevel level) {
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = IntegrateAndReflectAvx512(x, y, vx, vy, count, dt, width, height);
+    } else if (level == SIMD_AVX2) {
+        done = IntegrateAndReflectAvx2(x, y, vx, vy, count, dt, width, height);
+    } else if (level == SIMD_SSE2) {
+        done = IntegrateAndReflectSse2(x, y, vx, vy, count, dt, width, height);
+    }
+#else
+    (void)level;
+#endif
+    IntegrateAndReflectScalar(x + done, y + done, vx + done, vy + done, count - done, dt, width, height);
+}
+
+void IntegrateAndReflect(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height) {
+    const SimdLevel level = ActiveSimdLevel();
+    IntegrateAndReflect(x, y, vx, vy, count, dt, width, height, level);
+}
+
+void RotatePhase(float* re, float* im, size_t count, float c, float s) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = RotatePhaseAvx512(re, im, count, c, s);
+    } else if (level == SIMD_AVX2) {
+        done = RotatePhaseAvx2(re, im, count, c, s);
+    } else if (level == SIMD_SSE2) {
+        done = RotatePhaseSse2(re, im, count, c, s);
+    }
+#else
+    (void)level;
+#endif
+    RotatePhaseScalar(re + done, im + done, count - done, c, s);
+}
+
+void MixAmplitudes(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s) {
+    const SimdLevel level = ActiveSimdLevel();
+    size_t done = 0;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        done = MixAmplitudesAvx512(reA, imA, reB, imB, count, c, s);
+    } else if (level == SIMD_AVX2) {
+        done = MixAmplitudesAvx2(reA, imA, reB, imB, count, c, s);
+    } else if (level == SIMD_SSE2) {
+        done = MixAmplitudesSse2(reA, imA, reB, imB, count, c, s);
+    }
+#else
+    (void)level;
+#endif
+    MixAmplitudesScalar(reA + done, imA + done, reB + done, imB + done, count - done, c, s);
+}
+
+void SumDeviations(const float* v, size_t count, float shift, float& sum, float& sumSquares) {
+    const SimdLevel level = ActiveSimdLevel();
+    const size_t blocks = count / SUM_LANES * SUM_LANES;
+#ifdef QPS_X86_SIMD
+    if (level == SIMD_AVX512) {
+        SumDeviationsAvx512(v, blocks, shift, sum, sumSquares);
+    } else if (level == SIMD_AVX2) {
+        SumDeviationsAvx2(v, blocks, shift, sum, sumSquares);
+    } else if (level == SIMD_SSE2) {
+        SumDeviationsSse2(v, blocks, shift, sum, sumSquares);
+    } else {
+        SumDeviationsLanes(v, blocks, shift, sum, sumSquares);
+    }
+#else
+    (void)level;
+    SumDeviationsLanes(v, blocks, shift, sum, sumSquares);
+#endif
+    for (size_t i = blocks; i < count; i++) {
+        const float d = v[i] - shift;
+        sum += d;
+        sumSquares += d * d;
+    }
+}
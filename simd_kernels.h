@@ -0,0 +1,56 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+
+// GCC and Clang on x86 build every vector path into one binary, each function
+// with its own target attribute, and pick one at run time. Every path has to
+// give the scalar path's bits, so nothing may be contracted into an FMA, which
+// rounds once where the scalar code rounds twice. AVX-512 implies FMA, so its
+// functions take QPS_AVX512_TARGET, which also turns contraction off.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QPS_X86_SIMD 1
+#define QPS_AVX512_TARGET __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#include <immintrin.h>
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+SimdLevel DetectSimdLevel();
+const char* SimdLevelName(SimdLevel level);
+
+// The level every dispatching kernel runs at: the detected one, unless
+// LimitSimdLevel has held it lower so the bench can compare each path the CPU
+// supports against the scalar one.
+SimdLevel ActiveSimdLevel();
+void LimitSimdLevel(SimdLevel level);
+
+// position += velocity * dt, then flip the velocity component of every particle
+// that ends up on or past a wall. Matches the scalar `<= 0 || >= width` test bit
+// for bit.
+void IntegrateAndReflectScalar(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height);
+void IntegrateAndReflect(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height);
+void IntegrateAndReflect(float* x, float* y, float* vx, float* vy, size_t count, float dt, float width, float height, SimdLevel level);
+
+// (re + i im) *= (c + i s) for count amplitudes: one phase rotation shared by
+// the whole range. Every path rounds the same, so results match bit for bit.
+void RotatePhaseScalar(float* re, float* im, size_t count, float c, float s);
+void RotatePhase(float* re, float* im, size_t count, float c, float s);
+
+// (a, b) <- (c a - i s b, c b - i s a) for count pairs of amplitudes: a
+// rotation that moves probability between two states and keeps |a|^2 + |b|^2.
+// Every path rounds the same, so results match bit for bit.
+void MixAmplitudesScalar(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s);
+void MixAmplitudes(float* reA, float* imA, float* reB, float* imB, size_t count, float c, float s);
+
+// Sum of (v - shift) and of (v - shift)^2 over count values. With shift near
+// the mean the squares do not cancel, so a float sum over a slice is enough
+// to seed a Welford merge. All paths give the same bits.
+void SumDeviations(const float* v, size_t count, float shift, float& sum, float& sumSquares);
+
+#endif
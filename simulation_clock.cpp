@@ -0,0 +1,28 @@
+#include "simulation_clock.h"
+#include <cmath>
+
+// A frame a hair shorter than a step still runs it, borrowing the difference
+// from the next frame, so vsync jitter around a step's length does not
+// alternate between zero and two steps per frame.
+static const double SIMULATION_STEP_SLACK = 0.05;
+
+int AdvanceSimulationClock(SimulationClock& clock, double realSeconds) {
+    if (realSeconds > SIMULATION_MAX_FRAME_SECONDS) realSeconds = SIMULATION_MAX_FRAME_SECONDS;
+    if (realSeconds < 0.0) realSeconds = 0.0;
+    const double stepSeconds = 1.0 / clock.stepRate;
+    clock.accumulator += realSeconds * clock.speed;
+    int steps = static_cast<int>(std::floor(clock.accumulator / stepSeconds + SIMULATION_STEP_SLACK));
+    if (steps > SIMULATION_MAX_STEPS_PER_FRAME) {
+        steps = SIMULATION_MAX_STEPS_PER_FRAME;
+        clock.accumulator = 0.0;
+    } else {
+        clock.accumulator -= steps * stepSeconds;
+    }
+    clock.lastSteps = steps;
+    return steps;
+}
+
+void ResetSimulationClock(SimulationClock& clock) {
+    clock.accumulator = 0.0;
+    clock.lastSteps = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef SIMULATION_CLOCK_H
+#define SIMULATION_CLOCK_H
+
+#include "integrators.h"
+
+// Steps one rendered frame may run. A slower frame drops the rest of its
+// backlog, so the simulation falls behind real time instead of spending ever
+// longer frames catching up.
+const int SIMULATION_MAX_STEPS_PER_FRAME = 64;
+
+// Longest real frame the clock accounts for; a window drag or a breakpoint
+// does not turn into a burst of steps.
+const double SIMULATION_MAX_FRAME_SECONDS = 0.25;
+
+// Fixed-timestep clock. Rendered frames of any length feed an accumulator of
+// simulated time that is drained in whole physics steps, so the simulation
+// advances at the same rate whatever the frame rate and however many frames
+// were dropped.
+struct SimulationClock {
+    // Physics steps per second of simulated time.
+    float stepRate = SIMULATION_FRAME_RATE;
+    // Simulated seconds per real second.
+    float speed = 1.0f;
+    double accumulator = 0.0;
+    int lastSteps = 0;
+};
+
+// Frames of simulated time per step: the dt every kernel takes.
+inline float SimulationStepFrames(const SimulationClock& clock) {
+    return SIMULATION_FRAME_RATE / clock.stepRate;
+}
+
+// Adds a real frame of realSeconds and returns how many steps to run for it.
+int AdvanceSimulationClock(SimulationClock& clock, double realSeconds);
+
+// Forgets time accumulated while the simulation was not running.
+void ResetSimulationClock(SimulationClock& clock);
+
+#endif
@@ -0,0 +1,347 @@
+#include "spatial_grid.h"
+#include "frame_profiler.h"
+#include "particle_system.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+#include <cstring>
+
+// Cells per task when turning the per-task counts into offsets.
+static const size_t SPATIAL_GRID_CELLS_PER_TASK = 4096;
+// Slots whose impulses are summed together before they are written back.
+static const size_t COLLISION_BATCH_SIZE = 64;
+
+// A contiguous range of candidate slots: one row of a 3x3 block of cells.
+struct SlotRange {
+    uint32_t begin;
+    uint32_t end;
+};
+
+void BuildSpatialGrid(SpatialGrid& grid, const ParticleSystem& particles, float width, float height, float reach, float margin) {
+    const size_t count = particles.Size();
+    if (grid.particle.Capacity() < count) {
+        const size_t capacity = GrownCapacity(grid.particle.Capacity(), count);
+        grid.particle.Reallocate(capacity, 0);
+        grid.x.Reallocate(capacity, 0);
+        grid.y.Reallocate(capacity, 0);
+        grid.vx.Reallocate(capacity, 0);
+        grid.vy.Reallocate(capacity, 0);
+        grid.radius.Reallocate(capacity, 0);
+        grid.entries.Reallocate(capacity, 0);
+        grid.cell.Reallocate(capacity, 0);
+    }
+    const size_t chunks = (count + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    if (grid.chunkRadius.Capacity() < chunks) grid.chunkRadius.Reallocate(chunks, 0);
+
+    const float* x = particles.x.Data();
+    const float* y = particles.y.Data();
+    const float* radius = particles.radius.Data();
+    float* chunkRadius = grid.chunkRadius.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        float largest = 0.0f;
+        for (size_t i = begin; i < end; i++) largest = radius[i] > largest ? radius[i] : largest;
+        chunkRadius[begin / PARALLEL_CHUNK_SIZE] = largest;
+    });
+    float largest = 0.0f;
+    for (size_t chunk = 0; chunk < chunks; chunk++) largest = chunkRadius[chunk] > largest ? chunkRadius[chunk] : largest;
+
+    // Touching circles are at most two of the largest radii apart, so a reach
+    // of 1 always puts them in the same or neighbouring cells.
+    float cellSize = 2.0f * largest * reach + margin;
+    if (!(cellSize > 0.0f)) cellSize = 1.0f;
+    const double area = static_cast<double>(width > 0.0f ? width : 0.0f) * (height > 0.0f ? height : 0.0f);
+    if (count > 0 && area / (static_cast<double>(cellSize) * cellSize) > static_cast<double>(count)) {
+        cellSize = static_cast<float>(std::sqrt(area / static_cast<double>(count)));
+    }
+    grid.cellSize = cellSize;
+    grid.inverseCellSize = 1.0f / cellSize;
+    grid.columns = width > cellSize ? static_cast<size_t>(std::ceil(width / cellSize)) : 1;
+    grid.rows = height > cellSize ? static_cast<size_t>(std::ceil(height / cellSize)) : 1;
+    grid.cells = grid.columns * grid.rows;
+    grid.members = count;
+
+    // The counting sort is stable whatever the split, so it gets one task per
+    // thread, which keeps the count table at threads x cells.
+    const size_t cells = grid.cells;
+    const size_t threads = static_cast<size_t>(GetThreadPool().ThreadCount());
+    const size_t tasks = count < threads ? (count > 0 ? count : 1) : threads;
+    const size_t blocks = (cells + SPATIAL_GRID_CELLS_PER_TASK - 1) / SPATIAL_GRID_CELLS_PER_TASK;
+    grid.tasks = tasks;
+    if (grid.taskCells.Capacity() < tasks * cells) grid.taskCells.Reallocate(tasks * cells, 0);
+    if (grid.cellStart.Capacity() < cells + 1) grid.cellStart.Reallocate(cells + 1, 0);
+    if (grid.blockStart.Capacity() < blocks + 1) grid.blockStart.Reallocate(blocks + 1, 0);
+
+    uint32_t* cell = grid.cell.Data();
+    uint32_t* taskCells = grid.taskCells.Data();
+    uint32_t* cellStart = grid.cellStart.Data();
+    uint32_t* blockStart = grid.blockStart.Data();
+    const size_t columns = grid.columns;
+    ParallelFor(tasks, 1, [&](size_t task, size_t) {
+        uint32_t* counts = taskCells + task * cells;
+        std::memset(counts, 0, cells * sizeof(uint32_t));
+        const size_t end = count * (task + 1) / tasks;
+        for (size_t i = count * task / tasks; i < end; i++) {
+            const uint32_t c = static_cast<uint32_t>(SpatialGridRow(grid, y[i]) * columns + SpatialGridColumn(grid, x[i]));
+            cell[i] = c;
+            counts[c]++;
+        }
+    });
+
+    // Each task's count becomes its offset from the start of the cell's
+    // block: the block's earlier cells plus the earlier tasks' particles in
+    // this cell. The block totals are then scanned serially.
+    ParallelFor(cells, SPATIAL_GRID_CELLS_PER_TASK, [&](size_t begin, size_t end) {
+        uint32_t running = 0;
+        for (size_t c = begin; c < end; c++) {
+            cellStart[c] = running;
+            for (size_t task = 0; task < tasks; task++) {
+                const uint32_t n = taskCells[task * cells + c];
+                taskCells[task * cells + c] = running;
+                running += n;
+            }
+        }
+        blockStart[begin / SPATIAL_GRID_CELLS_PER_TASK] = running;
+    });
+    uint32_t total = 0;
+    for (size_t block = 0; block < blocks; block++) {
+        const uint32_t n = blockStart[block];
+        blockStart[block] = total;
+        total += n;
+    }
+    cellStart[cells] = total;
+    ParallelFor(cells, SPATIAL_GRID_CELLS_PER_TASK, [&](size_t begin, size_t end) {
+        const uint32_t offset = blockStart[begin / SPATIAL_GRID_CELLS_PER_TASK];
+        for (size_t c = begin; c < end; c++) cellStart[c] += offset;
+    });
+
+    const float* vx = particles.vx.Data();
+    const float* vy = particles.vy.Data();
+    SpatialGridEntry* entries = grid.entries.Data();
+    ParallelFor(tasks, 1, [&](size_t task, size_t) {
+        uint32_t* offsets = taskCells + task * cells;
+        const size_t end = count * (task + 1) / tasks;
+        for (size_t i = count * task / tasks; i < end; i++) {
+            const uint32_t c = cell[i];
+            SpatialGridEntry& entry = entries[blockStart[c / SPATIAL_GRID_CELLS_PER_TASK] + offsets[c]++];
+            entry.x = x[i];
+            entry.y = y[i];
+            entry.vx = vx[i];
+            entry.vy = vy[i];
+            entry.radius = radius[i];
+            entry.particle = static_cast<uint32_t>(i);
+        }
+    });
+
+    // One record per particle keeps the scatter to one write stream per cell
+    // rather than six; splitting it back into arrays is a sequential pass.
+    uint32_t* member = grid.particle.Data();
+    float* sortedX = grid.x.Data();
+    float* sortedY = grid.y.Data();
+    float* sortedVx = grid.vx.Data();
+    float* sortedVy = grid.vy.Data();
+    float* sortedRadius = grid.radius.Data();
+    ParallelFor(count, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; slot++) {
+            const SpatialGridEntry& entry = entries[slot];
+            sortedX[slot] = entry.x;
+            sortedY[slot] = entry.y;
+            sortedVx[slot] = entry.vx;
+            sortedVy[slot] = entry.vy;
+            sortedRadius[slot] = entry.radius;
+            member[slot] = entry.particle;
+        }
+    });
+}
+
+// Sums the impulses on slots [first, first + count) from every slot in the
+// ranges, j in order, so each slot's sum is the same whichever kernel runs it.
+static void CollideSlotsScalar(const SpatialGrid& grid, const SlotRange* ranges, size_t rangeCount, size_t first, size_t count, float* dvx,
+                               float* dvy) {
+    const float* x = grid.x.Data();
+    const float* y = grid.y.Data();
+    const float* vx = grid.vx.Data();
+    const float* vy = grid.vy.Data();
+    const float* radius = grid.radius.Data();
+    for (size_t k = 0; k < count; k++) {
+        const size_t i = first + k;
+        const float xi = x[i], yi = y[i], vxi = vx[i], vyi = vy[i], ri = radius[i];
+        const float mi = ri * ri;
+        float sumX = 0.0f, sumY = 0.0f;
+        for (size_t r = 0; r < rangeCount; r++) {
+            for (uint32_t j = ranges[r].begin; j < ranges[r].end; j++) {
+                const float dx = x[j] - xi;
+                const float dy = y[j] - yi;
+                const float distanceSquared = dx * dx + dy * dy;
+                const float reach = ri + radius[j];
+                const float approach = (vx[j] - vxi) * dx + (vy[j] - vyi) * dy;
+                // Zero distance covers the slot itself.
+                if (distanceSquared < reach * reach && distanceSquared > 0.0f && approach < 0.0f) {
+                    const float mj = radius[j] * radius[j];
+                    const float s = (2.0f * mj) / (mi + mj) * approach / distanceSquared;
+                    sumX += s * dx;
+                    sumY += s * dy;
+                }
+            }
+        }
+        dvx[k] = sumX;
+        dvy[k] = sumY;
+    }
+}
+
+#ifdef QPS_X86_SIMD
+
+// Eight slots at once against one broadcast neighbour; returns how many slots
+// it handled.
+__attribute__((target("avx2"))) static size_t CollideSlotsAvx2(const SpatialGrid& grid, const SlotRange* ranges, size_t rangeCount, size_t first,
+                                                               size_t count, float* dvx, float* dvy) {
+    const float* x = grid.x.Data();
+    const float* y = grid.y.Data();
+    const float* vx = grid.vx.Data();
+    const float* vy = grid.vy.Data();
+    const float* radius = grid.radius.Data();
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 two = _mm256_set1_ps(2.0f);
+    size_t k = 0;
+    for (; k + 8 <= count; k += 8) {
+        const size_t i = first + k;
+        const __m256 xi = _mm256_loadu_ps(x + i);
+        const __m256 yi = _mm256_loadu_ps(y + i);
+        const __m256 vxi = _mm256_loadu_ps(vx + i);
+        const __m256 vyi = _mm256_loadu_ps(vy + i);
+        const __m256 ri = _mm256_loadu_ps(radius + i);
+        const __m256 mi = _mm256_mul_ps(ri, ri);
+        __m256 sumX = zero, sumY = zero;
+        for (size_t r = 0; r < rangeCount; r++) {
+            for (uint32_t j = ranges[r].begin; j < ranges[r].end; j++) {
+                const __m256 dx = _mm256_sub_ps(_mm256_set1_ps(x[j]), xi);
+                const __m256 dy = _mm256_sub_ps(_mm256_set1_ps(y[j]), yi);
+                const __m256 distanceSquared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+                const __m256 rj = _mm256_set1_ps(radius[j]);
+                const __m256 reach = _mm256_add_ps(ri, rj);
+                const __m256 approach = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(vx[j]), vxi), dx),
+                                                      _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(vy[j]), vyi), dy));
+                const __m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(distanceSquared, _mm256_mul_ps(reach, reach), _CMP_LT_OQ),
+                                                               _mm256_cmp_ps(distanceSquared, zero, _CMP_GT_OQ)),
+                                                 _mm256_cmp_ps(approach, zero, _CMP_LT_OQ));
+                if (_mm256_movemask_ps(hit) == 0) continue;
+                const __m256 mj = _mm256_mul_ps(rj, rj);
+                const __m256 s = _mm256_div_ps(_mm256_mul_ps(_mm256_div_ps(_mm256_mul_ps(two, mj), _mm256_add_ps(mi, mj)), approach), distanceSquared);
+                sumX = _mm256_blendv_ps(sumX, _mm256_add_ps(sumX, _mm256_mul_ps(s, dx)), hit);
+                sumY = _mm256_blendv_ps(sumY, _mm256_add_ps(sumY, _mm256_mul_ps(s, dy)), hit);
+            }
+        }
+        _mm256_storeu_ps(dvx + k, sumX);
+        _mm256_storeu_ps(dvy + k, sumY);
+    }
+    return k;
+}
+
+// The AVX2 kernel sixteen slots wide.
+QPS_AVX512_TARGET static size_t CollideSlotsAvx512(const SpatialGrid& grid, const SlotRange* ranges, size_t rangeCount, size_t first,
+                                                  size_t count, float* dvx, float* dvy) {
+    const float* x = grid.x.Data();
+    const float* y = grid.y.Data();
+    const float* vx = grid.vx.Data();
+    const float* vy = grid.vy.Data();
+    const float* radius = grid.radius.Data();
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 two = _mm512_set1_ps(2.0f);
+    size_t k = 0;
+    for (; k + 16 <= count; k += 16) {
+        const size_t i = first + k;
+        const __m512 xi = _mm512_loadu_ps(x + i);
+        const __m512 yi = _mm512_loadu_ps(y + i);
+        const __m512 vxi = _mm512_loadu_ps(vx + i);
+        const __m512 vyi = _mm512_loadu_ps(vy + i);
+        const __m512 ri = _mm512_loadu_ps(radius + i);
+        const __m512 mi = _mm512_mul_ps(ri, ri);
+        __m512 sumX = zero, sumY = zero;
+        for (size_t r = 0; r < rangeCount; r++) {
+            for (uint32_t j = ranges[r].begin; j < ranges[r].end; j++) {
+                const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(x[j]), xi);
+                const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(y[j]), yi);
+                const __m512 distanceSquared = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+                const __m512 rj = _mm512_set1_ps(radius[j]);
+                const __m512 reach = _mm512_add_ps(ri, rj);
+                const __m512 approach = _mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(vx[j]), vxi), dx),
+                                                      _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(vy[j]), vyi), dy));
+                const __mmask16 hit = _mm512_cmp_ps_mask(distanceSquared, _mm512_mul_ps(reach, reach), _CMP_LT_OQ) &
+                                      _mm512_cmp_ps_mask(distanceSquared, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(approach, zero, _CMP_LT_OQ);
+                if (hit == 0) continue;
+                const __m512 mj = _mm512_mul_ps(rj, rj);
+                const __m512 s = _mm512_div_ps(_mm512_mul_ps(_mm512_div_ps(_mm512_mul_ps(two, mj), _mm512_add_ps(mi, mj)), approach), distanceSquared);
+                sumX = _mm512_mask_add_ps(sumX, hit, sumX, _mm512_mul_ps(s, dx));
+                sumY = _mm512_mask_add_ps(sumY, hit, sumY, _mm512_mul_ps(s, dy));
+            }
+        }
+        _mm512_storeu_ps(dvx + k, sumX);
+        _mm512_storeu_ps(dvy + k, sumY);
+    }
+    return k;
+}
+
+#endif
+
+void ResolveCollisions(const SpatialGrid& grid, ParticleSystem& particles) {
+    const SimdLevel level = ActiveSimdLevel();
+    if (grid.members == 0) return;
+    const uint32_t* cellStart = grid.cellStart.Data();
+    const uint32_t* member = grid.particle.Data();
+    const float* sortedVx = grid.vx.Data();
+    const float* sortedVy = grid.vy.Data();
+    float* vx = particles.vx.Data();
+    float* vy = particles.vy.Data();
+    const size_t columns = grid.columns;
+    // Each slot's new velocity depends only on the sorted copies, so rows can
+    // go to any thread in any order.
+    ParallelFor(grid.rows, 1, [&](size_t begin, size_t end) {
+        float dvx[COLLISION_BATCH_SIZE];
+        float dvy[COLLISION_BATCH_SIZE];
+        for (size_t row = begin; row < end; row++) {
+            const size_t top = row > 0 ? row - 1 : 0;
+            const size_t bottom = row + 1 < grid.rows ? row + 1 : row;
+            for (size_t column = 0; column < columns; column++) {
+                const uint32_t cellEnd = cellStart[row * columns + column + 1];
+                if (cellStart[row * columns + column] == cellEnd) continue;
+                const size_t left = column > 0 ? column - 1 : 0;
+                const size_t right = column + 1 < columns ? column + 1 : column;
+                SlotRange ranges[3];
+                size_t rangeCount = 0;
+                for (size_t r = top; r <= bottom; r++) {
+                    ranges[rangeCount++] = {cellStart[r * columns + left], cellStart[r * columns + right + 1]};
+                }
+                for (uint32_t first = cellStart[row * columns + column]; first < cellEnd; first += COLLISION_BATCH_SIZE) {
+                    const size_t count = cellEnd - first < COLLISION_BATCH_SIZE ? cellEnd - first : COLLISION_BATCH_SIZE;
+                    size_t done = 0;
+#ifdef QPS_X86_SIMD
+                    if (level == SIMD_AVX512) {
+                        done = CollideSlotsAvx512(grid, ranges, rangeCount, first, count, dvx, dvy);
+                    } else if (level == SIMD_AVX2) {
+                        done = CollideSlotsAvx2(grid, ranges, rangeCount, first, count, dvx, dvy);
+                    }
+#else
+                    (void)level;
+#endif
+                    CollideSlotsScalar(grid, ranges, rangeCount, first + done, count - done, dvx + done, dvy + done);
+                    // Most slots touch nothing; skipping them spares a
+                    // random write into the particle arrays.
+                    for (size_t k = 0; k < count; k++) {
+                        if (dvx[k] == 0.0f && dvy[k] == 0.0f) continue;
+                        const uint32_t p = member[first + k];
+                        vx[p] = sortedVx[first + k] + dvx[k];
+                        vy[p] = sortedVy[first + k] + dvy[k];
+                    }
+                }
+            }
+        }
+    });
+}
+
+void CollideParticles(ParticleSystem& particles, float width, float height) {
+    {
+        ScopedProfile profile(PROFILE_SPATIAL_GRID);
+        BuildSpatialGrid(particles.grid, particles, width, height, 1.0f, 0.0f);
+    }
+    ScopedProfile profile(PROFILE_COLLISIONS);
+    ResolveCollisions(particles.grid, particles);
+}
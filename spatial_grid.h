@@ -0,0 +1,114 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include "aligned_array.h"
+#include <cstddef>
+#include <cstdint>
+
+class ParticleSystem;
+
+// A particle's state as the spatial grid's counting sort moves it.
+struct SpatialGridEntry {
+    float x;
+    float y;
+    float vx;
+    float vy;
+    float radius;
+    uint32_t particle;
+};
+
+// Uniform grid of square cells over the domain, rebuilt from the particles by
+// a counting sort. Cells are at least twice the largest radius, so any two
+// touching circles sit in the same or adjacent cells. Each particle's state is
+// copied into cell order, so a cell and its row neighbours are one contiguous
+// range of slots.
+struct SpatialGrid {
+    // Per slot, in cell order: the particle and a copy of its state.
+    AlignedArray<uint32_t> particle;
+    AlignedArray<float> x;
+    AlignedArray<float> y;
+    AlignedArray<float> vx;
+    AlignedArray<float> vy;
+    AlignedArray<float> radius;
+    // The slots as the sort scatters them, before they are split into the
+    // arrays above.
+    AlignedArray<SpatialGridEntry> entries;
+    // Per particle: its cell, row-major.
+    AlignedArray<uint32_t> cell;
+    // cells + 1 slot offsets: cell c holds slots [cellStart[c], cellStart[c + 1]).
+    AlignedArray<uint32_t> cellStart;
+    // Per sorting task, a count and then a scatter offset for every cell.
+    AlignedArray<uint32_t> taskCells;
+    // Slots before each block of cells, and the largest radius per chunk.
+    AlignedArray<uint32_t> blockStart;
+    AlignedArray<float> chunkRadius;
+    size_t members = 0;
+    size_t columns = 0;
+    size_t rows = 0;
+    size_t cells = 0;
+    size_t tasks = 0;
+    float cellSize = 0.0f;
+    float inverseCellSize = 0.0f;
+};
+
+// Rebuilds grid from the particles in [0, particles.Size()) over a width x
+// height domain with a counting sort: each task counts its particles per cell,
+// the counts become per-task offsets, and each task scatters its particles
+// into cell order. The sort is stable, so the result is the same at any thread
+// count. Cells are reach times the largest diameter plus margin wide, or
+// larger when that would leave more cells than particles, so pairs up to that
+// far apart share a cell or sit in neighbouring ones. Positions outside the
+// domain clamp to the border cells.
+void BuildSpatialGrid(SpatialGrid& grid, const ParticleSystem& particles, float width, float height, float reach, float margin);
+
+// Elastic collisions between touching circles, with masses proportional to
+// radius squared. Every impulse comes from the velocities at the last
+// BuildSpatialGrid, so the order pairs are visited in does not matter, and
+// only approaching pairs bounce, so overlapping circles drift apart instead
+// of sticking. Writes the new velocities to particles.
+void ResolveCollisions(const SpatialGrid& grid, ParticleSystem& particles);
+
+// Builds the grid and resolves collisions, profiled as separate stages.
+void CollideParticles(ParticleSystem& particles, float width, float height);
+
+inline size_t SpatialGridColumn(const SpatialGrid& grid, float x) {
+    const float column = x * grid.inverseCellSize;
+    if (!(column > 0.0f)) return 0;
+    return column < static_cast<float>(grid.columns - 1) ? static_cast<size_t>(column) : grid.columns - 1;
+}
+
+inline size_t SpatialGridRow(const SpatialGrid& grid, float y) {
+    const float row = y * grid.inverseCellSize;
+    if (!(row > 0.0f)) return 0;
+    return row < static_cast<float>(grid.rows - 1) ? static_cast<size_t>(row) : grid.rows - 1;
+}
+
+// Calls fn(slot) for every slot in the 3x3 block of cells around (column,
+// row). Cells next to each other in a row are next to each other in slot
+// order, so the block is three contiguous ranges.
+template <typename Fn>
+void ForEachNeighborSlot(const SpatialGrid& grid, size_t column, size_t row, Fn&& fn) {
+    const size_t left = column > 0 ? column - 1 : 0;
+    const size_t right = column + 1 < grid.columns ? column + 1 : column;
+    const size_t top = row > 0 ? row - 1 : 0;
+    const size_t bottom = row + 1 < grid.rows ? row + 1 : row;
+    const uint32_t* cellStart = grid.cellStart.Data();
+    for (size_t r = top; r <= bottom; r++) {
+        const uint32_t end = cellStart[r * grid.columns + right + 1];
+        for (uint32_t slot = cellStart[r * grid.columns + left]; slot < end; slot++) fn(slot);
+    }
+}
+
+// Calls fn(j) for every particle j other than the given one that may touch
+// it: everything in its own and the eight surrounding cells. Only valid until
+// the particles move or are resized after the last BuildSpatialGrid.
+template <typename Fn>
+void ForEachNeighbor(const SpatialGrid& grid, size_t particle, Fn&& fn) {
+    const uint32_t cell = grid.cell[particle];
+    const uint32_t* members = grid.particle.Data();
+    ForEachNeighborSlot(grid, cell % grid.columns, cell / grid.columns, [&](uint32_t slot) {
+        if (members[slot] != particle) fn(static_cast<size_t>(members[slot]));
+    });
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include "superposition.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+
+// Basis state k turns by (k + 1) times this many radians per step.
+static const float SUPERPOSITION_BASE_FREQUENCY = 0.02f;
+// Radians per step that probability rotates between neighbouring basis
+// states: a collapsed particle spreads back over the basis within about the
+// 50 frames between its measurements.
+static const float SUPERPOSITION_HOP_RATE = 0.05f;
+
+size_t SuperpositionBasisCount(size_t particles) {
+    size_t basis = particles > 0 ? SUPERPOSITION_POOL_AMPLITUDES / particles : SUPERPOSITION_MAX_BASIS;
+    if (basis > SUPERPOSITION_MAX_BASIS) basis = SUPERPOSITION_MAX_BASIS;
+    if (basis < 2) basis = 2;
+    return basis & ~static_cast<size_t>(1);
+}
+
+void BuildSuperposition(SuperpositionState& state, const uint32_t* id, size_t particles, uint64_t seed) {
+    const size_t basis = SuperpositionBasisCount(particles);
+    state.stride = PaddedCapacity(particles);
+    state.basis = basis;
+    state.seed = seed;
+    state.amplitudes.Reallocate(2 * basis * state.stride, 0);
+
+    // Complex Gaussian amplitudes, normalized, are uniform over the unit sphere
+    // of states. Each stream step fills two basis states.
+    ParallelFor(particles, PARALLEL_CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t first = begin; first < end; first += RNG_BATCH_SIZE) {
+            const size_t n = end - first < RNG_BATCH_SIZE ? end - first : RNG_BATCH_SIZE;
+            float norm[RNG_BATCH_SIZE] = {};
+            for (size_t k = 0; k < basis; k += 2) {
+                const RandomStream stream = MakeRandomStream(seed, RNG_STREAM_SUPERPOSITION, k / 2);
+                float* re0 = state.Real(k) + first;
+                float* im0 = state.Imag(k) + first;
+                float* re1 = state.Real(k + 1) + first;
+                float* im1 = state.Imag(k + 1) + first;
+                FillGaussianById(stream, id + first, n, re0, im0, re1, im1);
+                for (size_t j = 0; j < n; j++) {
+                    norm[j] += re0[j] * re0[j] + im0[j] * im0[j] + re1[j] * re1[j] + im1[j] * im1[j];
+                }
+            }
+            for (size_t j = 0; j < n; j++) norm[j] = norm[j] > 0.0f ? 1.0f / std::sqrt(norm[j]) : 0.0f;
+            for (size_t k = 0; k < basis; k++) {
+                float* re = state.Real(k) + first;
+                float* im = state.Imag(k) + first;
+                for (size_t j = 0; j < n; j++) {
+                    re[j] *= norm[j];
+                    im[j] *= norm[j];
+                }
+            }
+        }
+    });
+    state.members = particles;
+}
+
+void SetSuperpositionTimestep(SuperpositionState& state, float dt) {
+    for (size_t k = 0; k < SUPERPOSITION_MAX_BASIS; k++) {
+        const float omega = SUPERPOSITION_BASE_FREQUENCY * static_cast<float>(k + 1);
+        state.phaseCos[k] = std::cos(omega * dt);
+        state.phaseSin[k] = -std::sin(omega * dt);
+    }
+    state.hopCos = std::cos(SUPERPOSITION_HOP_RATE * dt);
+    state.hopSin = std::sin(SUPERPOSITION_HOP_RATE * dt);
+    state.dt = dt;
+}
+
+void EvolveSuperposition(SuperpositionState& state, size_t first, size_t count) {
+    for (size_t k = 0; k < state.basis; k++) {
+        RotatePhase(state.Real(k) + first, state.Imag(k) + first, count, state.phaseCos[k], state.phaseSin[k]);
+    }
+    for (size_t parity = 0; parity < 2; parity++) {
+        for (size_t a = parity; a < state.basis; a += 2) {
+            const size_t b = (a + 1) % state.basis;
+            MixAmplitudes(state.Real(a) + first, state.Imag(a) + first, state.Real(b) + first, state.Imag(b) + first,
+                          count, state.hopCos, state.hopSin);
+        }
+    }
+}
+
+size_t SampleSuperpositionBasis(const SuperpositionState& state, size_t particle, float u) {
+    float probability[SUPERPOSITION_MAX_BASIS];
+    float total = 0.0f;
+    for (size_t k = 0; k < state.basis; k++) {
+        const float re = state.Real(k)[particle];
+        const float im = state.Imag(k)[particle];
+        probability[k] = re * re + im * im;
+        total += probability[k];
+    }
+    float target = u * total;
+    for (size_t k = 0; k + 1 < state.basis; k++) {
+        if (target < probability[k]) return k;
+        target -= probability[k];
+    }
+    return state.basis - 1;
+}
+
+void CollapseSuperposition(SuperpositionState& state, size_t particle, size_t k) {
+    const float re = state.Real(k)[particle];
+    const float im = state.Imag(k)[particle];
+    const float magnitude = std::sqrt(re * re + im * im);
+    for (size_t j = 0; j < state.basis; j++) {
+        state.Real(j)[particle] = 0.0f;
+        state.Imag(j)[particle] = 0.0f;
+    }
+    state.Real(k)[particle] = magnitude > 0.0f ? re / magnitude : 1.0f;
+    state.Imag(k)[particle] = magnitude > 0.0f ? im / magnitude : 0.0f;
+}
+
+Vector2 SuperpositionBasisPosition(const SuperpositionState& state, uint32_t id, size_t k, float width, float height) {
+    uint32_t words[4];
+    RandomWords(MakeRandomStream(state.seed, RNG_STREAM_SUPERPOSITION_BASIS, k), id, words);
+    return {std::floor(BitsToUniform(words[0]) * width), std::floor(BitsToUniform(words[1]) * height)};
+}
@@ -0,0 +1,74 @@
+#ifndef SUPERPOSITION_H
+#define SUPERPOSITION_H
+
+#include "raylib.h"
+#include "aligned_array.h"
+#include <cstddef>
+#include <cstdint>
+
+// Largest basis the SUPERPOSITION principle gives a particle.
+const size_t SUPERPOSITION_MAX_BASIS = 16;
+
+// Complex amplitudes c_k over a small basis of positions for the SUPERPOSITION
+// principle, built on first use. One pool of 2 * basis planes of `stride`
+// floats each (Re c_k, then Im c_k), kept apart from the position arrays so
+// the other kernels never stream it.
+struct SuperpositionState {
+    AlignedArray<float> amplitudes;
+    size_t stride = 0;
+    size_t basis = 0;
+    size_t members = 0;
+    uint64_t seed = 0;
+    // Per-step phase factor e^(-i w_k dt) of each basis state, for steps of
+    // dt frames.
+    float phaseCos[SUPERPOSITION_MAX_BASIS] = {};
+    float phaseSin[SUPERPOSITION_MAX_BASIS] = {};
+    // Per-step mixing of neighbouring basis states, cos and sin of the angle
+    // probability rotates through between them in dt frames.
+    float hopCos = 1.0f;
+    float hopSin = 0.0f;
+    float dt = 0.0f;
+
+    float* Real(size_t k) { return amplitudes.Data() + 2 * k * stride; }
+    float* Imag(size_t k) { return amplitudes.Data() + (2 * k + 1) * stride; }
+    const float* Real(size_t k) const { return amplitudes.Data() + 2 * k * stride; }
+    const float* Imag(size_t k) const { return amplitudes.Data() + (2 * k + 1) * stride; }
+};
+
+// Complex amplitudes the pool holds: 1M particles at the full 16-state basis
+// (128 MB). Larger counts get a smaller basis, down to two states.
+const size_t SUPERPOSITION_POOL_AMPLITUDES = 1000000 * SUPERPOSITION_MAX_BASIS;
+
+// Chance per frame that a particle is measured and collapses.
+const float SUPERPOSITION_MEASURE_RATE = 0.02f;
+
+// Basis size K for a particle count: even, between 2 and SUPERPOSITION_MAX_BASIS.
+size_t SuperpositionBasisCount(size_t particles);
+
+// Prepares every particle in a random normalized state over K basis positions,
+// drawn at its id so it does not depend on the particle's slot. Deterministic
+// for a seed at any thread count.
+void BuildSuperposition(SuperpositionState& state, const uint32_t* id, size_t particles, uint64_t seed);
+
+// Sets the phase each basis state turns through in a step of dt frames, and
+// the angle it mixes with its neighbours by.
+void SetSuperpositionTimestep(SuperpositionState& state, float dt);
+
+// c_k *= e^(-i w_k dt) for particles [first, first + count), one SIMD phase
+// rotation per basis plane, then a hop between neighbouring basis states on a
+// ring: pairs (0, 1), (2, 3), ... then (1, 2), ..., (K - 1, 0). Both steps are
+// unitary, so the norm holds while probability spreads over the basis.
+void EvolveSuperposition(SuperpositionState& state, size_t first, size_t count);
+
+// Samples k with probability |c_k|^2 / sum |c|^2 using u in [0, 1).
+size_t SampleSuperpositionBasis(const SuperpositionState& state, size_t particle, float u);
+
+// Measurement outcome k: c_k keeps its phase at unit magnitude and every other
+// amplitude of the particle drops to zero.
+void CollapseSuperposition(SuperpositionState& state, size_t particle, size_t k);
+
+// Position of basis state k of the particle with the given id, derived from
+// the seed rather than stored, so the pool holds amplitudes only.
+Vector2 SuperpositionBasisPosition(const SuperpositionState& state, uint32_t id, size_t k, float width, float height);
+
+#endif
@@ -0,0 +1,69 @@
+#include "text_layer.h"
+#include <algorithm>
+#include <vector>
+
+static std::vector<TextLayer*>& TextLayerRegistry() {
+    static std::vector<TextLayer*> layers;
+    return layers;
+}
+
+TextLayer::TextLayer() : target_(), bounds_(), key_(0), valid_(false) {
+    TextLayerRegistry().push_back(this);
+}
+
+TextLayer::~TextLayer() {
+    std::vector<TextLayer*>& layers = TextLayerRegistry();
+    layers.erase(std::remove(layers.begin(), layers.end(), this), layers.end());
+}
+
+void TextLayer::Unload() {
+    if (target_.id != 0) UnloadRenderTexture(target_);
+    target_ = RenderTexture2D{};
+    valid_ = false;
+}
+
+bool TextLayer::Matches(uint64_t key, Rectangle bounds) const {
+    return valid_ && key == key_ && bounds.x == bounds_.x && bounds.y == bounds_.y && bounds.width == bounds_.width &&
+           bounds.height == bounds_.height;
+}
+
+bool TextLayer::BeginContent(Rectangle bounds) {
+    if (target_.id == 0 || target_.texture.width != static_cast<int>(bounds.width) || target_.texture.height != static_cast<int>(bounds.height)) {
+        Unload();
+        target_ = LoadRenderTexture(static_cast<int>(bounds.width), static_cast<int>(bounds.height));
+        if (!IsRenderTextureValid(target_)) {
+            target_ = RenderTexture2D{};
+            return false;
+        }
+        // Smooths the quad when it is drawn scaled.
+        SetTextureFilter(target_.texture, TEXTURE_FILTER_BILINEAR);
+    }
+    bounds_ = bounds;
+    BeginTextureMode(target_);
+    ClearBackground(BLANK);
+    // Adding into a cleared target stores each glyph's colour and coverage
+    // unblended, so the quad composites once with normal alpha blending
+    // instead of having its edges faded twice.
+    BeginBlendMode(BLEND_ADD_COLORS);
+    BeginMode2D(Camera2D{{-bounds.x, -bounds.y}, {0.0f, 0.0f}, 0.0f, 1.0f});
+    return true;
+}
+
+void TextLayer::EndContent(uint64_t key) {
+    EndMode2D();
+    EndBlendMode();
+    EndTextureMode();
+    key_ = key;
+    valid_ = true;
+}
+
+void TextLayer::Present(Rectangle dest) const {
+    if (!valid_) return;
+    // Render textures are stored bottom-up.
+    Rectangle source = {0.0f, 0.0f, static_cast<float>(target_.texture.width), -static_cast<float>(target_.texture.height)};
+    DrawTexturePro(target_.texture, source, dest, {0.0f, 0.0f}, 0.0f, WHITE);
+}
+
+void UnloadTextLayers() {
+    for (TextLayer* layer : TextLayerRegistry()) layer->Unload();
+}
@@ -0,0 +1,72 @@
+#ifndef TEXT_LAYER_H
+#define TEXT_LAYER_H
+
+#include "raylib.h"
+#include <cstdint>
+#include <initializer_list>
+
+// Folds the values a panel's text depends on (selection, score, principle...)
+// into one key; the panel is re-rasterized only when the key changes.
+inline uint64_t TextLayerKey(std::initializer_list<long long> parts) {
+    uint64_t hash = 14695981039346656037ull;
+    for (long long part : parts) {
+        hash ^= static_cast<uint64_t>(part);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A screen region of static text kept in a render texture. While its key is
+// unchanged, drawing the panel is one textured quad instead of a MeasureText
+// and a glyph quad per character.
+//
+// Content is drawn in screen coordinates and mapped into the texture with a
+// camera offset, so existing DrawText calls move in unchanged. Layers must be
+// drawn between BeginDrawing and EndDrawing, after ClearBackground: switching
+// to the texture flushes whatever the batch holds.
+class TextLayer {
+public:
+    TextLayer();
+    ~TextLayer();
+    TextLayer(const TextLayer&) = delete;
+    TextLayer& operator=(const TextLayer&) = delete;
+
+    template <typename DrawFn>
+    void Draw(uint64_t key, Rectangle bounds, DrawFn&& drawContent) {
+        Draw(key, bounds, bounds, drawContent);
+    }
+
+    // Same, but stretches the cached quad over dest, e.g. for a pulsing title.
+    template <typename DrawFn>
+    void Draw(uint64_t key, Rectangle bounds, Rectangle dest, DrawFn&& drawContent) {
+        if (!Matches(key, bounds)) {
+            if (!BeginContent(bounds)) {
+                // No render texture available: fall back to drawing directly.
+                drawContent();
+                return;
+            }
+            drawContent();
+            EndContent(key);
+        }
+        Present(dest);
+    }
+
+    void Unload();
+
+private:
+    bool Matches(uint64_t key, Rectangle bounds) const;
+    bool BeginContent(Rectangle bounds);
+    void EndContent(uint64_t key);
+    void Present(Rectangle dest) const;
+
+    RenderTexture2D target_;
+    Rectangle bounds_;
+    uint64_t key_;
+    bool valid_;
+};
+
+// Frees every layer's texture. Call before CloseWindow; layers are usually
+// function-local statics that outlive the GL context.
+void UnloadTextLayers();
+
+#endif
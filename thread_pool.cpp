@@ -0,0 +1,105 @@
+#include "thread_pool.h"
+#include "frame_profiler.h"
+
+static thread_local int workerIndex = 0;
+
+int HardwareThreadCount() {
+    unsigned int count = std::thread::hardware_concurrency();
+    return count > 0 ? static_cast<int>(count) : 1;
+}
+
+ThreadPool::ThreadPool(int threadCount)
+    : job_(nullptr), context_(nullptr), count_(0), chunkSize_(0), chunkCount_(0), nextChunk_(0),
+      activeWorkers_(0), generation_(0), stopping_(false), running_(false) {
+    Start(threadCount);
+}
+
+ThreadPool::~ThreadPool() {
+    Stop();
+}
+
+int ThreadPool::CurrentWorkerIndex() {
+    return workerIndex;
+}
+
+void ThreadPool::SetThreadCount(int threadCount) {
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount == ThreadCount()) return;
+    Stop();
+    Start(threadCount);
+}
+
+void ThreadPool::Start(int threadCount) {
+    stopping_ = false;
+    for (int i = 1; i < threadCount; i++) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+void ThreadPool::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+void ThreadPool::ExecuteChunks() {
+    const uint64_t start = TraceRecorder::Enabled() ? ProfileNow() : 0;
+    size_t executed = 0;
+    for (;;) {
+        size_t chunk = nextChunk_.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= chunkCount_) break;
+        size_t begin = chunk * chunkSize_;
+        size_t end = begin + chunkSize_ < count_ ? begin + chunkSize_ : count_;
+        job_(context_, begin, end);
+        executed++;
+    }
+    // One span per thread per parallel run; threads that found no chunk left
+    // stay blank in the trace, which is what utilization gaps look like.
+    if (start != 0 && executed > 0) GetTraceRecorder().Record("parallel chunks", "pool", start, ProfileNow());
+}
+
+void ThreadPool::Run(size_t count, size_t chunkSize, ChunkFn fn, void* context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = fn;
+        context_ = context;
+        count_ = count;
+        chunkSize_ = chunkSize;
+        chunkCount_ = (count + chunkSize - 1) / chunkSize;
+        nextChunk_.store(0, std::memory_order_relaxed);
+        activeWorkers_ = static_cast<int>(workers_.size());
+        running_ = true;
+        generation_++;
+    }
+    wake_.notify_all();
+    ExecuteChunks();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return activeWorkers_ == 0; });
+    running_ = false;
+}
+
+void ThreadPool::WorkerLoop(int index) {
+    workerIndex = index;
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_) return;
+        seen = generation_;
+        lock.unlock();
+        ExecuteChunks();
+        lock.lock();
+        if (--activeWorkers_ == 0) done_.notify_one();
+    }
+}
+
+ThreadPool& GetThreadPool() {
+    static ThreadPool pool(HardwareThreadCount());
+    return pool;
+}
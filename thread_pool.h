@@ -0,0 +1,84 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Chunk size used by every particle kernel. It is fixed rather than derived from
+// the thread count so the same seed partitions work identically on any machine.
+const size_t PARALLEL_CHUNK_SIZE = 16384;
+
+int HardwareThreadCount();
+
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int ThreadCount() const { return static_cast<int>(workers_.size()) + 1; }
+    void SetThreadCount(int threadCount);
+
+    // Calls fn(begin, end) for every chunkSize-sized slice of [0, count). The
+    // calling thread takes part; nested calls from inside a chunk run inline.
+    template <typename Fn>
+    void ParallelFor(size_t count, size_t chunkSize, Fn&& fn) {
+        if (count == 0) return;
+        if (chunkSize == 0) chunkSize = count;
+        const size_t chunks = (count + chunkSize - 1) / chunkSize;
+        if (chunks == 1 || workers_.empty() || CurrentWorkerIndex() != 0 || running_) {
+            for (size_t begin = 0; begin < count; begin += chunkSize) {
+                fn(begin, begin + chunkSize < count ? begin + chunkSize : count);
+            }
+            return;
+        }
+        Run(count, chunkSize, &Invoke<typename std::remove_reference<Fn>::type>, &fn);
+    }
+
+    // 0 on the thread that owns the pool, 1..ThreadCount()-1 on workers.
+    static int CurrentWorkerIndex();
+
+private:
+    typedef void (*ChunkFn)(void* context, size_t begin, size_t end);
+
+    template <typename Fn>
+    static void Invoke(void* context, size_t begin, size_t end) {
+        (*static_cast<Fn*>(context))(begin, end);
+    }
+
+    void Run(size_t count, size_t chunkSize, ChunkFn fn, void* context);
+    void ExecuteChunks();
+    void WorkerLoop(int index);
+    void Start(int threadCount);
+    void Stop();
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    ChunkFn job_;
+    void* context_;
+    size_t count_;
+    size_t chunkSize_;
+    size_t chunkCount_;
+    std::atomic<size_t> nextChunk_;
+    int activeWorkers_;
+    unsigned long long generation_;
+    bool stopping_;
+    bool running_;
+};
+
+ThreadPool& GetThreadPool();
+
+template <typename Fn>
+void ParallelFor(size_t count, size_t chunkSize, Fn&& fn) {
+    GetThreadPool().ParallelFor(count, chunkSize, std::forward<Fn>(fn));
+}
+
+#endif
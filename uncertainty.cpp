@@ -0,0 +1,65 @@
+#include "uncertainty.h"
+#include "rng.h"
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <cmath>
+
+void PrepareUncertainty(UncertaintyState& state, size_t particles, uint64_t seed, uint64_t step, float dt, float width, float height) {
+    const bool fresh = state.members != particles || state.seed != seed || state.lastStep + 1 != step || state.dt != dt;
+    if (state.seed != seed) state.packet = 0;
+    state.launching = fresh || static_cast<float>(state.age) * dt >= UNCERTAINTY_PACKET_FRAMES;
+    state.dt = dt;
+    state.members = particles;
+    state.seed = seed;
+    state.lastStep = step;
+    if (state.launching) {
+        state.sigmaX = UNCERTAINTY_MIN_WIDTH * static_cast<float>(1u << (state.packet % UNCERTAINTY_WIDTHS));
+        state.sigmaP = UNCERTAINTY_HBAR / (2.0f * state.sigmaX);
+        state.centerX = width * 0.5f;
+        state.centerY = height * 0.5f;
+        state.shift[UNCERTAINTY_X] = state.centerX;
+        state.shift[UNCERTAINTY_Y] = state.centerY;
+        state.shift[UNCERTAINTY_VX] = 0.0f;
+        state.shift[UNCERTAINTY_VY] = 0.0f;
+        state.age = 0;
+        state.packet++;
+    }
+    state.chunks = (particles + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    state.partial.Reallocate(state.chunks * UNCERTAINTY_AXES, 0);
+    for (size_t i = 0; i < state.chunks * UNCERTAINTY_AXES; i++) state.partial[i] = DeviationSums();
+}
+
+void LaunchWavePackets(const UncertaintyState& state, const uint32_t* id, float* x, float* y, float* vx, float* vy, size_t first, size_t count) {
+    const RandomStream stream = MakeRandomStream(state.seed, RNG_STREAM_UNCERTAINTY, state.packet - 1);
+    FillGaussianById(stream, id + first, count, x + first, y + first, vx + first, vy + first);
+    for (size_t i = first; i < first + count; i++) {
+        x[i] = state.centerX + state.sigmaX * x[i];
+        y[i] = state.centerY + state.sigmaX * y[i];
+        vx[i] *= state.sigmaP;
+        vy[i] *= state.sigmaP;
+    }
+}
+
+void MeasureUncertainty(UncertaintyState& state, const float* x, const float* y, const float* vx, const float* vy, size_t first, size_t count) {
+    const float* values[UNCERTAINTY_AXES] = {x + first, y + first, vx + first, vy + first};
+    DeviationSums* partial = state.partial.Data() + first / PARALLEL_CHUNK_SIZE * UNCERTAINTY_AXES;
+    for (size_t axis = 0; axis < UNCERTAINTY_AXES; axis++) {
+        float sum, sumSquares;
+        SumDeviations(values[axis], count, state.shift[axis], sum, sumSquares);
+        partial[axis].count += static_cast<double>(count);
+        partial[axis].sum += sum;
+        partial[axis].squares += sumSquares;
+    }
+}
+
+void FinishUncertainty(UncertaintyState& state) {
+    for (size_t axis = 0; axis < UNCERTAINTY_AXES; axis++) {
+        RunningMoments total;
+        for (size_t chunk = 0; chunk < state.chunks; chunk++) {
+            MergeMoments(total, SumsToMoments(state.partial[chunk * UNCERTAINTY_AXES + axis], state.shift[axis]));
+        }
+        state.moments[axis] = total;
+        state.shift[axis] = static_cast<float>(total.mean);
+    }
+    state.age++;
+}
@@ -0,0 +1,74 @@
+#ifndef UNCERTAINTY_H
+#define UNCERTAINTY_H
+
+#include "aligned_array.h"
+#include "running_moments.h"
+#include <cstddef>
+#include <cstdint>
+
+// Quantities the UNCERTAINTY principle measures, in the order it keeps them.
+enum UncertaintyAxis {
+    UNCERTAINTY_X,
+    UNCERTAINTY_Y,
+    UNCERTAINTY_VX,
+    UNCERTAINTY_VY,
+    UNCERTAINTY_AXES
+};
+
+// Gaussian wave-packet ensemble for the UNCERTAINTY principle. Every particle
+// is one sample of the same packet, launched at minimum uncertainty and then
+// left to spread; the spreads are measured after every step.
+struct UncertaintyState {
+    // UNCERTAINTY_AXES sums per thread-pool chunk, turned into moments and
+    // merged in chunk order.
+    AlignedArray<DeviationSums> partial;
+    size_t chunks = 0;
+    // Last completed measurement, and the float shift each step's deviations
+    // are summed about (the previous step's means).
+    RunningMoments moments[UNCERTAINTY_AXES];
+    float shift[UNCERTAINTY_AXES] = {};
+    size_t members = 0;
+    uint64_t seed = 0;
+    uint64_t lastStep = 0;
+    // Packets launched so far; the current one is packet - 1.
+    uint64_t packet = 0;
+    // Steps since the current packet was launched, each of dt frames.
+    size_t age = 0;
+    float dt = 0.0f;
+    bool launching = false;
+    float sigmaX = 0.0f;
+    float sigmaP = 0.0f;
+    float centerX = 0.0f;
+    float centerY = 0.0f;
+};
+
+// Planck's constant over 2 pi in simulation units (px^2 per step, mass 1): a
+// packet of width sigma_x has sigma_p = hbar / (2 sigma_x), so the narrowest
+// packets scatter visibly within a second.
+const float UNCERTAINTY_HBAR = 16.0f;
+
+// Frames a packet spreads before the next one is launched.
+const float UNCERTAINTY_PACKET_FRAMES = 240.0f;
+
+// Packet widths cycle through this many doublings of the narrowest.
+const float UNCERTAINTY_MIN_WIDTH = 8.0f;
+const size_t UNCERTAINTY_WIDTHS = 4;
+
+// Serial part of a step: decides whether this step launches a new packet (the
+// first step, after any gap, or once the current one is old enough) and clears
+// the per-chunk moments.
+void PrepareUncertainty(UncertaintyState& state, size_t particles, uint64_t seed, uint64_t step, float dt, float width, float height);
+
+// Places particles [first, first + count) as samples of the new packet, each
+// drawn at its id: positions ~ N(centre, sigma_x^2), velocities ~ N(0, sigma_p^2).
+void LaunchWavePackets(const UncertaintyState& state, const uint32_t* id, float* x, float* y, float* vx, float* vy, size_t first, size_t count);
+
+// Adds particles [first, first + count) to the moments of the thread-pool chunk
+// holding first. The slices of a chunk must come in order from one thread.
+void MeasureUncertainty(UncertaintyState& state, const float* x, const float* y, const float* vx, const float* vy, size_t first, size_t count);
+
+// Merges the chunk moments in chunk order, so the result is the same at any
+// thread count, and ages the packet.
+void FinishUncertainty(UncertaintyState& state);
+
+#endif
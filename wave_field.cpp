@@ -0,0 +1,244 @@
+#include "wave_field.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Grid rows handled per task by the pointwise passes.
+static const size_t WAVE_ROWS_PER_TASK = 16;
+
+// Barrier height for the Crank-Nicolson solver, in units of the packet's
+// kinetic energy; through a wall n / 128 cells thick, next to nothing tunnels.
+static const float WAVE_BARRIER_ENERGY = 16.0f;
+
+static const float TWO_PI = 6.28318530718f;
+
+static const char* const WAVE_SOLVER_NAMES[] = {"split_step", "crank_nicolson"};
+static_assert(sizeof(WAVE_SOLVER_NAMES) / sizeof(WAVE_SOLVER_NAMES[0]) == WAVE_SOLVER_COUNT, "every wave solver needs a name");
+
+const char* WaveSolverName(WaveSolver solver) {
+    return WAVE_SOLVER_NAMES[solver];
+}
+
+WaveField::WaveField() : n_(0), steps_(0), pending_(0.0f), dt_(0.0f), norm_(0.0f), peak_(0.0f), solver_(WAVE_SOLVER_SPLIT_STEP) {}
+
+void WaveField::Resize(size_t n) {
+    size_t size = WAVE_GRID_MIN;
+    while (size < n && size < WAVE_GRID_MAX) size *= 2;
+    if (size != n_) {
+        n_ = size;
+        fft_.Resize(size);
+        re_.Reallocate(size * size, 0);
+        im_.Reallocate(size * size, 0);
+        mask_.Reallocate(size * size, 0);
+        absorb_.Reallocate(size * size, 0);
+        density_.Reallocate(size * size, 0);
+        cellCumulative_.Reallocate(size * size, 0);
+        rowCumulative_.Reallocate(size, 0);
+        kineticRe_.Reallocate(size, 0);
+        kineticIm_.Reallocate(size, 0);
+
+        // Wavelength n / 64 and a time step that carries the packet across
+        // the grid in about 600 steps, so the picture looks alike at any size.
+        const float cells = static_cast<float>(size);
+        const float k0 = TWO_PI * 64.0f / cells;
+        const float dt = cells / (600.0f * k0);
+        dt_ = dt;
+        for (size_t j = 0; j < size; j++) {
+            const float wave = static_cast<float>(j < size / 2 ? static_cast<long>(j) : static_cast<long>(j) - static_cast<long>(size));
+            const float k = TWO_PI * wave / cells;
+            const float phase = -0.5f * k * k * dt;
+            kineticRe_[j] = std::cos(phase) / cells;
+            kineticIm_[j] = std::sin(phase) / cells;
+        }
+
+        // Double slit: a wall at 45% of the width with two openings, plus a
+        // quadratic absorbing ramp over the outer sixteenth on every side.
+        const size_t wallLeft = size * 45 / 100;
+        const size_t wallRight = wallLeft + std::max<size_t>(2, size / 128);
+        const float slitOffset = cells / 12.0f;
+        const float slitHalfWidth = std::max(1.0f, cells / 80.0f);
+        const float ramp = cells / 16.0f;
+        float* mask = mask_.Data();
+        float* absorb = absorb_.Data();
+        ParallelFor(size, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                const float y = static_cast<float>(r) + 0.5f;
+                const float fromCenter = std::fabs(y - 0.5f * cells);
+                const bool inSlit = std::fabs(fromCenter - slitOffset) <= slitHalfWidth;
+                for (size_t c = 0; c < size; c++) {
+                    const float x = static_cast<float>(c) + 0.5f;
+                    const float edge = std::min(std::min(x, cells - x), std::min(y, cells - y));
+                    const float depth = edge < ramp ? (ramp - edge) / ramp : 0.0f;
+                    const bool wall = c >= wallLeft && c < wallRight && !inSlit;
+                    absorb[r * size + c] = 1.0f - 0.1f * depth * depth;
+                    mask[r * size + c] = wall ? 0.0f : absorb[r * size + c];
+                }
+            }
+        });
+    }
+    Launch();
+}
+
+void WaveField::Launch() {
+    const size_t n = n_;
+    const float cells = static_cast<float>(n);
+    const float k0 = TWO_PI * 64.0f / cells;
+    const float sigma = cells / 20.0f;
+    const float x0 = 0.2f * cells;
+    const float y0 = 0.5f * cells;
+    const float amplitude = 1.0f / std::sqrt(TWO_PI * sigma * sigma);
+    float* re = re_.Data();
+    float* im = im_.Data();
+    ParallelFor(n, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const float dy = static_cast<float>(r) - y0;
+            for (size_t c = 0; c < n; c++) {
+                const float dx = static_cast<float>(c) - x0;
+                const float envelope = amplitude * std::exp(-(dx * dx + dy * dy) / (4.0f * sigma * sigma));
+                re[r * n + c] = envelope * std::cos(k0 * dx);
+                im[r * n + c] = envelope * std::sin(k0 * dx);
+            }
+        }
+    });
+    steps_ = 0;
+}
+
+bool WaveField::Advance(float frames) {
+    pending_ += frames;
+    bool stepped = false;
+    while (pending_ >= 1.0f) {
+        Step();
+        pending_ -= 1.0f;
+        stepped = true;
+    }
+    return stepped;
+}
+
+void WaveField::Step() {
+    if (solver_ == WAVE_SOLVER_CRANK_NICOLSON) {
+        StepCrankNicolson();
+        return;
+    }
+    const size_t n = n_;
+    float* re = re_.Data();
+    float* im = im_.Data();
+    const float* mask = mask_.Data();
+    ParallelFor(n, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t i = begin * n; i < end * n; i++) {
+            re[i] *= mask[i];
+            im[i] *= mask[i];
+        }
+    });
+    fft_.Forward(re, im);
+    // The spectrum comes back transposed, which the symmetric factor
+    // kinetic[row] * kinetic[column] does not notice.
+    const float* kineticRe = kineticRe_.Data();
+    const float* kineticIm = kineticIm_.Data();
+    ParallelFor(n, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            float* rowRe = re + r * n;
+            float* rowIm = im + r * n;
+            const float ar = kineticRe[r];
+            const float ai = kineticIm[r];
+            for (size_t c = 0; c < n; c++) {
+                const float fr = ar * kineticRe[c] - ai * kineticIm[c];
+                const float fi = ar * kineticIm[c] + ai * kineticRe[c];
+                const float vr = rowRe[c];
+                const float vi = rowIm[c];
+                rowRe[c] = vr * fr - vi * fi;
+                rowIm[c] = vr * fi + vi * fr;
+            }
+        }
+    });
+    fft_.Inverse(re, im);
+    steps_++;
+}
+
+void WaveField::StepCrankNicolson() {
+    const size_t n = n_;
+    float* re = re_.Data();
+    float* im = im_.Data();
+    if (adi_.Size() != n) {
+        const float k0 = TWO_PI * 64.0f / static_cast<float>(n);
+        const float barrier = WAVE_BARRIER_ENERGY * 0.5f * k0 * k0;
+        std::vector<float> potential(n * n);
+        const float* mask = mask_.Data();
+        for (size_t i = 0; i < n * n; i++) potential[i] = mask[i] == 0.0f ? barrier : 0.0f;
+        adi_.Resize(n, dt_, potential.data());
+    }
+    const float* absorb = absorb_.Data();
+    ParallelFor(n, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t i = begin * n; i < end * n; i++) {
+            re[i] *= absorb[i];
+            im[i] *= absorb[i];
+        }
+    });
+    adi_.Step(re, im);
+    steps_++;
+}
+
+void WaveField::UpdateDensity() {
+    const size_t n = n_;
+    const float* re = re_.Data();
+    const float* im = im_.Data();
+    float* density = density_.Data();
+    float* cumulative = cellCumulative_.Data();
+    float* rows = rowCumulative_.Data();
+    std::vector<float> rowPeak(n);
+    ParallelFor(n, WAVE_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            float sum = 0.0f;
+            float peak = 0.0f;
+            for (size_t i = r * n; i < (r + 1) * n; i++) {
+                density[i] = re[i] * re[i] + im[i] * im[i];
+                peak = std::max(peak, density[i]);
+                sum += density[i];
+                cumulative[i] = sum;
+            }
+            rows[r] = sum;
+            rowPeak[r] = peak;
+        }
+    });
+    float total = 0.0f;
+    float peak = 0.0f;
+    for (size_t r = 0; r < n; r++) {
+        total += rows[r];
+        rows[r] = total;
+        peak = std::max(peak, rowPeak[r]);
+    }
+    norm_ = total;
+    peak_ = peak;
+    if (norm_ < WAVE_RELAUNCH_NORM) {
+        Launch();
+        UpdateDensity();
+    }
+}
+
+Vector2 WaveField::Sample(float u0, float u1) const {
+    const size_t n = n_;
+    if (n == 0 || norm_ <= 0.0f) return {0.5f * n, 0.5f * n};
+    const float* rows = rowCumulative_.Data();
+    const float target = u0 * norm_;
+    size_t r = static_cast<size_t>(std::upper_bound(rows, rows + n, target) - rows);
+    if (r >= n) r = n - 1;
+    const float rowStart = r > 0 ? rows[r - 1] : 0.0f;
+    const float rowMass = rows[r] - rowStart;
+    // Where the target fell inside its row's mass places the sample within
+    // the row, so one uniform covers both the row choice and the jitter.
+    const float fy = rowMass > 0.0f ? std::min(std::max((target - rowStart) / rowMass, 0.0f), 0.999f) : 0.5f;
+
+    const float* cells = cellCumulative_.Data() + r * n;
+    const float columnTarget = u1 * cells[n - 1];
+    size_t c = static_cast<size_t>(std::upper_bound(cells, cells + n, columnTarget) - cells);
+    if (c >= n) c = n - 1;
+    const float cellStart = c > 0 ? cells[c - 1] : 0.0f;
+    const float cellMass = cells[c] - cellStart;
+    const float fx = cellMass > 0.0f ? std::min(std::max((columnTarget - cellStart) / cellMass, 0.0f), 0.999f) : 0.5f;
+    return {static_cast<float>(c) + fx, static_cast<float>(r) + fy};
+}
+
+WaveField& GetWaveField() {
+    static WaveField field;
+    return field;
+}
@@ -0,0 +1,106 @@
+#ifndef WAVE_FIELD_H
+#define WAVE_FIELD_H
+
+#include "crank_nicolson.h"
+#include "fft.h"
+#include "particle_system.h"
+
+const size_t WAVE_GRID_MIN = 16;
+const size_t WAVE_GRID_MAX = 2048;
+// Grid the interactive view starts with; 1024 and up want several cores.
+const size_t WAVE_GRID_DEFAULT = 512;
+
+// Chance per frame that a WAVE_PARTICLE_DUALITY particle is detected again at
+// a position drawn from |psi|^2.
+const float WAVE_DETECT_RATE = 0.05f;
+
+// A new packet is launched once less than this much probability is left on
+// the grid (the rest went into the barrier or the absorbing edges).
+const float WAVE_RELAUNCH_NORM = 0.1f;
+
+enum WaveSolver {
+    // Spectral kinetic step; the barrier is a mask that zeroes psi.
+    WAVE_SOLVER_SPLIT_STEP,
+    // Finite differences, implicit, with the barrier as a tall potential.
+    // The stencil slows short waves: with the packet's n / 64 wavelength it
+    // runs about 10% behind at 512 and takes 1024 and up to keep pace.
+    WAVE_SOLVER_CRANK_NICOLSON,
+    WAVE_SOLVER_COUNT
+};
+
+// Short name used on the command line and in benchmark output.
+const char* WaveSolverName(WaveSolver solver);
+
+// A 2D wavefunction on a square n x n grid (hbar = m = 1, unit cells) sent at
+// a double slit. With the split-step solver, Step() is one Fourier update:
+//   psi *= mask;  psi = IFFT(e^(-i k^2 dt / 2) FFT(psi))
+// where the mask is zero inside the barrier and fades towards the edges so
+// the packet is absorbed instead of wrapping around the periodic grid. The
+// Crank-Nicolson solver applies only the fade, and sees the barrier as a
+// potential well above the packet's energy.
+class WaveField {
+public:
+    WaveField();
+
+    // Rounds n to a power of two in [WAVE_GRID_MIN, WAVE_GRID_MAX] and
+    // launches a fresh packet.
+    void Resize(size_t n);
+    size_t Size() const { return n_; }
+    uint64_t Steps() const { return steps_; }
+
+    // Takes effect from the next Step(), on the current wavefunction.
+    void SetSolver(WaveSolver solver) { solver_ = solver; }
+    WaveSolver Solver() const { return solver_; }
+
+    // A Gaussian packet left of the slits, moving right.
+    void Launch();
+    void Step();
+    // Runs one Step() per frame of simulated time, carrying fractions over
+    // to the next call. Returns whether it stepped.
+    bool Advance(float frames);
+
+    // Computes |psi|^2 and the tables Sample() draws from. Relaunches the
+    // packet when too little of it is left.
+    void UpdateDensity();
+    const float* Density() const { return density_.Data(); }
+    float DensityPeak() const { return peak_; }
+    float Norm() const { return norm_; }
+    // 1 where the wave moves freely, 0 inside the barrier.
+    const float* Mask() const { return mask_.Data(); }
+
+    // A position in grid units distributed as the last UpdateDensity, from
+    // two uniforms in [0, 1).
+    Vector2 Sample(float u0, float u1) const;
+
+private:
+    void StepCrankNicolson();
+
+    size_t n_;
+    uint64_t steps_;
+    float pending_;
+    float dt_;
+    float norm_;
+    float peak_;
+    WaveSolver solver_;
+    Fft2D fft_;
+    // Set up on the first Crank-Nicolson step after a resize.
+    CrankNicolsonAdi adi_;
+    AlignedArray<float> re_;
+    AlignedArray<float> im_;
+    AlignedArray<float> mask_;
+    // The mask without the barrier: just the fade at the edges.
+    AlignedArray<float> absorb_;
+    // Kinetic phase per wavenumber, with the 1 / n^2 of the round trip folded
+    // in; separable, so one row serves both axes.
+    AlignedArray<float> kineticRe_;
+    AlignedArray<float> kineticIm_;
+    AlignedArray<float> density_;
+    // Running sum of density_ along each row, and of the row totals.
+    AlignedArray<float> cellCumulative_;
+    AlignedArray<float> rowCumulative_;
+};
+
+// The field the WAVE_PARTICLE_DUALITY principle and its renderer share.
+WaveField& GetWaveField();
+
+#endif